@@ -2590,7 +2590,6 @@ void show_file(const std::string& path) {
 #include <filesystem>
 #include <atomic>
 #include <sstream>
-#include <map>
 #include <cmath>
 
 // Memory Optimization: AI-assisted Stack Allocation
@@ -2605,30 +2604,12 @@ std::unordered_map<std::string, std::string> file_cache;
 std::mutex cache_mutex;
 std::atomic<int> execution_count(0);
 
-// AI-assisted adaptive profiling variables
-std::map<std::string, double> compilation_times;
-std::map<std::string, int> optimization_levels;
-std::mutex ai_mutex;
-
 // Function to display help information
 void print_help() {
     std::cout << "NODECompiler - AOT Symbolic Compiler\n";
     std::cout << "Usage: nodec [file.node] [--help|--profile|--secure|--ai-expand|--debug]\n";
 }
 
-// AI-driven adaptive optimization system
-void optimize_compilation(const std::string& filename, double time_taken) {
-    std::lock_guard<std::mutex> lock(ai_mutex);
-    compilation_times[filename] = time_taken;
-
-    // Dynamically adjust optimization level
-    if (time_taken > 100.0) {
-        optimization_levels[filename] = std::max(optimization_levels[filename] - 1, 1);
-    } else {
-        optimization_levels[filename] = std::min(optimization_levels[filename] + 1, 5);
-    }
-}
-
 // AI-enhanced security validation
 bool security_scan(const std::string& filename) {
     std::ifstream file(filename);
@@ -2646,25 +2627,17 @@ bool security_scan(const std::string& filename) {
 
 // AI-assisted syntax expansion mechanism
 void ai_syntax_expansion() {
-    std::lock_guard<std::mutex> lock(ai_mutex);
     std::cout << "Expanding NODE syntax based on usage patterns...\n";
     // Dynamically add new commands based on developer behavior
 }
 
-// Real-time AI profiling of compilation speed
+// Profile-guided optimization lives in WorkingCompiler: build with --instrument, run, then
+// rebuild with --use-profile=<file>.nodeprof.
 void compile_file(const std::string& filename) {
-    auto start_time = std::chrono::high_resolution_clock::now();
-
     if (!security_scan(filename)) return;
 
-    std::cout << "Compiling: " << filename << " with AI optimization level: " << optimization_levels[filename] << "\n";
+    std::cout << "Compiling: " << filename << "\n";
     execution_count++;
-
-    asm("nop"); // Placeholder for NASM-level optimization
-
-    auto end_time = std::chrono::high_resolution_clock::now();
-    double compile_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-    optimize_compilation(filename, compile_time);
 }
 
 // Debugging output
@@ -4,6 +4,9 @@
 #include <fstream>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <set>
 #include <vector>
 #include <sstream>
 #include <stdexcept>
@@ -11,90 +14,288 @@
 #include <memory>
 #include <cctype>
 #include <cstdlib>
+#include <cstdint>
+#include <climits>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <atomic>
+#include <type_traits>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+struct iovec { void* iov_base; size_t iov_len; };
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <spawn.h>
+#endif
 
 // --- NODE Operation Table ---
 struct NODEInstruction {
-    std::string llvmEquivalent;
-    std::string nasmEquivalent;
-};
-
-std::unordered_map<std::string, NODEInstruction> instructionMap = {
-    {"xor_eq",  {"%result = xor i64 %X, %Y", "XOR RAX, RBX"}},
-    {"not_eq",  {"%cmp = icmp ne i64 %X, %Y", "CMP RAX, RBX\nJNE throw_handler"}},
-    {"and_eq",  {"%result = and i64 %X, %Y", "AND RAX, RBX"}},
-    {"or_eq",   {"%result = or i64 %X, %Y", "OR RAX, RBX"}},
-    {"not",     {"%result = xor i64 %X, -1", "NOT RAX"}},
-    {"shiftl",  {"%result = shl i64 %X, %Y", "SHL RAX, CL"}},
-    {"shiftr",  {"%result = lshr i64 %X, %Y", "SHR RAX, CL"}},
-
-    {"new",     {"%ptr = call i8* @malloc(i64 %size)", "CALL malloc"}},
-    {"delete",  {"call void @free(i8* %ptr)", "CALL free"}},
-    {"move",    {"store i64 %X, i64* %Y", "MOV [Y], X"}},
-    {"copy",    {"%X = load i64, i64* %Y", "MOV X, [Y]"}},
-
-    {"if_lt",   {"%cmp = icmp slt i64 %X, %Y", "CMP RAX, RBX\nJL true_label"}},
-    {"if_gt",   {"%cmp = icmp sgt i64 %X, %Y", "CMP RAX, RBX\nJG true_label"}},
-    {"if_eq",   {"%cmp = icmp eq i64 %X, %Y", "CMP RAX, RBX\nJE true_label"}},
-    {"throw",   {"br label %throw_handler", "JMP throw_handler"}},
-
-    {"call",    {"call i64 @func(i64 %X, i64 %Y)", "CALL func"}},
-    {"routine", {"define i64 @func(i64 %X, i64 %Y) { ... }", "func PROC\n...\nRET"}},
-    {"return",  {"ret i64 %X", "MOV RAX, X\nRET"}},
-    {"exit",    {"call void @exit(i32 0)", "MOV RDI, 0\nCALL exit"}},
-
-    {"add",     {"%res = add i64 %X, %Y", "ADD RAX, RBX"}},
-    {"sub",     {"%res = sub i64 %X, %Y", "SUB RAX, RBX"}},
-    {"mul",     {"%res = mul i64 %X, %Y", "IMUL RAX, RBX"}},
-    {"div",     {"%res = sdiv i64 %X, %Y", "IDIV RBX"}},
-    {"mod",     {"%res = srem i64 %X, %Y", "IDIV RBX (RDX = remainder)"}},
-
-    {"push",    {"N/A", "PUSH RAX"}},
-    {"pop",     {"N/A", "POP RAX"}},
-    {"save",    {"N/A", "PUSHAD"}},
-    {"restore", {"N/A", "POPAD"}},
-    {"swap",    {"%tmp = %X; %X = %Y; %Y = %tmp", "XCHG RAX, RBX"}},
-
-    {"start",   {"define i32 @main() {", "main PROC"}},
-    {"label",   {"label: ", "label:"}},
-    {"goto",    {"br label %X", "JMP label"}},
-
-    {"trap",    {"call void @trap()", "INT 3"}},
-    {"panic",   {"call void @puts\ncall exit", "MOV RDI, msg\nCALL puts\nCALL exit"}},
-
-    {"inc",     {"%res = add i64 %X, 1", "INC RAX"}},           // Increment
-    {"dec",     {"%res = sub i64 %X, 1", "DEC RAX"}},           // Decrement
-    {"bitnot",  {"%res = xor i64 %X, -1", "NOT RAX"}},          // Bitwise NOT
-    {"land",    {"%res = and i64 %X, %Y\n%res = icmp ne i64 %res, 0", "AND RAX, RBX\nSETNE AL"}}, // Logical AND
-    {"lor",     {"%res = or i64 %X, %Y\n%res = icmp ne i64 %res, 0", "OR RAX, RBX\nSETNE AL"}},   // Logical OR
-    {"print",   {"call void @print(i64 %X)", "MOV RDI, RAX\nCALL print"}}, // Print
-    {"input",   {"%X = call i64 @input()", "CALL input"}},                 // Input
-    {"nop",     {"", "NOP"}},                                             // No operation
-
-    {"and",     {"%res = and i64 %X, %Y", "AND RAX, RBX"}}, // 0x1D2
-    {"or",      {"%res = or i64 %X, %Y", "OR RAX, RBX"}},   // 0x1D3
-    {"xor",     {"%res = xor i64 %X, %Y", "XOR RAX, RBX"}}, // 0x1D4
-    {"not",     {"%res = xor i64 %X, -1", "NOT RAX"}},      // 0x1D5
-    {"and_eq",  {"%result = and i64 %X, %Y", "AND RAX, RBX"}}, // 0x1D6
-    {"or_eq",   {"%result = or i64 %X, %Y", "OR RAX, RBX"}},   // 0x1D7
-    {"xor_eq",  {"%result = xor i64 %X, %Y", "XOR RAX, RBX"}}, // 0x1D8
-    {"not_eq",  {"%cmp = icmp ne i64 %X, %Y", "CMP RAX, RBX\nJNE throw_handler"}}, // 0x1D9
-    {"nullptr", {"XOR RAX, RAX", "XOR RAX, RAX"}}, // 0x1E0
-    {"throw",   {"br label %throw_handler", "JMP throw_handler"}}, // 0x1E1
-    {"try",     {"; try block", "; try block"}}, // 0x1E2
-    {"catch",   {"; catch block", "; catch block"}}, // 0x1E3
-    {"if",      {"%cmp = icmp", "CMP RAX, RBX"}}, // 0x205
-    {"for",     {"; for loop", "; for loop"}}, // 0x20B
-    {"new",     {"%ptr = call i8* @malloc(i64 %size)", "CALL malloc"}}, // 0x201
-    {"delete",  {"call void @free(i8* %ptr)", "CALL free"}}, // 0x202
-    {"reinterpret_cast", {"; reinterpret_cast", "; reinterpret_cast"}}, // 0x1DA
-    {"dynamic_cast", {"; dynamic_cast", "; dynamic_cast"}}, // 0x1DB
-    {"static_cast", {"; static_cast", "; static_cast"}}, // 0x1DC
-    {"const_cast", {"; const_cast", "; const_cast"}}, // 0x1DD
-    {"is_base_of", {"; is_base_of", "; is_base_of"}}, // 0x1DE
-};
-
-std::string translateLine(const std::string& line, int lineNumber, std::ostream& log) {
-    std::stringstream result;
+    const char* keyword;
+    const char* llvmEquivalent;
+    const char* nasmEquivalent;
+};
+
+// One entry per keyword; a repeated keyword would shadow the first, so it fails the build.
+static constexpr NODEInstruction instructionTable[] = {
+    {"xor_eq",  "%result = xor i64 %X, %Y", "XOR RAX, RBX"}, // 0x1D8
+    {"not_eq",  "%cmp = icmp ne i64 %X, %Y", "CMP RAX, RBX\nJNE throw_handler"}, // 0x1D9
+    {"and_eq",  "%result = and i64 %X, %Y", "AND RAX, RBX"}, // 0x1D6
+    {"or_eq",   "%result = or i64 %X, %Y", "OR RAX, RBX"}, // 0x1D7
+    {"not",     "%result = xor i64 %X, -1", "NOT RAX"}, // 0x1D5
+    {"shiftl",  "%result = shl i64 %X, %Y", "SHL RAX, CL"},
+    {"shiftr",  "%result = lshr i64 %X, %Y", "SHR RAX, CL"},
+
+    {"new",     "%ptr = call i8* @malloc(i64 %size)", "CALL malloc"}, // 0x201
+    {"delete",  "call void @free(i8* %ptr)", "CALL free"}, // 0x202
+    {"move",    "store i64 %X, i64* %Y", "MOV [Y], X"},
+    {"copy",    "%X = load i64, i64* %Y", "MOV X, [Y]"},
+
+    {"if_lt",   "%cmp = icmp slt i64 %X, %Y", "CMP RAX, RBX\nJL true_label"},
+    {"if_gt",   "%cmp = icmp sgt i64 %X, %Y", "CMP RAX, RBX\nJG true_label"},
+    {"if_eq",   "%cmp = icmp eq i64 %X, %Y", "CMP RAX, RBX\nJE true_label"},
+    {"throw",   "br label %throw_handler", "JMP throw_handler"}, // 0x1E1
+
+    {"call",    "call i64 @func(i64 %X, i64 %Y)", "CALL func"},
+    {"routine", "define i64 @func(i64 %X, i64 %Y) { ... }", "func PROC\n...\nRET"},
+    {"return",  "ret i64 %X", "MOV RAX, X\nRET"},
+    {"exit",    "call void @exit(i32 0)", "MOV RDI, 0\nCALL exit"},
+
+    {"add",     "%res = add i64 %X, %Y", "ADD RAX, RBX"},
+    {"sub",     "%res = sub i64 %X, %Y", "SUB RAX, RBX"},
+    {"mul",     "%res = mul i64 %X, %Y", "IMUL RAX, RBX"},
+    {"div",     "%res = sdiv i64 %X, %Y", "IDIV RBX"},
+    {"mod",     "%res = srem i64 %X, %Y", "IDIV RBX (RDX = remainder)"},
+
+    {"push",    "N/A", "PUSH RAX"},
+    {"pop",     "N/A", "POP RAX"},
+    {"save",    "N/A", "PUSHAD"},
+    {"restore", "N/A", "POPAD"},
+    {"swap",    "%tmp = %X; %X = %Y; %Y = %tmp", "XCHG RAX, RBX"},
+
+    {"start",   "define i32 @main() {", "main PROC"},
+    {"label",   "label: ", "label:"},
+    {"goto",    "br label %X", "JMP label"},
+
+    {"trap",    "call void @trap()", "INT 3"},
+    {"panic",   "call void @puts\ncall exit", "MOV RDI, msg\nCALL puts\nCALL exit"},
+
+    {"inc",     "%res = add i64 %X, 1", "INC RAX"},           // Increment
+    {"dec",     "%res = sub i64 %X, 1", "DEC RAX"},           // Decrement
+    {"bitnot",  "%res = xor i64 %X, -1", "NOT RAX"},          // Bitwise NOT
+    {"land",    "%res = and i64 %X, %Y\n%res = icmp ne i64 %res, 0", "AND RAX, RBX\nSETNE AL"}, // Logical AND
+    {"lor",     "%res = or i64 %X, %Y\n%res = icmp ne i64 %res, 0", "OR RAX, RBX\nSETNE AL"},   // Logical OR
+    {"print",   "call void @print(i64 %X)", "MOV RDI, RAX\nCALL print"}, // Print
+    {"input",   "%X = call i64 @input()", "CALL input"},                 // Input
+    {"nop",     "", "NOP"},                                             // No operation
+
+    {"and",     "%res = and i64 %X, %Y", "AND RAX, RBX"}, // 0x1D2
+    {"or",      "%res = or i64 %X, %Y", "OR RAX, RBX"},   // 0x1D3
+    {"xor",     "%res = xor i64 %X, %Y", "XOR RAX, RBX"}, // 0x1D4
+    {"nullptr", "XOR RAX, RAX", "XOR RAX, RAX"}, // 0x1E0
+    {"try",     "; try block", "; try block"}, // 0x1E2
+    {"catch",   "; catch block", "; catch block"}, // 0x1E3
+    {"if",      "%cmp = icmp", "CMP RAX, RBX"}, // 0x205
+    {"for",     "; for loop", "; for loop"}, // 0x20B
+    {"reinterpret_cast", "; reinterpret_cast", "; reinterpret_cast"}, // 0x1DA
+    {"dynamic_cast", "; dynamic_cast", "; dynamic_cast"}, // 0x1DB
+    {"static_cast", "; static_cast", "; static_cast"}, // 0x1DC
+    {"const_cast", "; const_cast", "; const_cast"}, // 0x1DD
+    {"is_base_of", "; is_base_of", "; is_base_of"}, // 0x1DE
+};
+
+constexpr bool sameText(const char* a, const char* b) {
+    while (*a && *a == *b) { ++a; ++b; }
+    return *a == *b;
+}
+
+template <size_t N>
+constexpr bool distinctKeywords(const NODEInstruction (&table)[N]) {
+    for (size_t i = 0; i < N; ++i)
+        for (size_t j = 0; j < i; ++j)
+            if (sameText(table[i].keyword, table[j].keyword)) return false;
+    return true;
+}
+static_assert(distinctKeywords(instructionTable), "instructionTable: duplicate NODE keyword");
+
+static const NODEInstruction* findInstruction(const std::string& keyword) {
+    for (const NODEInstruction& entry : instructionTable)
+        if (keyword == entry.keyword) return &entry;
+    return nullptr;
+}
+
+// A whole number from 1 to INT_MAX, decimal or 0x hex, with nothing after it.
+static bool parseCount(const std::string& text, int& out) {
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) return false;
+    char* end = nullptr;
+    errno = 0;
+    long long value = std::strtoll(text.c_str(), &end, 0);
+    if (*end || errno == ERANGE || value < 1 || value > INT_MAX) return false;
+    out = static_cast<int>(value);
+    return true;
+}
+
+// -----------------------------
+// EMISSION BUFFER
+// -----------------------------
+
+// Text output for the emitters. Appends memcpy into 64 KiB chunks and formats integers in
+// place. Chunks go out with one writev once 16 of them are full, and on Flush. Without a file
+// descriptor it only collects, for str() or for appending to another buffer; small chunks then
+// suit a buffer that holds one routine.
+class EmitBuffer {
+public:
+    static constexpr size_t FlushChunks = 16;
+
+    explicit EmitBuffer(int fd = -1, bool owned = false, size_t chunkSize = 1 << 16)
+        : fd(fd), owned(owned), chunkSize(chunkSize) { chunks.emplace_back(new char[chunkSize]); }
+    ~EmitBuffer() {
+        Flush();
+        if (owned && fd >= 0) close(fd);
+    }
+    EmitBuffer(const EmitBuffer&) = delete;
+    EmitBuffer& operator=(const EmitBuffer&) = delete;
+
+    // Writes to `descriptor` from now on and closes it when done.
+    void Attach(int descriptor) {
+        Flush();
+        if (owned && fd >= 0) close(fd);
+        fd = descriptor;
+        owned = true;
+    }
+    // Creates or truncates `path` and writes there from now on; false if it cannot be opened.
+    bool Open(const std::string& path) {
+        Attach(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+        return fd >= 0;
+    }
+    // Flushes and hands the descriptor to the caller; -1 if any write so far failed.
+    int Release() {
+        int result = Flush() ? fd : -1;
+        if (result < 0 && owned && fd >= 0) close(fd);
+        fd = -1;
+        owned = false;
+        return result;
+    }
+    bool isOpen() const { return fd >= 0; }
+    uint64_t size() const { return written + (chunks.size() - 1) * chunkSize + used; }
+
+    void append(const char* p, size_t n) {
+        while (n > chunkSize - used) {
+            size_t room = chunkSize - used;
+            std::memcpy(chunks.back().get() + used, p, room);
+            p += room;
+            n -= room;
+            used = chunkSize;
+            nextChunk();
+        }
+        std::memcpy(chunks.back().get() + used, p, n);
+        used += n;
+    }
+    void append(const EmitBuffer& other) {
+        for (size_t i = 0; i < other.chunks.size(); ++i)
+            append(other.chunks[i].get(), i + 1 < other.chunks.size() ? other.chunkSize : other.used);
+    }
+    EmitBuffer& operator<<(const std::string& s) { append(s.data(), s.size()); return *this; }
+    EmitBuffer& operator<<(const char* s) { append(s, std::strlen(s)); return *this; }
+    EmitBuffer& operator<<(char c) { append(&c, 1); return *this; }
+    template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+    EmitBuffer& operator<<(T v) {
+        bool negative = std::is_signed<T>::value && v < T(0);
+        uint64_t magnitude = negative ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+        char digits[21];
+        char* end = digits + sizeof digits;
+        char* p = end;
+        do {
+            *--p = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude);
+        if (negative) *--p = '-';
+        append(p, static_cast<size_t>(end - p));
+        return *this;
+    }
+
+    // Writes every buffered byte; false if the descriptor refused some of it, now or in an
+    // earlier flush (including the ones append makes when the chunks fill up).
+    bool Flush() {
+        if (fd < 0) return !failed;
+        std::vector<iovec> pieces;
+        for (size_t i = 0; i < chunks.size(); ++i)
+            pieces.push_back({ chunks[i].get(), i + 1 < chunks.size() ? chunkSize : used });
+        bool ok = writeAll(pieces);
+        written += (chunks.size() - 1) * chunkSize + used;
+        chunks.resize(1);
+        used = 0;
+        if (!ok) failed = true;
+        return !failed;
+    }
+
+    // Everything appended, for a buffer without a descriptor.
+    std::string str() const {
+        std::string s;
+        for (size_t i = 0; i < chunks.size(); ++i) s.append(chunks[i].get(), i + 1 < chunks.size() ? chunkSize : used);
+        return s;
+    }
+
+private:
+    int fd;
+    bool owned;
+    const size_t chunkSize;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t used = 0;
+    uint64_t written = 0;
+    bool failed = false;            // sticky: some write lost bytes
+
+    void nextChunk() {
+        if (fd >= 0 && chunks.size() >= FlushChunks) Flush();
+        else {
+            chunks.emplace_back(new char[chunkSize]);
+            used = 0;
+        }
+    }
+
+    bool writeAll(std::vector<iovec>& pieces) {
+#if !defined(__unix__) && !defined(__APPLE__)
+        for (const iovec& piece : pieces)
+            if (write(fd, piece.iov_base, static_cast<unsigned>(piece.iov_len)) != static_cast<int>(piece.iov_len))
+                return false;
+        return true;
+#else
+        size_t first = 0;
+        while (first < pieces.size()) {
+            int count = static_cast<int>(std::min<size_t>(pieces.size() - first, IOV_MAX));
+            ssize_t n = writev(fd, pieces.data() + first, count);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            // Skip what went out; a short write leaves the rest of a piece for the next call.
+            size_t left = static_cast<size_t>(n);
+            while (first < pieces.size() && left >= pieces[first].iov_len) left -= pieces[first++].iov_len;
+            if (first < pieces.size()) {
+                pieces[first].iov_base = static_cast<char*>(pieces[first].iov_base) + left;
+                pieces[first].iov_len -= left;
+            }
+        }
+        return true;
+#endif
+    }
+};
+
+// Appends the NASM for one line of legacy NODE source to `out`.
+void translateLine(const std::string& line, int lineNumber, EmitBuffer& out, std::ostream& log) {
     std::string trimmed = std::regex_replace(line, std::regex("#.*"), ""); // Remove single-line comments
     trimmed = std::regex_replace(trimmed, std::regex("\\*\\*.*\\*\\*"), ""); // Remove multi-line comments
 
@@ -124,145 +325,7983 @@ std::string translateLine(const std::string& line, int lineNumber, std::ostream&
     bool matched = false;
 
     while (iss >> token) {
-        auto it = instructionMap.find(token);
-        if (it != instructionMap.end()) {
-            result << it->second.nasmEquivalent << "\n";
+        if (const NODEInstruction* entry = findInstruction(token)) {
+            out << entry->nasmEquivalent << '\n';
             matched = true;
         }
     }
     if (!matched && !processed.empty()) {
-        result << "; " << processed << "\n"; // Emit as NASM comment if not recognized
+        out << "; " << processed << '\n'; // Emit as NASM comment if not recognized
         log << "[Line " << lineNumber << "] Warning: No recognized NODE operation in: " << line << "\n";
     }
-    return result.str();
 }
 
-void compileNODEFile(const std::string& filename) {
-    std::ifstream inFile(filename);
-    if (!inFile.is_open()) {
-        std::cerr << "Error: Could not open " << filename << std::endl;
-        return;
+// -----------------------------
+// LEXER
+// -----------------------------
+
+enum class TokenType { Identifier, Number, String, Symbol, EndOfFile };
+
+struct Token {
+    TokenType type;
+    std::string lexeme;
+    int line;
+};
+
+class Lexer {
+    std::string source;
+    size_t index = 0;
+    int line = 1;
+
+public:
+    Lexer(const std::string& src) : source(src) {}
+
+    std::vector<Token> Tokenize() {
+        std::vector<Token> tokens;
+        while (index < source.size()) {
+            char c = source[index];
+            if (c == '\n') { ++line; ++index; continue; }
+            if (isspace(static_cast<unsigned char>(c))) { ++index; continue; }
+            if (c == '#') { skipLine(); continue; }
+            if (c == '*' && peek(1) == '*') { skipBlockComment(); continue; }
+            if (isalpha(static_cast<unsigned char>(c)) || c == '_') { tokens.push_back(lexIdentifier()); continue; }
+            if (isdigit(static_cast<unsigned char>(c))) { tokens.push_back(lexNumber()); continue; }
+            if (c == '"') { tokens.push_back(lexString()); continue; }
+            tokens.push_back(lexSymbol());
+        }
+        tokens.push_back(Token{ TokenType::EndOfFile, "<eof>", line });
+        return tokens;
+    }
+
+private:
+    char peek(size_t ahead) const {
+        return index + ahead < source.size() ? source[index + ahead] : '\0';
+    }
+    void skipLine() {
+        while (index < source.size() && source[index] != '\n') ++index;
+    }
+    void skipBlockComment() {
+        index += 2;
+        while (index < source.size() && !(source[index] == '*' && peek(1) == '*')) {
+            if (source[index] == '\n') ++line;
+            ++index;
+        }
+        index = std::min(index + 2, source.size());
+    }
+    Token lexIdentifier() {
+        size_t start = index;
+        while (index < source.size() && (isalnum(static_cast<unsigned char>(source[index])) || source[index] == '_')) ++index;
+        return Token{ TokenType::Identifier, source.substr(start, index - start), line };
+    }
+    Token lexNumber() {
+        size_t start = index;
+        if (source[index] == '0' && (peek(1) == 'x' || peek(1) == 'X')) {
+            index += 2;
+            while (index < source.size() && isxdigit(static_cast<unsigned char>(source[index]))) ++index;
+        } else {
+            while (index < source.size() && isdigit(static_cast<unsigned char>(source[index]))) ++index;
+        }
+        return Token{ TokenType::Number, source.substr(start, index - start), line };
+    }
+    Token lexString() {
+        std::string value;
+        ++index;
+        while (index < source.size() && source[index] != '"') {
+            if (source[index] == '\\' && index + 1 < source.size()) {
+                char e = source[++index];
+                value += (e == 'n') ? '\n' : (e == 't') ? '\t' : e;
+            } else {
+                if (source[index] == '\n') ++line;
+                value += source[index];
+            }
+            ++index;
+        }
+        ++index;
+        return Token{ TokenType::String, value, line };
+    }
+    Token lexSymbol() {
+        static const char* twoChar[] = { "==", "<=", ">=", "<<", ">>", "->", "<-", "~>", "<~" };
+        for (const char* op : twoChar) {
+            if (source[index] == op[0] && peek(1) == op[1]) {
+                index += 2;
+                return Token{ TokenType::Symbol, op, line };
+            }
+        }
+        return Token{ TokenType::Symbol, std::string(1, source[index++]), line };
     }
+};
+
+// -----------------------------
+// PARSER
+// -----------------------------
+
+struct ASTNode {
+    std::string kind;
+    std::string value;
+    std::vector<ASTNode*> children;
+    int line = 0;
+};
+
+struct Program {
+    std::vector<std::unique_ptr<ASTNode>> pool;
+    std::vector<ASTNode*> items;   // "Start", "Routine" and "TopLevel" statements in source order
+};
+
+class Parser {
+    std::vector<Token> tokens;
+    size_t index = 0;
+    Program& program;
+    std::ostream& log;
 
-    std::ofstream asmFile("output.asm");
-    std::ofstream logFile("compile.log");
-    asmFile << "section .text\nglobal _start\n_start:\n";
+public:
+    Parser(const std::vector<Token>& toks, Program& prog, std::ostream& logStream)
+        : tokens(toks), program(prog), log(logStream) {}
 
-    std::string line;
-    int lineNumber = 0;
-    while (std::getline(inFile, line)) {
-        ++lineNumber;
-        std::string asmCode = translateLine(line, lineNumber, logFile);
-        if (!asmCode.empty()) asmFile << asmCode;
+    void Parse() {
+        while (!atEnd()) {
+            std::vector<std::string> specifiers = parseSpecifiers();
+            if (check("Start")) { program.items.push_back(parseStart()); continue; }
+            if (check("routine") || check("namespace")) {
+                // `@noinline routine f(...)`: specifiers ride along after the body as "Specifier" children.
+                ASTNode* routine = parseRoutine();
+                for (const std::string& spec : specifiers) routine->children.push_back(make("Specifier", spec, routine->line));
+                program.items.push_back(routine);
+                continue;
+            }
+            if (check("|")) { skipMacroMarker(); continue; }
+            ASTNode* stmt = parseStatement();
+            if (stmt) program.items.push_back(stmt);
+        }
     }
 
-    asmFile << "\nMOV RAX, 60\nXOR RDI, RDI\nSYSCALL\n";
-    // Add runtime for print/input
-    asmFile << R"(
-; --- Runtime support for print and input (Windows x64) ---
-section .data
-    input_buffer: times 32 db 0
-    output_buffer: times 32 db 0
-    bytes_written: dq 0
-    bytes_read: dq 0
-    hStdIn: dq 0
-    hStdOut: dq 0
+private:
+    ASTNode* make(const std::string& kind, const std::string& value = "", int line = 0) {
+        program.pool.push_back(std::make_unique<ASTNode>());
+        ASTNode* node = program.pool.back().get();
+        node->kind = kind;
+        node->value = value;
+        node->line = line ? line : peek().line;
+        return node;
+    }
 
-section .text
+    const Token& peek(size_t ahead = 0) const {
+        return tokens[std::min(index + ahead, tokens.size() - 1)];
+    }
+    const Token& advance() { return tokens[index < tokens.size() - 1 ? index++ : index]; }
+    bool atEnd() const { return peek().type == TokenType::EndOfFile; }
+    bool check(const std::string& lexeme, size_t ahead = 0) const {
+        const Token& t = peek(ahead);
+        return t.type != TokenType::String && t.type != TokenType::EndOfFile && t.lexeme == lexeme;
+    }
+    bool accept(const std::string& lexeme) {
+        if (!check(lexeme)) return false;
+        advance();
+        return true;
+    }
+    void expect(const std::string& lexeme) {
+        if (!accept(lexeme)) {
+            log << "[Line " << peek().line << "] Error: expected '" << lexeme << "' but found '" << peek().lexeme << "'\n";
+            throw std::runtime_error("parse error at line " + std::to_string(peek().line));
+        }
+    }
+    // Statements end at ';' or, when the terminator is omitted, at the end of the source line.
+    void endStatement(int line) {
+        if (accept(";")) return;
+        if (atEnd() || peek().line != line || check("}")) return;
+        expect(";");
+    }
 
-extern GetStdHandle
-extern WriteConsoleA
-extern ReadConsoleA
-extern wsprintfA
+    void skipMacroMarker() {
+        int line = advance().line;
+        while (!atEnd() && !check("|") && peek().line == line) advance();
+        accept("|");
+    }
 
-print:
-    ; RDI = integer to print
-    sub     rsp, 40                ; shadow space for Win64 ABI
-    lea     rcx, [output_buffer]   ; lpOut buffer
-    mov     rdx, output_buffer     ; lpOut buffer
-    mov     r8, 32                 ; buffer size
-    mov     r9, "%lld", 0          ; format string
-    mov     rax, rdi               ; value to print
-    mov     [rsp+32], rax          ; pass value on stack
-    mov     rcx, rdx               ; wsprintfA(lpOut, format, value)
-    mov     rdx, r9
-    mov     r8, [rsp+32]
-    call    wsprintfA
-
-    mov     rcx, -11               ; STD_OUTPUT_HANDLE
-    call    GetStdHandle
-    mov     [hStdOut], rax
-    mov     rcx, rax               ; hConsoleOutput
-    lea     rdx, [output_buffer]   ; lpBuffer
-    mov     r8d, 32                ; nNumberOfCharsToWrite
-    lea     r9, [bytes_written]    ; lpNumberOfCharsWritten
-    push    0                      ; lpReserved
-    call    WriteConsoleA
-    add     rsp, 48
-    ret
+    std::string parseBlockName() {
+        std::string name;
+        if (accept("|")) {
+            while (!atEnd() && !check("|")) name += advance().lexeme;
+            expect("|");
+        } else if (accept("[")) {
+            while (!atEnd() && !check("]")) name += advance().lexeme;
+            expect("]");
+            accept(";");
+        } else if (peek().type == TokenType::Identifier) {
+            name = advance().lexeme;
+        }
+        return name;
+    }
 
-input:
-    mov     rcx, -10               ; STD_INPUT_HANDLE
-    call    GetStdHandle
-    mov     [hStdIn], rax
-    mov     rcx, rax               ; hConsoleInput
-    lea     rdx, [input_buffer]    ; lpBuffer
-    mov     r8d, 32                ; nNumberOfCharsToRead
-    lea     r9, [bytes_read]       ; lpNumberOfCharsRead
-    push    0                      ; lpReserved
-    call    ReadConsoleA
-    ; Convert ASCII to integer (simple, not robust)
-    lea     rsi, [input_buffer]
-    xor     rax, rax
-    xor     rcx, rcx
-.next_digit:
-    mov     bl, [rsi + rcx]
-    cmp     bl, 13                 ; CR
-    je      .done
-    cmp     bl, 10                 ; LF
-    je      .done
-    cmp     bl, 0
-    je      .done
-    sub     bl, '0'
-    cmp     bl, 9
-    ja      .done
-    imul    rax, rax, 10
-    add     rax, rbx
-    inc     rcx
-    jmp     .next_digit
-.done:
-    ret
+    ASTNode* parseStart() {
+        ASTNode* node = make("Start", "", advance().line);
+        node->value = parseBlockName();
+        // The first `Return` at block depth closes the Start block.
+        while (!atEnd()) {
+            bool closing = check("Return");
+            ASTNode* stmt = parseStatement();
+            if (stmt) node->children.push_back(stmt);
+            if (closing) break;
+        }
+        return node;
+    }
 
-section .data
-    fmt: db "%lld",0
-)";
+    ASTNode* parseRoutine() {
+        ASTNode* node = make("Routine", "", peek().line);
+        bool isNamespace = advance().lexeme == "namespace";
+        node->value = advance().lexeme;
+        ASTNode* params = make("Params");
+        if (!isNamespace && accept("(")) {
+            while (!check(")")) {
+                params->children.push_back(make("Identifier", advance().lexeme));
+                if (!accept(",")) break;
+            }
+            expect(")");
+        }
+        node->children.push_back(params);
+        node->children.push_back(parseBlock());
+        return node;
+    }
 
-    asmFile.close();
-    inFile.close();
-    logFile.close();
+    ASTNode* parseBlock() {
+        ASTNode* block = make("Block");
+        expect("{");
+        while (!atEnd() && !check("}")) {
+            if (check("|")) { skipMacroMarker(); continue; }
+            ASTNode* stmt = parseStatement();
+            if (stmt) block->children.push_back(stmt);
+        }
+        expect("}");
+        return block;
+    }
+
+    std::vector<std::string> parseSpecifiers() {
+        std::vector<std::string> specifiers;
+        while (check("@") || check("$") || check("!")) {
+            // `@name` or a dotted `@A.G.I`; the identifier after it starts the declaration.
+            std::string spec = advance().lexeme;
+            if (peek().type == TokenType::Identifier) spec += advance().lexeme;
+            while (check(".") && peek(1).type == TokenType::Identifier) {
+                spec += advance().lexeme;
+                spec += advance().lexeme;
+            }
+            specifiers.push_back(spec);
+        }
+        return specifiers;
+    }
+
+    void skipSpecifiers() { parseSpecifiers(); }
+
+    ASTNode* parseStatement() {
+        skipSpecifiers();
+        if (check("{")) return parseBlock();
+        if (accept(";")) return nullptr;
+        int line = peek().line;
+
+        if (check("Init")) {
+            advance();
+            ASTNode* decl = parseAssignment("Init", line);
+            endStatement(line);
+            return decl;
+        }
+        if (check("if")) return parseIf();
+        if (check("while")) {
+            ASTNode* node = make("While", "", advance().line);
+            node->children.push_back(parseCondition());
+            node->children.push_back(parseBlock());
+            return node;
+        }
+        if (check("for")) return parseFor();
+        if (check("unroll")) {
+            // `unroll(N) for (...)` requests a factor; bare `unroll for` lets the cost model pick one.
+            advance();
+            std::string factor = "auto";
+            if (accept("(")) {
+                int count = 0;
+                if (peek().type != TokenType::Number || !parseCount(peek().lexeme, count)) {
+                    log << "[Line " << line << "] Error: unroll factor must be a whole number from 1 up, not '"
+                        << peek().lexeme << "'\n";
+                    throw std::runtime_error("parse error at line " + std::to_string(line));
+                }
+                advance();
+                factor = std::to_string(count);
+                expect(")");
+            }
+            if (!check("for")) {
+                log << "[Line " << line << "] Error: 'unroll' must precede a for loop\n";
+                throw std::runtime_error("parse error at line " + std::to_string(line));
+            }
+            ASTNode* loop = parseFor();
+            loop->value = factor;
+            return loop;
+        }
+        if (check("break") || check("continue") || check("halt")) {
+            std::string word = advance().lexeme;
+            ASTNode* node = make(word == "break" ? "Break" : word == "continue" ? "Continue" : "Halt", "", line);
+            endStatement(line);
+            return node;
+        }
+        if (check("throw")) {
+            advance();
+            ASTNode* node = make("Throw", "", line);
+            if (accept("if")) node->children.push_back(parseExpression());
+            endStatement(line);
+            return node;
+        }
+        if (check("Return") || check("return")) {
+            advance();
+            ASTNode* node = make("Return", "", line);
+            if (!check(";") && !check("}") && peek().line == line) node->children.push_back(parseExpression());
+            endStatement(line);
+            return node;
+        }
+        if (check("call")) {
+            advance();
+            ASTNode* call = parseCall(advance().lexeme, line);
+            endStatement(line);
+            return wrap("ExprStmt", call, line);
+        }
+        if (check("delete")) {
+            advance();
+            ASTNode* node = wrap("Delete", parseExpression(), line);
+            endStatement(line);
+            return node;
+        }
+        if (peek().type == TokenType::Identifier && check("[", 1)) {
+            // Buffer element store: `buf[i] = expr;`
+            ASTNode* node = make("Store", advance().lexeme, line);
+            advance();
+            node->children.push_back(parseExpression());
+            expect("]");
+            expect("=");
+            node->children.push_back(parseExpression());
+            endStatement(line);
+            return node;
+        }
+        if (peek().type == TokenType::Identifier && (check("=", 1) || check("==", 1))) {
+            ASTNode* node = parseAssignment("Assign", line);
+            endStatement(line);
+            return node;
+        }
+        if (peek().type == TokenType::Identifier && check("(", 1)) {
+            std::string name = advance().lexeme;
+            ASTNode* call = parseCall(name, line);
+            if (accept(":")) {
+                // AGI fallback target: `xor_eq(X, Y) : status;` or `not_eq(A, B) : throw;`
+                call->children.push_back(make("Target", advance().lexeme, line));
+            }
+            endStatement(line);
+            return wrap("ExprStmt", call, line);
+        }
+        return parseLegacy(line);
+    }
+
+    ASTNode* wrap(const std::string& kind, ASTNode* child, int line) {
+        ASTNode* node = make(kind, "", line);
+        node->children.push_back(child);
+        return node;
+    }
+
+    // Anything the structured parser does not know falls back to the AGI instruction table.
+    ASTNode* parseLegacy(int line) {
+        if (peek().type == TokenType::Identifier && findInstruction(peek().lexeme)) return parseInstruction(line);
+        ASTNode* node = make("Legacy", "", line);
+        std::string text;
+        while (!atEnd() && peek().line == line && !check(";") && !check("}")) {
+            if (!text.empty()) text += " ";
+            text += advance().lexeme;
+        }
+        accept(";");
+        node->value = text;
+        return node;
+    }
+
+    // A line that starts with a table keyword applies it to the operands after it: `inc X`,
+    // `add X, Y`, `swap X, Y`, `print X`, `trap`. Keywords that only make sense as raw machine
+    // code (`push`, `goto`, `start`, ...) are errors rather than text pasted into allocated code.
+    ASTNode* parseInstruction(int line) {
+        std::string keyword = advance().lexeme;
+        static const std::unordered_map<std::string, std::string> updates = {
+            {"add", "+"}, {"sub", "-"}, {"mul", "*"}, {"div", "/"}, {"mod", "%"},
+            {"and", "and"}, {"or", "or"}, {"xor", "xor"}, {"land", "and"}, {"lor", "or"},
+        };
+        static const std::unordered_set<std::string> calls = {
+            "xor_eq", "and_eq", "or_eq", "shiftl", "shiftr", "not_eq", "print", "input",
+        };
+        static const std::unordered_set<std::string> unary = { "inc", "dec", "not", "bitnot", "nullptr" };
+        int arity = updates.count(keyword) || keyword == "swap" ? 2
+                  : unary.count(keyword) ? 1
+                  : keyword == "exit" || keyword == "nop" || keyword == "trap" ? 0
+                  : calls.count(keyword) ? (keyword == "print" || keyword == "input" ? 1 : 2)
+                  : -1;
+        if (arity < 0) {
+            log << "[Line " << line << "] Error: '" << keyword << "' has no meaning on NODE values; "
+                << "use the structured statement instead\n";
+            throw std::runtime_error("parse error at line " + std::to_string(line));
+        }
+        std::vector<ASTNode*> operands;
+        while (!atEnd() && peek().line == line && !check(";") && !check("}")) {
+            operands.push_back(parseExpression());
+            accept(",");
+        }
+        endStatement(line);
+        // The first operand is the variable written, except for print and not_eq; swap writes
+        // both. print and input also stand alone: `print` writes 0, `input` discards a line.
+        bool written = keyword != "print" && keyword != "not_eq";
+        bool ok = static_cast<int>(operands.size()) == arity || ((keyword == "print" || keyword == "input") && operands.empty());
+        for (size_t i = 0; ok && i < operands.size(); ++i)
+            if ((i == 0 && written) || keyword == "swap") ok = operands[i]->kind == "Identifier";
+        if (!ok) {
+            log << "[Line " << line << "] Error: '" << keyword << "' takes " << arity << (arity == 1 ? " operand" : " operands")
+                << (!written || !arity ? "" : arity == 1 ? ", a variable name" : ", the first a variable name") << "\n";
+            throw std::runtime_error("parse error at line " + std::to_string(line));
+        }
+
+        if (keyword == "nop") return nullptr;
+        if (keyword == "exit") return make("Halt", "", line);
+        if (keyword == "trap") return make("Trap", "", line);
+        if (calls.count(keyword)) {
+            ASTNode* call = make("Call", keyword, line);
+            call->children = operands;
+            return wrap("ExprStmt", call, line);
+        }
+        auto assign = [&](const std::string& kind, const std::string& name, ASTNode* value) {
+            ASTNode* node = make(kind, name, line);
+            node->children.push_back(value);
+            return node;
+        };
+        ASTNode* x = operands[0];
+        if (keyword == "swap") {
+            // Through a hidden variable; `swap.` cannot collide with a source name.
+            ASTNode* block = make("Block", "", line);
+            block->children.push_back(assign("Init", "swap.", x));
+            block->children.push_back(assign("Assign", x->value, operands[1]));
+            block->children.push_back(assign("Assign", operands[1]->value, make("Identifier", "swap.", line)));
+            return block;
+        }
+        ASTNode* value;
+        if (keyword == "inc" || keyword == "dec") value = binary(keyword == "inc" ? "+" : "-", x, make("Number", "1", line));
+        else if (keyword == "nullptr") value = make("Number", "0", line);
+        else if (unary.count(keyword)) {
+            value = make("Unary", "not", line);
+            value->children.push_back(x);
+        } else value = binary(updates.at(keyword), x, operands[1]);
+        if (keyword == "land" || keyword == "lor") value = binary("not_eq", value, make("Number", "0", line));
+        return assign("Assign", x->value, value);
+    }
+
+    ASTNode* parseAssignment(const std::string& kind, int line) {
+        ASTNode* node = make(kind, advance().lexeme, line);
+        if (accept("==")) node->children.push_back(make("Immutable", "", line));
+        else expect("=");
+        node->children.insert(node->children.begin(), parseExpression());
+        return node;
+    }
+
+    ASTNode* parseIf() {
+        ASTNode* node = make("If", "", advance().line);
+        node->children.push_back(parseCondition());
+        node->children.push_back(parseBlock());
+        if (accept("else")) {
+            if (check("if")) node->children.push_back(wrap("Block", parseIf(), peek().line));
+            else node->children.push_back(parseBlock());
+        }
+        return node;
+    }
+
+    ASTNode* parseFor() {
+        ASTNode* node = make("For", "", advance().line);
+        expect("(");
+        int line = peek().line;
+        accept("Init");
+        node->children.push_back(parseAssignment("Init", line));
+        expect(";");
+        node->children.push_back(parseExpression());
+        expect(";");
+        node->children.push_back(parseAssignment("Assign", peek().line));
+        expect(")");
+        node->children.push_back(parseBlock());
+        return node;
+    }
+
+    // `if < X {` compares against an implicit zero left-hand side.
+    ASTNode* parseCondition() {
+        if (check("<") || check(">") || check("<=") || check(">=")) {
+            ASTNode* node = make("Binary", advance().lexeme);
+            node->children.push_back(make("Number", "0"));
+            node->children.push_back(parseAdditive());
+            return node;
+        }
+        return parseExpression();
+    }
+
+    ASTNode* parseCall(const std::string& name, int line) {
+        ASTNode* node = make("Call", name, line);
+        if (accept("(")) {
+            while (!check(")") && !atEnd()) {
+                node->children.push_back(parseExpression());
+                if (!accept(",")) break;
+            }
+            expect(")");
+        }
+        return node;
+    }
+
+    ASTNode* binary(const std::string& op, ASTNode* lhs, ASTNode* rhs) {
+        ASTNode* node = make("Binary", op, lhs->line);
+        node->children.push_back(lhs);
+        node->children.push_back(rhs);
+        return node;
+    }
+
+    ASTNode* parseExpression() {
+        ASTNode* lhs = parseXor();
+        while (check("or")) { std::string op = advance().lexeme; lhs = binary(op, lhs, parseXor()); }
+        return lhs;
+    }
+    ASTNode* parseXor() {
+        ASTNode* lhs = parseAnd();
+        while (check("xor")) { std::string op = advance().lexeme; lhs = binary(op, lhs, parseAnd()); }
+        return lhs;
+    }
+    ASTNode* parseAnd() {
+        ASTNode* lhs = parseComparison();
+        while (check("and")) { std::string op = advance().lexeme; lhs = binary(op, lhs, parseComparison()); }
+        return lhs;
+    }
+    ASTNode* parseComparison() {
+        ASTNode* lhs = parseAdditive();
+        while (check("<") || check(">") || check("<=") || check(">=") || check("==") || check("not_eq")) {
+            std::string op = advance().lexeme;
+            lhs = binary(op, lhs, parseAdditive());
+        }
+        return lhs;
+    }
+    ASTNode* parseAdditive() {
+        ASTNode* lhs = parseMultiplicative();
+        while (check("+") || check("-")) { std::string op = advance().lexeme; lhs = binary(op, lhs, parseMultiplicative()); }
+        return lhs;
+    }
+    ASTNode* parseMultiplicative() {
+        ASTNode* lhs = parsePower();
+        while (check("*") || check("/") || check("%")) { std::string op = advance().lexeme; lhs = binary(op, lhs, parsePower()); }
+        return lhs;
+    }
+    ASTNode* parsePower() {
+        ASTNode* lhs = parseUnary();
+        if (check("^")) { advance(); return binary("^", lhs, parsePower()); }
+        return lhs;
+    }
+    ASTNode* parseUnary() {
+        if (check("-") || check("not")) {
+            ASTNode* node = make("Unary", advance().lexeme);
+            node->children.push_back(parseUnary());
+            return node;
+        }
+        return parsePrimary();
+    }
+    ASTNode* parsePrimary() {
+        const Token& t = peek();
+        if (t.type == TokenType::Number) return make("Number", advance().lexeme);
+        if (t.type == TokenType::String) return make("String", advance().lexeme);
+        if (accept("(")) {
+            ASTNode* inner = parseExpression();
+            expect(")");
+            return inner;
+        }
+        if (check("[")) {
+            // `[a, b, ...]`: a read-only table of 64-bit constants, bound with `==`.
+            ASTNode* node = make("List", "", advance().line);
+            if (!check("]")) {
+                do node->children.push_back(parseExpression());
+                while (accept(","));
+            }
+            expect("]");
+            return node;
+        }
+        if (t.type == TokenType::Identifier && t.lexeme == "new" && check("[", 1)) {
+            // `new[N]` allocates a buffer of N 64-bit elements.
+            ASTNode* node = make("New", "", advance().line);
+            advance();
+            node->children.push_back(parseExpression());
+            expect("]");
+            return node;
+        }
+        if (t.type == TokenType::Identifier) {
+            std::string name = advance().lexeme;
+            if (check("(")) return parseCall(name, t.line);
+            if (accept("[")) {
+                ASTNode* node = make("Index", name, t.line);
+                node->children.push_back(parseExpression());
+                expect("]");
+                return node;
+            }
+            return make("Identifier", name);
+        }
+        log << "[Line " << t.line << "] Error: unexpected '" << t.lexeme << "' in expression\n";
+        throw std::runtime_error("parse error at line " + std::to_string(t.line));
+    }
+};
+
+// -----------------------------
+// IR (three-address code over virtual registers)
+// -----------------------------
+
+enum class IROp {
+    Const, Copy, Add, Sub, Mul, Div, Mod, And, Or, Xor, Shl, Shr, Neg, Not,
+    SetCC, Branch, Jump, Label, Param, Call, Ret, Print, Input, AddrOf, Raw,
+    Load, Store,                                // dst = [a + b*8]; [a + b*8] = args[0]
+    Count,                                      // ++profile counter a
+    FrameAddr,                                  // dst = address of word a of the stack buffer area
+    TailCall,                                   // call in tail position: tear down the frame and jump
+    BoundsCheck,                                // trap unless 0 <= b < element count at [a - 8]
+    VLoad, VStore, VSplat, VArith, VZeroUpper   // vector forms over registers vd/va/vb; args[0] = element offset
+};
+
+enum class Cond { EQ, NE, LT, LE, GT, GE };
+
+struct IRValue {
+    enum Kind { None, Temp, Imm } kind = None;
+    int temp = -1;
+    int64_t imm = 0;
+
+    static IRValue T(int t) { IRValue v; v.kind = Temp; v.temp = t; return v; }
+    static IRValue I(int64_t i) { IRValue v; v.kind = Imm; v.imm = i; return v; }
+    bool isTemp() const { return kind == Temp; }
+    bool isImm() const { return kind == Imm; }
+};
+
+struct IRInst {
+    IROp op;
+    int dst = -1;
+    IRValue a, b;
+    Cond cc = Cond::EQ;
+    std::string sym;              // label, callee, data symbol or raw NASM text
+    std::vector<IRValue> args;    // call arguments, stored value
+    int vd = -1, va = -1, vb = -1; // vector registers for V* ops
+    int line = 0;
+};
 
-    std::cout << "Assembling and linking output.asm...\n";
-    int result = system("nasm -g -f elf64 output.asm -o output.o && ld -g output.o -o output.exe");
-    if (result == 0) {
-        std::cout << "[SUCCESS] Compilation successful: output.exe generated.\nLogs: compile.log\n";
+struct IRFunction {
+    std::string name;             // source name
+    std::string symbol;           // emitted label
+    int paramCount = 0;
+    int vectorBytes = 0;          // SIMD register width the vector loops were built for (16, 32 or 64)
+    bool cold = false;            // never entered in the training profile; emitted after the hot code
+    int64_t entries = -1;         // entries in the training profile, -1 without one
+    bool noinline = false;        // `@noinline routine`
+    int bufferWords = 0;          // stack storage for buffers that never escape the function
+    int passLabels = 0;           // labels passes have added (preheaders, inlined bodies); keeps reruns unique
+    int inlineGrowth = 0;         // IR instructions inlining has added, over every inline run
+    std::vector<IRInst> code;
+    std::vector<std::string> tempNames;   // variable name, or "" for compiler temporaries
+
+    int newTemp(const std::string& name = "") {
+        tempNames.push_back(name);
+        return static_cast<int>(tempNames.size()) - 1;
+    }
+};
+
+// A function built once per SIMD width; its public symbol jumps through a dispatch slot.
+struct DispatchEntry {
+    std::string symbol;
+    std::vector<std::pair<int, std::string>> versions;   // vector width in bytes, version symbol
+};
+
+struct IRModule {
+    std::vector<IRFunction> functions;
+    std::vector<DispatchEntry> dispatch;
+    std::set<std::string> runtime;                              // runtime routines and data the code references
+    std::vector<std::pair<std::string, std::string>> strings;   // symbol, contents (.rodata, one per distinct literal)
+    std::vector<std::pair<std::string, std::vector<int64_t>>> tables;   // `==` list literals (.rodata, deduplicated)
+    std::vector<std::string> externs;
+    std::vector<std::string> entryCalls;                        // symbols `_start` calls in order
+    int profileCounters = 0;                                    // --instrument: counter slots to allocate
+    uint64_t sourceHash = 0;                                    // ties a .nodeprof file to its source
+    std::string profileOutput;                                  // file the instrumented binary writes
+    std::string sourceFile;                                     // the .node file, named by -g line tables
+};
+
+// FNV-1a over the source text.
+static uint64_t hashSource(const std::string& text) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : text) { h ^= c; h *= 1099511628211ull; }
+    return h;
+}
+
+static Cond invertCond(Cond c) {
+    switch (c) {
+    case Cond::EQ: return Cond::NE;
+    case Cond::NE: return Cond::EQ;
+    case Cond::LT: return Cond::GE;
+    case Cond::LE: return Cond::GT;
+    case Cond::GT: return Cond::LE;
+    case Cond::GE: return Cond::LT;
     }
-    else {
-        std::cerr << "❌ Compilation failed. Check NASM/LD installation.\n";
+    return c;
+}
+
+static bool holdsCond(int64_t x, int64_t y, Cond cc) {
+    switch (cc) {
+    case Cond::EQ: return x == y;
+    case Cond::NE: return x != y;
+    case Cond::LT: return x < y;
+    case Cond::LE: return x <= y;
+    case Cond::GT: return x > y;
+    case Cond::GE: return x >= y;
     }
+    return false;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc == 2) {
-        compileNODEFile(argv[1]);
-        return 0;
+// Evaluates a pure operation on immediates; false when it must stay (division by zero).
+static bool foldConstant(const IRInst& in, int64_t& out) {
+    if (in.op == IROp::Neg || in.op == IROp::Not) {
+        if (!in.a.isImm()) return false;
+        out = in.op == IROp::Neg ? static_cast<int64_t>(0 - static_cast<uint64_t>(in.a.imm)) : ~in.a.imm;
+        return true;
+    }
+    if (!in.a.isImm() || !in.b.isImm()) return false;
+    uint64_t x = static_cast<uint64_t>(in.a.imm), y = static_cast<uint64_t>(in.b.imm);
+    switch (in.op) {
+    case IROp::Add: out = static_cast<int64_t>(x + y); return true;
+    case IROp::Sub: out = static_cast<int64_t>(x - y); return true;
+    case IROp::Mul: out = static_cast<int64_t>(x * y); return true;
+    case IROp::And: out = static_cast<int64_t>(x & y); return true;
+    case IROp::Or: out = static_cast<int64_t>(x | y); return true;
+    case IROp::Xor: out = static_cast<int64_t>(x ^ y); return true;
+    case IROp::Shl: out = static_cast<int64_t>(x << (y & 63)); return true;
+    case IROp::Shr: out = static_cast<int64_t>(x >> (y & 63)); return true;
+    case IROp::Div: case IROp::Mod:
+        if (in.b.imm == 0 || (in.b.imm == -1 && in.a.imm == INT64_MIN)) return false;
+        out = in.op == IROp::Div ? in.a.imm / in.b.imm : in.a.imm % in.b.imm;
+        return true;
+    case IROp::SetCC: out = holdsCond(in.a.imm, in.b.imm, in.cc); return true;
+    default: return false;
+    }
+}
+
+// base^exponent for exponent >= 0, wrapping like the generated multiply loop.
+static int64_t wrappingPower(int64_t base, int64_t exponent) {
+    uint64_t result = 1, factor = static_cast<uint64_t>(base);
+    for (uint64_t e = static_cast<uint64_t>(exponent); e; e >>= 1, factor *= factor)
+        if (e & 1) result *= factor;
+    return static_cast<int64_t>(result);
+}
+
+static bool isTerminator(IROp op) {
+    return op == IROp::Jump || op == IROp::Ret || op == IROp::TailCall;
+}
+
+// Temps read by an instruction.
+static void irUses(const IRInst& in, std::vector<int>& uses) {
+    uses.clear();
+    if (in.a.isTemp()) uses.push_back(in.a.temp);
+    if (in.b.isTemp()) uses.push_back(in.b.temp);
+    for (const IRValue& v : in.args) if (v.isTemp()) uses.push_back(v.temp);
+}
+
+struct BasicBlock {
+    int first, last;                // inclusive instruction range
+    std::vector<int> succ;
+    std::vector<char> liveIn, liveOut;
+};
+
+static std::vector<BasicBlock> buildBlocks(const IRFunction& fn) {
+    std::vector<BasicBlock> blocks;
+    std::unordered_map<std::string, int> labelBlock;
+    int n = static_cast<int>(fn.code.size());
+    int start = 0;
+    for (int i = 0; i < n; ++i) {
+        const IRInst& in = fn.code[i];
+        bool endsHere = i + 1 == n || fn.code[i + 1].op == IROp::Label || in.op == IROp::Branch || isTerminator(in.op);
+        if (endsHere) {
+            blocks.push_back(BasicBlock{ start, i, {}, {}, {} });
+            start = i + 1;
+        }
+    }
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        const IRInst& head = fn.code[blocks[b].first];
+        if (head.op == IROp::Label) labelBlock[head.sym] = static_cast<int>(b);
+    }
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        const IRInst& tail = fn.code[blocks[b].last];
+        if (tail.op == IROp::Jump || tail.op == IROp::Branch) {
+            auto it = labelBlock.find(tail.sym);
+            if (it != labelBlock.end()) blocks[b].succ.push_back(it->second);
+        }
+        if (!isTerminator(tail.op) && b + 1 < blocks.size()) blocks[b].succ.push_back(static_cast<int>(b) + 1);
+    }
+    return blocks;
+}
+
+// Dominator facts over the IR's basic blocks (Cooper, Harvey and Kennedy's iterative scheme).
+struct DominatorTree {
+    std::vector<BasicBlock> blocks;
+    std::vector<int> blockOf;                 // instruction -> block
+    std::vector<std::vector<int>> preds, children;
+    std::vector<int> idom, pre, post;         // pre/post: dominator-tree DFS numbering, -1 if unreachable
+
+    explicit DominatorTree(const IRFunction& fn) : blocks(buildBlocks(fn)) {
+        size_t n = blocks.size();
+        blockOf.assign(fn.code.size(), 0);
+        preds.assign(n, {});
+        for (size_t b = 0; b < n; ++b) {
+            for (int i = blocks[b].first; i <= blocks[b].last; ++i) blockOf[i] = static_cast<int>(b);
+            for (int s : blocks[b].succ) preds[s].push_back(static_cast<int>(b));
+        }
+        std::vector<int> order, rpoIndex(n, -1);
+        std::vector<char> seen(n, 0);
+        std::vector<std::pair<int, size_t>> stack;
+        if (n) { stack.push_back({ 0, 0 }); seen[0] = 1; }
+        while (!stack.empty()) {
+            auto& top = stack.back();
+            if (top.second < blocks[top.first].succ.size()) {
+                int s = blocks[top.first].succ[top.second++];
+                if (!seen[s]) { seen[s] = 1; stack.push_back({ s, 0 }); }
+            } else {
+                order.push_back(top.first);
+                stack.pop_back();
+            }
+        }
+        std::reverse(order.begin(), order.end());
+        for (size_t k = 0; k < order.size(); ++k) rpoIndex[order[k]] = static_cast<int>(k);
+        idom.assign(n, -1);
+        if (n) idom[0] = 0;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t k = 1; k < order.size(); ++k) {
+                int b = order[k], best = -1;
+                for (int p : preds[b]) {
+                    if (idom[p] < 0) continue;
+                    if (best < 0) { best = p; continue; }
+                    int x = p, y = best;
+                    while (x != y) {
+                        while (rpoIndex[x] > rpoIndex[y]) x = idom[x];
+                        while (rpoIndex[y] > rpoIndex[x]) y = idom[y];
+                    }
+                    best = x;
+                }
+                if (best >= 0 && idom[b] != best) { idom[b] = best; changed = true; }
+            }
+        }
+        children.assign(n, {});
+        for (size_t b = 1; b < n; ++b) if (idom[b] >= 0) children[idom[b]].push_back(static_cast<int>(b));
+        pre.assign(n, -1);
+        post.assign(n, -1);
+        int clock = 0;
+        std::vector<std::pair<int, size_t>> walk;
+        if (n) { walk.push_back({ 0, 0 }); pre[0] = clock++; }
+        while (!walk.empty()) {
+            auto& top = walk.back();
+            if (top.second < children[top.first].size()) {
+                int c = children[top.first][top.second++];
+                pre[c] = clock++;
+                walk.push_back({ c, 0 });
+            } else {
+                post[top.first] = clock++;
+                walk.pop_back();
+            }
+        }
+    }
+
+    bool reachable(int b) const { return pre[b] >= 0; }
+    bool dominates(int a, int b) const {
+        return reachable(a) && reachable(b) && pre[a] <= pre[b] && post[b] <= post[a];
+    }
+    // Instruction-level: definition at `def` is available at `use`.
+    bool dominatesInst(int def, int use) const {
+        int a = blockOf[def], b = blockOf[use];
+        return a == b ? def < use : dominates(a, b);
+    }
+};
+
+// Marks instructions in a natural loop: the blocks of every back edge (a jump to a block that
+// dominates it), walked back to the loop header. Code laid out after a return that jumps back
+// to it, like profile-cold blocks, is not a loop.
+static std::vector<char> loopMembership(const IRFunction& f, const DominatorTree& dom) {
+    std::vector<char> inLoop(f.code.size(), 0);
+    std::vector<char> body(dom.blocks.size(), 0);
+    for (size_t h = 0; h < dom.blocks.size(); ++h) {
+        std::vector<int> work;
+        for (int p : dom.preds[h]) if (dom.dominates(static_cast<int>(h), p)) work.push_back(p);
+        if (work.empty()) continue;
+        body[h] = 1;
+        while (!work.empty()) {
+            int b = work.back();
+            work.pop_back();
+            if (body[b]) continue;
+            body[b] = 1;
+            for (int p : dom.preds[b]) if (dom.reachable(p)) work.push_back(p);
+        }
+    }
+    for (size_t i = 0; i < f.code.size(); ++i) inLoop[i] = body[dom.blockOf[i]];
+    return inLoop;
+}
+
+// Per-function analyses, computed on first request and dropped when a pass changes the function.
+class AnalysisCache {
+    struct Entry {
+        std::unique_ptr<DominatorTree> dominators;
+        std::unique_ptr<std::vector<char>> loops;
+    };
+    std::unordered_map<const IRFunction*, Entry> entries;
+
+public:
+    int computed = 0, reused = 0;
+
+    const DominatorTree& dominators(const IRFunction& fn) {
+        Entry& e = entries[&fn];
+        if (e.dominators) reused++;
+        else { e.dominators = std::make_unique<DominatorTree>(fn); computed++; }
+        return *e.dominators;
+    }
+    const std::vector<char>& loops(const IRFunction& fn) {
+        Entry& e = entries[&fn];
+        if (e.loops) reused++;
+        else { e.loops = std::make_unique<std::vector<char>>(loopMembership(fn, dominators(fn))); computed++; }
+        return *e.loops;
+    }
+    void invalidate(const IRFunction& fn) { entries.erase(&fn); }
+    void invalidateAll() { entries.clear(); }
+};
+
+static std::string mangleSymbol(const std::string& name) {
+    std::string out = "node_";
+    for (char c : name) out += (isalnum(static_cast<unsigned char>(c)) || c == '_') ? c : '_';
+    return out;
+}
+
+struct CompileOptions {
+    bool spillEverything = false;   // --regalloc=spill: baseline with every value in a frame slot
+    bool peephole = true;           // --no-peephole: emit the lowering output untouched
+    bool autoUnroll = true;         // --no-unroll: only honour explicit `unroll(N)`
+    int unrollBudget = 160;         // --unroll-budget=N: max IR nodes an unrolled loop body may grow to
+    bool vectorize = true;          // --no-vectorize: keep element-wise buffer loops scalar
+    bool strengthReduce = true;     // --no-strength-reduce: plain imul/idiv for constant operands
+    bool treeSelection = true;      // --isel=simple: lower each IR instruction on its own
+    bool schedule = true;           // --no-schedule: keep the instruction order lowering produced
+    std::string costModel;          // --cost-model=FILE: latency/port table for the scheduler
+    int optLevel = 2;               // -O0..-O3: sets the switches above and the IR pipeline below
+    // IR passes in run order (--passes=a,b,...). --no-inline, --no-gvn, --no-licm, --no-escape
+    // and --no-tail-calls drop a pass from whatever pipeline is in effect.
+    std::vector<std::string> passes = { "inline", "webs", "gvn", "dce", "licm", "escape", "tailcalls" };
+    bool timeReport = false;        // --time-report: wall time and memory per phase
+    bool boundsChecks = true;       // --no-bounds-checks: index buffers without checking the element count
+    bool reportBounds = false;      // --report-bounds: list the bounds checks left in the code
+    bool instrument = false;        // --instrument: count blocks and branches, write <source>.nodeprof at exit
+    std::string useProfile;         // --use-profile=FILE: counts that steer layout and loop decisions
+    std::string targetCpu = "multi"; // --target-cpu=sse2|avx2|avx512|native: single-version SIMD code
+    bool profile = false;           // --profile: per-pass statistics on stdout
+    bool nasmBackend = false;       // --assembler=nasm: run nasm + ld instead of encoding in process
+    bool emitAsm = false;           // --emit-asm: also write output.asm
+    bool emitObject = false;        // --emit-obj: stop at a relocatable output.o instead of linking output.exe
+    bool runtimeLibrary = false;    // --runtime=lib: leave the runtime to libnoderuntime.a at link time
+    bool debugInfo = false;         // -g: DWARF line table mapping the code to .node source lines
+    bool prefault = false;          // --prefault: populate .data and .bss with one madvise at startup
+    bool packSegments = false;      // --pack-segments: headers, .rodata and .text in one R+X segment
+    int startupRuns = 0;            // --time-startup=N: run the executable N times, timing exec to _start
+    int jobs = 0;                   // --jobs=N: nasm + ld runs in flight during a batch build (0: one per core)
+    int threads = 0;                // --threads=N: routines compiled at once by emitModule (0: one per core)
+    std::string output = "output";  // name of the .asm/.o/.exe files; <source stem> in a batch build
+    std::string logPath = "compile.log";
+};
+
+// -----------------------------
+// IR GENERATION
+// -----------------------------
+
+// Shape of a counted loop `for (Init i = A; i <op> B; i = i +/- S)` whose induction variable
+// and bound are not written in the body.
+struct LoopShape {
+    std::string var;
+    Cond cc = Cond::LT;
+    ASTNode* bound = nullptr;
+    int64_t delta = 0;
+    bool constantTrip = false;
+    int64_t trip = 0;
+};
+
+struct LoopStats {
+    int full = 0, partial = 0, capped = 0, vectorized = 0;
+};
+
+struct ProfileStats {
+    int hotLoops = 0, coldLoops = 0, coldBlocks = 0, swappedBranches = 0, coldFunctions = 0;
+};
+
+// Buffer accesses by how their bounds are enforced; each source access counts once.
+struct BoundsStats {
+    int proven = 0, guarded = 0, guards = 0, checked = 0, unchecked = 0;
+};
+
+class IRBuilder {
+    IRModule& module;
+    std::ostream& log;
+    const CompileOptions& options;
+    IRFunction* fn = nullptr;
+    std::unordered_map<std::string, int> vars;
+    std::vector<IRInst> zeroInits;
+    // `==` bindings: the statement that bound each name, and the compile-time value or table
+    // contents when it has one. Constants never get a temp; their uses become immediates.
+    std::unordered_map<std::string, const ASTNode*> immutables;
+    std::unordered_map<std::string, int64_t> constants;
+    std::unordered_map<std::string, std::vector<int64_t>> tableContents;
+    std::unordered_set<std::string> mutableStrings;               // names ever assigned a string without ==
+    std::map<std::string, std::string> stringSymbols;             // module-wide, by contents
+    std::map<std::vector<int64_t>, std::string> tableSymbols;
+    // Names only ever assigned `new[N]` or a list literal hold a buffer base with its element
+    // count at [ptr - 8]; those accesses are checked. Parameters and derived pointers are not.
+    std::unordered_map<std::string, int> bufferAssignments;
+    std::unordered_set<std::string> notBuffers;
+    std::unordered_map<std::string, int64_t> knownCounts;
+    std::unordered_set<const ASTNode*> coveredAccesses;          // in range by a loop guard or by proof
+    std::unordered_map<const ASTNode*, std::string> uncoveredReason;
+    std::unordered_set<const ASTNode*> reportedChecks;
+    std::vector<std::pair<std::string, std::string>> loops;   // continue label, break label
+    std::unordered_map<std::string, std::string> functionSymbols;
+    std::unordered_map<std::string, size_t> functionArity;     // parameters each routine takes (0 for start blocks)
+    int labelCounter = 0;
+    int line = 0;
+    int vectorBytes = 32;
+    // Profile counters are keyed by syntax node so a rebuild with different loop and layout
+    // decisions still finds its counts: functions get one slot (entries), loops two (entries,
+    // iterations), ifs two (reached, then taken).
+    std::unordered_map<const ASTNode*, int> counterSlot;
+    std::vector<uint64_t> profile;
+    std::vector<std::function<void()>> coldRegions;
+    std::set<std::pair<const int*, const ASTNode*>> noted;      // unrolled copies count once
+
+    void note(int& stat, const ASTNode* node) {
+        if (noted.insert({ &stat, node }).second) stat++;
+    }
+
+public:
+    LoopStats loopStats;
+    ProfileStats profileStats;
+    BoundsStats boundsStats;
+    std::vector<std::string> boundsReport;   // one line per access still checked at run time
+
+    IRBuilder(IRModule& mod, std::ostream& logStream, const CompileOptions& opts)
+        : module(mod), log(logStream), options(opts) {}
+
+    void UseProfile(std::vector<uint64_t> counts) { profile = std::move(counts); }
+
+    void Build(const Program& program) {
+        int slots = 0;
+        for (ASTNode* item : program.items) numberCounters(item, slots);
+        if (options.instrument) module.profileCounters = slots;
+        if (!profile.empty() && profile.size() != static_cast<size_t>(slots)) {
+            log << "Warning: profile has " << profile.size() << " counters, program needs " << slots << "; ignoring it\n";
+            profile.clear();
+        }
+
+        // Pass 1: name every function so calls can be resolved regardless of order.
+        std::vector<ASTNode*> topLevel;
+        std::string entry, firstStart;
+        for (ASTNode* item : program.items) {
+            if (item->kind == "Start" || item->kind == "Routine") {
+                std::string name = item->value.empty() ? "start" + std::to_string(functionSymbols.size()) : item->value;
+                if (functionSymbols.count(name)) name += "_" + std::to_string(functionSymbols.size());
+                item->value = name;
+                functionSymbols[name] = mangleSymbol(name);
+                functionArity[name] = item->kind == "Routine" ? item->children[0]->children.size() : 0;
+                if (item->kind == "Start" && firstStart.empty()) firstStart = name;
+                if (item->kind == "Start" && name == "main") entry = name;
+            } else {
+                topLevel.push_back(item);
+            }
+        }
+        if (entry.empty()) entry = firstStart;
+
+        if (!topLevel.empty()) {
+            buildVersions("toplevel", mangleSymbol("toplevel"), [&] {
+                for (ASTNode* stmt : topLevel) scanBuffers(stmt);
+                for (ASTNode* stmt : topLevel) genStmt(stmt);
+            });
+            module.entryCalls.push_back(mangleSymbol("toplevel"));
+        }
+        for (ASTNode* item : program.items) {
+            if (item->kind == "Start") {
+                buildVersions(item->value, functionSymbols[item->value], [&] {
+                    for (ASTNode* stmt : item->children) scanBuffers(stmt);
+                    enterFunction(item);
+                    for (ASTNode* stmt : item->children) genStmt(stmt);
+                });
+            } else if (item->kind == "Routine") {
+                buildVersions(item->value, functionSymbols[item->value], [&] {
+                    ASTNode* params = item->children[0];
+                    scanBuffers(item->children[1]);
+                    for (size_t i = 0; i < params->children.size(); ++i) {
+                        notBuffers.insert(params->children[i]->value);
+                        int t = declare(params->children[i]->value);
+                        IRInst in{ IROp::Param };
+                        in.dst = t;
+                        in.a = IRValue::I(static_cast<int64_t>(i));
+                        emit(in);
+                    }
+                    fn->paramCount = static_cast<int>(params->children.size());
+                    for (size_t i = 2; i < item->children.size(); ++i)
+                        if (item->children[i]->value == "@noinline") fn->noinline = true;
+                    enterFunction(item);
+                    genStmt(item->children[1]);
+                });
+            }
+        }
+        if (!entry.empty()) module.entryCalls.push_back(functionSymbols[entry]);
+    }
+
+    // -- Profile counters ---------------------------------------------------
+
+    void numberCounters(const ASTNode* node, int& slots) {
+        const std::string& k = node->kind;
+        if (k == "Start" || k == "Routine") { counterSlot[node] = slots; slots += 1; }
+        else if (k == "For" || k == "While" || k == "If") { counterSlot[node] = slots; slots += 2; }
+        for (const ASTNode* child : node->children) numberCounters(child, slots);
+    }
+
+    void emitCounter(const ASTNode* node, int which) {
+        if (!options.instrument) return;
+        IRInst in{ IROp::Count };
+        in.a = IRValue::I(counterSlot.at(node) + which);
+        emit(in);
+    }
+
+    bool haveProfile() const { return !profile.empty(); }
+    uint64_t profileCount(const ASTNode* node, int which) const {
+        return haveProfile() ? profile[counterSlot.at(node) + which] : 0;
+    }
+
+    void enterFunction(const ASTNode* item) {
+        emitCounter(item, 0);
+        if (haveProfile()) fn->entries = static_cast<int64_t>(profileCount(item, 0));
+        if (haveProfile() && profileCount(item, 0) == 0) {
+            fn->cold = true;
+            note(profileStats.coldFunctions, item);
+        }
+    }
+
+    static const char* isaName(int bytes) {
+        return bytes == 64 ? "avx512" : bytes == 32 ? "avx2" : "sse2";
+    }
+
+    // SIMD widths to build vectorized functions for, widest first. SSE2 is the x86-64 baseline.
+    static std::vector<int> vectorTargets(const std::string& cpu) {
+        if (cpu == "sse2") return { 16 };
+        if (cpu == "avx2") return { 32 };
+        if (cpu == "avx512") return { 64 };
+        if (cpu == "native") {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) return { 64 };
+            if (__builtin_cpu_supports("avx2")) return { 32 };
+            return { 16 };
+        }
+        return { 64, 32, 16 };
+    }
+
+private:
+    // Builds one function; when it ends up with vector loops and several targets are enabled it is
+    // rebuilt once per SIMD width and its public symbol becomes a dispatch stub.
+    void buildVersions(const std::string& name, const std::string& symbol, const std::function<void()>& body) {
+        std::vector<int> targets = vectorTargets(options.targetCpu);
+        int vectorizedBefore = loopStats.vectorized;
+        vectorBytes = targets.front();
+        beginFunction(name, symbol);
+        body();
+        endFunction();
+        if (loopStats.vectorized == vectorizedBefore || targets.size() == 1) return;
+
+        DispatchEntry entry{ symbol, {} };
+        module.functions.back().symbol = symbol + "__" + isaName(targets.front());
+        entry.versions.emplace_back(targets.front(), module.functions.back().symbol);
+        LoopStats stats = loopStats;
+        std::streambuf* saved = log.rdbuf(nullptr);   // diagnostics were already reported once
+        for (size_t t = 1; t < targets.size(); ++t) {
+            vectorBytes = targets[t];
+            beginFunction(name, symbol + "__" + isaName(vectorBytes));
+            body();
+            endFunction();
+            entry.versions.emplace_back(vectorBytes, module.functions.back().symbol);
+        }
+        log.rdbuf(saved);
+        loopStats = stats;
+        module.dispatch.push_back(entry);
+    }
+
+    void beginFunction(const std::string& name, const std::string& symbol) {
+        module.functions.emplace_back();
+        fn = &module.functions.back();
+        fn->name = name;
+        fn->symbol = symbol;
+        fn->vectorBytes = vectorBytes;
+        vars.clear();
+        zeroInits.clear();
+        loops.clear();
+        immutables.clear();
+        constants.clear();
+        tableContents.clear();
+        mutableStrings.clear();
+        bufferAssignments.clear();
+        notBuffers.clear();
+        knownCounts.clear();
+    }
+
+    void endFunction() {
+        if (fn->code.empty() || fn->code.back().op != IROp::Ret) {
+            IRInst ret{ IROp::Ret };
+            emit(ret);
+        }
+        // Out-of-line cold blocks go after the return; each jumps back to where it was split off.
+        for (size_t i = 0; i < coldRegions.size(); ++i) coldRegions[i]();
+        coldRegions.clear();
+        // Implicitly declared variables start at zero; materialize them after the parameter moves.
+        auto pos = fn->code.begin();
+        while (pos != fn->code.end() && pos->op == IROp::Param) ++pos;
+        fn->code.insert(pos, zeroInits.begin(), zeroInits.end());
+        fn = nullptr;
+    }
+
+    void emit(IRInst in) {
+        in.line = line;
+        fn->code.push_back(std::move(in));
+    }
+
+    std::string newLabel() { return ".L" + std::to_string(labelCounter++); }
+
+    void emitLabel(const std::string& label) {
+        IRInst in{ IROp::Label };
+        in.sym = label;
+        emit(in);
+    }
+    void emitJump(const std::string& label) {
+        IRInst in{ IROp::Jump };
+        in.sym = label;
+        emit(in);
+    }
+    void emitBranch(IRValue a, IRValue b, Cond cc, const std::string& label) {
+        IRInst in{ IROp::Branch };
+        in.a = a;
+        in.b = b;
+        in.cc = cc;
+        in.sym = label;
+        emit(in);
+    }
+
+    int declare(const std::string& name) {
+        auto it = vars.find(name);
+        if (it != vars.end()) return it->second;
+        int t = fn->newTemp(name);
+        vars[name] = t;
+        return t;
+    }
+
+    int lookup(const std::string& name) {
+        auto it = vars.find(name);
+        if (it != vars.end()) return it->second;
+        log << "[Line " << line << "] Warning: '" << name << "' used before Init; assuming 0\n";
+        int t = declare(name);
+        IRInst zero{ IROp::Const };
+        zero.dst = t;
+        zero.a = IRValue::I(0);
+        zeroInits.push_back(zero);
+        return t;
+    }
+
+    IRValue valueOf(const std::string& name) {
+        auto it = constants.find(name);
+        return it != constants.end() ? IRValue::I(it->second) : IRValue::T(lookup(name));
+    }
+
+    void requireMutable(const std::string& name, const ASTNode* by, const char* what) {
+        auto it = immutables.find(name);
+        if (it == immutables.end() || it->second == by) return;
+        log << "[Line " << line << "] Error: cannot " << what << " '" << name << "': it is bound with ==\n";
+        throw std::runtime_error("write to immutable binding at line " + std::to_string(line));
+    }
+
+    // Tables and strings bound with `==` live in .rodata.
+    void requireWritable(const std::string& name, const char* what) {
+        auto it = immutables.find(name);
+        if (it == immutables.end()) return;
+        const std::string& kind = it->second->children[0]->kind;
+        if (kind != "List" && kind != "String") return;
+        log << "[Line " << line << "] Error: cannot " << what << " '" << name << "': it is read-only data\n";
+        throw std::runtime_error("write to read-only data at line " + std::to_string(line));
+    }
+
+    IRValue addressOf(const std::string& symbol) {
+        IRInst in{ IROp::AddrOf };
+        in.dst = fn->newTemp();
+        in.sym = symbol;
+        emit(in);
+        return IRValue::T(in.dst);
+    }
+
+    // Store `value` into variable temp `t`, retargeting the defining instruction when it produced a fresh temporary.
+    void assign(int t, IRValue value) {
+        if (value.isTemp() && !fn->code.empty()) {
+            IRInst& last = fn->code.back();
+            if (last.dst == value.temp && fn->tempNames[value.temp].empty() && last.op != IROp::Param) {
+                last.dst = t;
+                return;
+            }
+        }
+        IRInst in{ value.isImm() ? IROp::Const : IROp::Copy };
+        in.dst = t;
+        in.a = value;
+        emit(in);
+    }
+
+    IRValue binary(IROp op, IRValue a, IRValue b) {
+        IRInst in{ op };
+        in.a = a;
+        in.b = b;
+        int64_t folded;
+        if (foldConstant(in, folded)) return IRValue::I(folded);
+        in.dst = fn->newTemp();
+        emit(in);
+        return IRValue::T(in.dst);
+    }
+
+    IRValue materialize(IRValue v) {
+        if (v.isTemp()) return v;
+        IRInst in{ IROp::Const };
+        in.dst = fn->newTemp();
+        in.a = v;
+        emit(in);
+        return IRValue::T(in.dst);
+    }
+
+    // Square-and-multiply loop for `^` with a runtime exponent.
+    IRValue power(IRValue base, IRValue exponent) {
+        int result = fn->newTemp(), b = fn->newTemp(), e = fn->newTemp(), bit = fn->newTemp();
+        assign(result, IRValue::I(1));
+        assign(b, base);
+        assign(e, exponent);
+        std::string top = newLabel(), skip = newLabel(), done = newLabel();
+        emitLabel(top);
+        emitBranch(IRValue::T(e), IRValue::I(0), Cond::LE, done);
+        IRInst bitTest{ IROp::And };
+        bitTest.dst = bit;
+        bitTest.a = IRValue::T(e);
+        bitTest.b = IRValue::I(1);
+        emit(bitTest);
+        emitBranch(IRValue::T(bit), IRValue::I(0), Cond::EQ, skip);
+        IRInst mul{ IROp::Mul };
+        mul.dst = result;
+        mul.a = IRValue::T(result);
+        mul.b = IRValue::T(b);
+        emit(mul);
+        emitLabel(skip);
+        IRInst square{ IROp::Mul };
+        square.dst = b;
+        square.a = IRValue::T(b);
+        square.b = IRValue::T(b);
+        emit(square);
+        IRInst shift{ IROp::Shr };
+        shift.dst = e;
+        shift.a = IRValue::T(e);
+        shift.b = IRValue::I(1);
+        emit(shift);
+        emitJump(top);
+        emitLabel(done);
+        return IRValue::T(result);
+    }
+
+    // `x ^ k` for a constant k: the square-and-multiply loop unrolled into at most 2*log2(k) multiplies.
+    IRValue constantPower(IRValue base, int64_t exponent) {
+        if (exponent <= 0) return IRValue::I(1);
+        IRValue result, square = base;
+        for (;;) {
+            if (exponent & 1) result = result.kind == IRValue::None ? square : binary(IROp::Mul, result, square);
+            exponent >>= 1;
+            if (!exponent) break;
+            square = binary(IROp::Mul, square, square);
+        }
+        return result;
+    }
+
+    static bool comparison(const std::string& op, Cond& cc) {
+        if (op == "<") cc = Cond::LT;
+        else if (op == ">") cc = Cond::GT;
+        else if (op == "<=") cc = Cond::LE;
+        else if (op == ">=") cc = Cond::GE;
+        else if (op == "==") cc = Cond::EQ;
+        else if (op == "not_eq") cc = Cond::NE;
+        else return false;
+        return true;
+    }
+
+    IRValue genExpr(ASTNode* node) {
+        line = node->line;
+        if (node->kind == "Number") return IRValue::I(std::stoll(node->value, nullptr, 0));
+        if (node->kind == "String") {
+            std::string& symbol = stringSymbols[node->value];
+            if (symbol.empty()) {
+                symbol = "str" + std::to_string(module.strings.size());
+                module.strings.emplace_back(symbol, node->value);
+            }
+            return addressOf(symbol);
+        }
+        if (node->kind == "List") {
+            std::vector<int64_t> contents;
+            for (ASTNode* element : node->children) {
+                IRValue v = genExpr(element);
+                if (!v.isImm()) {
+                    log << "[Line " << node->line << "] Error: list elements must be compile-time constants\n";
+                    throw std::runtime_error("non-constant list element at line " + std::to_string(node->line));
+                }
+                contents.push_back(v.imm);
+            }
+            std::string& symbol = tableSymbols[contents];
+            if (symbol.empty()) {
+                symbol = "node_const" + std::to_string(module.tables.size());
+                module.tables.emplace_back(symbol, contents);
+            }
+            return addressOf(symbol);
+        }
+        if (node->kind == "Identifier") return valueOf(node->value);
+        if (node->kind == "Unary") {
+            IRValue v = genExpr(node->children[0]);
+            IRInst in{ node->value == "-" ? IROp::Neg : IROp::Not };
+            in.a = v;
+            int64_t folded;
+            if (foldConstant(in, folded)) return IRValue::I(folded);
+            in.dst = fn->newTemp();
+            emit(in);
+            return IRValue::T(in.dst);
+        }
+        if (node->kind == "Binary") {
+            IRValue a = genExpr(node->children[0]);
+            IRValue b = genExpr(node->children[1]);
+            const std::string& op = node->value;
+            Cond cc;
+            if (comparison(op, cc)) {
+                IRInst in{ IROp::SetCC };
+                in.dst = fn->newTemp();
+                in.a = a;
+                in.b = b;
+                in.cc = cc;
+                emit(in);
+                return IRValue::T(in.dst);
+            }
+            if (op == "^") {
+                if (a.isImm() && b.isImm() && b.imm >= 0) return IRValue::I(wrappingPower(a.imm, b.imm));
+                if (b.isImm() && options.strengthReduce) return constantPower(a, b.imm);
+                return power(a, b);
+            }
+            static const std::unordered_map<std::string, IROp> ops = {
+                {"+", IROp::Add}, {"-", IROp::Sub}, {"*", IROp::Mul}, {"/", IROp::Div}, {"%", IROp::Mod},
+                {"and", IROp::And}, {"or", IROp::Or}, {"xor", IROp::Xor},
+            };
+            auto it = ops.find(op);
+            if (it != ops.end()) return binary(it->second, a, b);
+            log << "[Line " << node->line << "] Warning: operator '" << op << "' has no lowering; using left operand\n";
+            return a;
+        }
+        if (node->kind == "Call") return genCall(node, true);
+        if (node->kind == "Index") {
+            IRValue index = genExpr(node->children[0]);
+            auto table = tableContents.find(node->value);
+            if (table != tableContents.end() && index.isImm()) {
+                if (index.imm >= 0 && index.imm < static_cast<int64_t>(table->second.size()))
+                    return IRValue::I(table->second[index.imm]);
+                log << "[Line " << node->line << "] Warning: index " << index.imm << " is outside '" << node->value
+                    << "' (" << table->second.size() << " elements)\n";
+            }
+            IRInst in{ IROp::Load };
+            in.a = IRValue::T(lookup(node->value));
+            in.b = index;
+            checkIndex(node, in.a, index);
+            in.dst = fn->newTemp();
+            line = node->line;
+            emit(in);
+            return IRValue::T(in.dst);
+        }
+        if (node->kind == "New") return runtimeCall("node_rt_new", genExpr(node->children[0]), true);
+        log << "[Line " << node->line << "] Warning: cannot evaluate " << node->kind << "\n";
+        return IRValue::I(0);
+    }
+
+    void genBranch(ASTNode* cond, const std::string& label, bool whenTrue) {
+        Cond cc;
+        if (cond->kind == "Binary" && comparison(cond->value, cc)) {
+            IRValue a = genExpr(cond->children[0]);
+            IRValue b = genExpr(cond->children[1]);
+            emitBranch(a, b, whenTrue ? cc : invertCond(cc), label);
+            return;
+        }
+        IRValue v = genExpr(cond);
+        emitBranch(v, IRValue::I(0), whenTrue ? Cond::NE : Cond::EQ, label);
+    }
+
+    IRValue runtimeCall(const std::string& helper, IRValue arg, bool wantValue) {
+        module.runtime.insert(helper);
+        IRInst in{ IROp::Call };
+        in.sym = helper;
+        in.args.push_back(arg);
+        if (wantValue) in.dst = fn->newTemp();
+        emit(in);
+        return wantValue ? IRValue::T(in.dst) : IRValue::I(0);
+    }
+
+    std::string targetOf(ASTNode* call) {
+        if (!call->children.empty() && call->children.back()->kind == "Target") return call->children.back()->value;
+        return "";
+    }
+
+    IRValue genCall(ASTNode* node, bool wantValue) {
+        const std::string& name = node->value;
+        std::string target = targetOf(node);
+        size_t argc = node->children.size() - (target.empty() ? 0 : 1);
+        line = node->line;
+
+        if (name == "print") {
+            // A string literal, or a name bound to one with ==, prints as text; anything else is an integer.
+            const ASTNode* arg = argc ? node->children[0] : nullptr;
+            auto bound = arg && arg->kind == "Identifier" ? immutables.find(arg->value) : immutables.end();
+            bool text = arg && (arg->kind == "String" || (bound != immutables.end() && bound->second->children[0]->kind == "String"));
+            if (!text && arg && arg->kind == "Identifier" && mutableStrings.count(arg->value)) {
+                log << "[Line " << line << "] Error: cannot print '" << arg->value << "' as text: bind the string with ==\n";
+                throw std::runtime_error("print of a mutable string at line " + std::to_string(line));
+            }
+            IRInst in{ IROp::Print };
+            in.sym = text ? "print_str" : "print";
+            module.runtime.insert(in.sym);
+            in.a = argc ? genExpr(node->children[0]) : IRValue::I(0);
+            emit(in);
+            return IRValue::I(0);
+        }
+        if (name == "input") {
+            module.runtime.insert("input");
+            IRInst in{ IROp::Input };
+            if (argc && node->children[0]->kind == "Identifier") requireMutable(node->children[0]->value, nullptr, "read into");
+            in.dst = (argc && node->children[0]->kind == "Identifier") ? declare(node->children[0]->value) : fn->newTemp();
+            emit(in);
+            return IRValue::T(in.dst);
+        }
+
+        static const std::unordered_map<std::string, IROp> agi = {
+            {"xor_eq", IROp::Xor}, {"and_eq", IROp::And}, {"or_eq", IROp::Or},
+            {"shiftl", IROp::Shl}, {"shiftr", IROp::Shr},
+        };
+        auto it = agi.find(name);
+        if (it != agi.end() && argc == 2) {
+            IRValue r = binary(it->second, genExpr(node->children[0]), genExpr(node->children[1]));
+            std::string dest = !target.empty() ? target
+                             : node->children[0]->kind == "Identifier" ? node->children[0]->value : "";
+            if (!dest.empty() && !wantValue) assign(declare(dest), r);
+            return r;
+        }
+        if (name == "not_eq" && argc == 2) {
+            IRValue a = genExpr(node->children[0]);
+            IRValue b = genExpr(node->children[1]);
+            if (wantValue || (!target.empty() && target != "throw")) {
+                IRInst in{ IROp::SetCC };
+                in.dst = fn->newTemp();
+                in.a = a;
+                in.b = b;
+                in.cc = Cond::NE;
+                emit(in);
+                if (!target.empty()) assign(declare(target), IRValue::T(in.dst));
+                return IRValue::T(in.dst);
+            }
+            emitBranch(a, b, Cond::NE, "throw_handler");
+            return IRValue::I(0);
+        }
+
+        IRInst in{ IROp::Call };
+        for (size_t i = 0; i < argc; ++i) in.args.push_back(genExpr(node->children[i]));
+        if (in.args.size() > 6) {
+            log << "[Line " << node->line << "] Error: call to '" << name << "' passes more than 6 arguments\n";
+            throw std::runtime_error("unsupported call at line " + std::to_string(node->line));
+        }
+        auto fit = functionSymbols.find(name);
+        if (fit != functionSymbols.end() && functionArity[name] != argc) {
+            size_t want = functionArity[name];
+            log << "[Line " << node->line << "] Error: call to '" << name << "' passes " << argc << " argument"
+                << (argc == 1 ? "" : "s") << ", but it takes " << want << "\n";
+            throw std::runtime_error("unsupported call at line " + std::to_string(node->line));
+        }
+        if (fit != functionSymbols.end()) {
+            in.sym = fit->second;
+        } else {
+            in.sym = name;
+            if (std::find(module.externs.begin(), module.externs.end(), name) == module.externs.end()) {
+                module.externs.push_back(name);
+                log << "[Line " << node->line << "] Warning: '" << name << "' is not defined in this module; emitting extern\n";
+            }
+        }
+        in.dst = fn->newTemp();
+        line = node->line;
+        emit(in);
+        IRValue result = IRValue::T(in.dst);
+        if (!target.empty() && target != "throw") assign(declare(target), result);
+        return result;
+    }
+
+    void genStmt(ASTNode* node) {
+        line = node->line;
+        const std::string& k = node->kind;
+        if (k == "Block") {
+            for (ASTNode* child : node->children) genStmt(child);
+        } else if (k == "Init" || k == "Assign") {
+            bool immutable = node->children.size() > 1 && node->children[1]->kind == "Immutable";
+            requireMutable(node->value, immutable ? node : nullptr, "reassign");
+            if (node->children[0]->kind == "List" && !immutable) {
+                log << "[Line " << node->line << "] Error: list literals are read-only; bind them with ==\n";
+                throw std::runtime_error("mutable list literal at line " + std::to_string(node->line));
+            }
+            IRValue v = genExpr(node->children[0]);
+            recordCount(node, v);
+            if (node->children[0]->kind == "String" && !immutable) mutableStrings.insert(node->value);
+            if (immutable) {
+                immutables[node->value] = node;
+                if (v.isImm()) {
+                    constants[node->value] = v.imm;
+                    return;
+                }
+                if (node->children[0]->kind == "List") {
+                    const std::string& symbol = fn->code.back().sym;
+                    for (const auto& t : module.tables) if (t.first == symbol) tableContents[node->value] = t.second;
+                }
+            }
+            assign(k == "Init" ? declare(node->value) : lookup(node->value), v);
+        } else if (k == "If") {
+            genIf(node);
+        } else if (k == "While") {
+            std::string top = newLabel(), exit = newLabel();
+            emitCounter(node, 0);
+            emitLabel(top);
+            genBranch(node->children[0], exit, false);
+            loops.emplace_back(top, exit);
+            emitCounter(node, 1);
+            genStmt(node->children[1]);
+            loops.pop_back();
+            emitJump(top);
+            emitLabel(exit);
+        } else if (k == "For") {
+            genFor(node);
+        } else if (k == "Store") {
+            requireWritable(node->value, "write into");
+            IRInst in{ IROp::Store };
+            in.a = IRValue::T(lookup(node->value));
+            in.b = genExpr(node->children[0]);
+            checkIndex(node, in.a, in.b);
+            in.args.push_back(genExpr(node->children[1]));
+            line = node->line;
+            emit(in);
+        } else if (k == "Delete") {
+            if (node->children[0]->kind == "Identifier") requireWritable(node->children[0]->value, "delete");
+            runtimeCall("node_rt_delete", genExpr(node->children[0]), false);
+        } else if (k == "Break" || k == "Continue") {
+            if (loops.empty()) {
+                log << "[Line " << node->line << "] Warning: '" << (k == "Break" ? "break" : "continue") << "' outside a loop\n";
+                return;
+            }
+            emitJump(k == "Break" ? loops.back().second : loops.back().first);
+        } else if (k == "Halt") {
+            emitJump("node_exit");
+        } else if (k == "Throw") {
+            if (node->children.empty()) emitJump("throw_handler");
+            else genBranch(node->children[0], "throw_handler", true);
+        } else if (k == "Return") {
+            IRInst in{ IROp::Ret };
+            if (!node->children.empty()) in.a = genExpr(node->children[0]);
+            emit(in);
+        } else if (k == "ExprStmt") {
+            genCall(node->children[0], false);
+        } else if (k == "Legacy") {
+            genLegacy(node);
+        } else if (k == "Trap") {
+            IRInst in{ IROp::Raw };   // a breakpoint: SIGTRAP, or a stop under a debugger
+            in.sym = "int3";
+            emit(in);
+        } else if (k == "Start" || k == "Routine") {
+            log << "[Line " << node->line << "] Warning: nested " << k << " blocks are not supported\n";
+        }
+    }
+
+    // -- Loop unrolling ----------------------------------------------------
+
+    static constexpr int maxFullUnrollTrips = 16;
+    static constexpr int maxUnrollFactor = 8;
+    static constexpr uint64_t hotLoopIterations = 10000;   // profile: total iterations that make a loop hot
+    static constexpr uint64_t hotLoopTrip = 16;            // ... and the average trip count it needs
+    static constexpr int hotLoopFactor = 4;
+
+    static int countNodes(const ASTNode* node) {
+        int n = 1;
+        for (const ASTNode* child : node->children) n += countNodes(child);
+        return n;
+    }
+
+    static void collectWrites(const ASTNode* node, std::unordered_set<std::string>& written) {
+        static const std::unordered_set<std::string> agiWriters = { "xor_eq", "and_eq", "or_eq", "shiftl", "shiftr", "input" };
+        if (node->kind == "Init" || node->kind == "Assign" || node->kind == "Target") written.insert(node->value);
+        if (node->kind == "Call" && agiWriters.count(node->value) && !node->children.empty() &&
+            node->children[0]->kind == "Identifier")
+            written.insert(node->children[0]->value);
+        for (const ASTNode* child : node->children) collectWrites(child, written);
+    }
+
+    // -- Bounds checks ---------------------------------------------------------
+
+    void scanBuffers(const ASTNode* node) {
+        if (node->kind == "Init" || node->kind == "Assign") {
+            const std::string& kind = node->children[0]->kind;
+            if (kind == "New" || kind == "List") bufferAssignments[node->value]++;
+            else notBuffers.insert(node->value);
+        }
+        if (node->kind == "Target") notBuffers.insert(node->value);
+        static const std::unordered_set<std::string> agiWriters = { "xor_eq", "and_eq", "or_eq", "shiftl", "shiftr", "input" };
+        if (node->kind == "Call" && agiWriters.count(node->value) && !node->children.empty() &&
+            node->children[0]->kind == "Identifier")
+            notBuffers.insert(node->children[0]->value);
+        for (const ASTNode* child : node->children) scanBuffers(child);
+    }
+
+    bool isBuffer(const std::string& name) const {
+        return bufferAssignments.count(name) && !notBuffers.count(name);
+    }
+
+    // A buffer assigned exactly once, with a constant size, has a known element count.
+    void recordCount(const ASTNode* assignment, IRValue value) {
+        const std::string& name = assignment->value;
+        const ASTNode* expr = assignment->children[0];
+        if (!isBuffer(name) || bufferAssignments[name] != 1) return;
+        if (expr->kind == "List") knownCounts[name] = static_cast<int64_t>(expr->children.size());
+        const IRInst* last = fn->code.empty() ? nullptr : &fn->code.back();
+        if (expr->kind == "New" && last && last->op == IROp::Call && last->dst == value.temp && last->args[0].isImm())
+            knownCounts[name] = last->args[0].imm;
+    }
+
+    void checkIndex(const ASTNode* access, IRValue buffer, IRValue index) {
+        if (!options.boundsChecks) return;
+        const std::string& name = access->value;
+        if (!isBuffer(name)) {
+            note(boundsStats.unchecked, access);
+            return;
+        }
+        auto known = knownCounts.find(name);
+        const ASTNode* expr = access->children[0];
+        int64_t mask;
+        bool masked = expr->kind == "Binary" && expr->value == "and" &&
+                      (constantOf(expr->children[1], mask) || constantOf(expr->children[0], mask)) && mask >= 0;
+        if (known != knownCounts.end() && ((index.isImm() && index.imm >= 0 && index.imm < known->second) ||
+                                           (masked && mask < known->second))) {
+            note(boundsStats.proven, access);
+            return;
+        }
+        if (coveredAccesses.count(access)) return;
+        note(boundsStats.checked, access);
+        if (reportedChecks.insert(access).second) {
+            auto reason = uncoveredReason.find(access);
+            boundsReport.push_back("line " + std::to_string(access->line) + ": " + name + "[...] checked on every access (" +
+                                   (reason != uncoveredReason.end() ? reason->second
+                                                                    : "index is not the counter of an enclosing for-loop plus a constant") + ")");
+        }
+        module.runtime.insert("node_rt_bounds_fail");
+        IRInst in{ IROp::BoundsCheck };
+        in.a = buffer;
+        in.b = index;
+        emit(in);
+    }
+
+    void collectAccesses(const ASTNode* node, std::vector<const ASTNode*>& accesses) const {
+        if ((node->kind == "Index" || node->kind == "Store") && isBuffer(node->value) && !coveredAccesses.count(node))
+            accesses.push_back(node);
+        for (const ASTNode* child : node->children) collectAccesses(child, accesses);
+    }
+
+    static bool exitsEarly(const ASTNode* node) {
+        const std::string& k = node->kind;
+        if (k == "Break" || k == "Return" || k == "Halt" || k == "Throw" || k == "Legacy") return true;
+        if (k == "Call" && node->value == "not_eq") return true;
+        if (k == "Target" && node->value == "throw") return true;
+        for (const ASTNode* child : node->children) if (exitsEarly(child)) return true;
+        return false;
+    }
+
+    static bool deletes(const ASTNode* node, const std::string& name) {
+        if (node->kind == "Delete" && node->children[0]->kind == "Identifier" && node->children[0]->value == name) return true;
+        for (const ASTNode* child : node->children) if (deletes(child, name)) return true;
+        return false;
+    }
+
+    // `var`, `var + k`, `k + var` or `var - k`, with k a compile-time constant.
+    bool loopOffset(const ASTNode* index, const std::string& var, int64_t& offset) const {
+        if (index->kind == "Identifier" && index->value == var) {
+            offset = 0;
+            return true;
+        }
+        if (index->kind != "Binary" || (index->value != "+" && index->value != "-")) return false;
+        const ASTNode *lhs = index->children[0], *rhs = index->children[1];
+        int64_t k;
+        if (lhs->kind == "Identifier" && lhs->value == var && constantOf(rhs, k)) {
+            offset = index->value == "+" ? k : -k;
+            return true;
+        }
+        if (index->value == "+" && rhs->kind == "Identifier" && rhs->value == var && constantOf(lhs, k)) {
+            offset = k;
+            return true;
+        }
+        return false;
+    }
+
+    // Range analysis for a counted upward loop: i runs over [first, end), so buf[i + k] stays in
+    // bounds when first + k >= 0 and end + k <= count. What can be shown at compile time needs
+    // no code; the rest becomes one guard in front of the loop, skipped when the loop does not run.
+    void coverAccesses(ASTNode* loop, const LoopShape& shape) {
+        if (!options.boundsChecks) return;
+        ASTNode* body = loop->children[3];
+        std::vector<const ASTNode*> accesses;
+        collectAccesses(body, accesses);
+        if (accesses.empty()) return;
+        std::string blocker;
+        if (shape.delta <= 0 || (shape.cc != Cond::LT && shape.cc != Cond::LE)) blocker = "the loop does not count upward";
+        else if (exitsEarly(body)) blocker = "the loop can exit early";
+        std::unordered_set<std::string> written;
+        collectWrites(body, written);
+        std::map<std::pair<std::string, int64_t>, std::vector<const ASTNode*>> groups;
+        for (const ASTNode* access : accesses) {
+            int64_t k;
+            if (!loopOffset(access->children[0], shape.var, k)) continue;   // an inner loop may still cover it
+            if (!blocker.empty()) uncoveredReason[access] = blocker;
+            else if (written.count(access->value) || deletes(body, access->value))
+                uncoveredReason[access] = "'" + access->value + "' is reassigned or deleted in the loop";
+            else groups[{ access->value, k }].push_back(access);
+        }
+        if (groups.empty()) return;
+
+        int64_t first = 0, bound = 0;
+        bool constFirst = constantOf(loop->children[0]->children[0], first);
+        bool constEnd = constantOf(shape.bound, bound);
+        if (shape.cc == Cond::LE) bound += 1;
+        bool neverRuns = constFirst && constEnd && first >= bound;
+        std::string skip = newLabel();
+        bool guarded = false;
+        IRValue var = IRValue::T(lookup(shape.var)), end;
+        for (const auto& group : groups) {
+            const std::string& name = group.first.first;
+            int64_t k = group.first.second;
+            auto known = knownCounts.find(name);
+            bool lowOk = constFirst && first + k >= 0;
+            bool highOk = constEnd && known != knownCounts.end() && bound + k <= known->second;
+            if (neverRuns || (lowOk && highOk)) {
+                for (const ASTNode* access : group.second) {
+                    coveredAccesses.insert(access);
+                    note(boundsStats.proven, access);
+                }
+                continue;
+            }
+            if (constFirst && constEnd && known != knownCounts.end() && (first + k < 0 || bound + k > known->second)) {
+                for (const ASTNode* access : group.second) uncoveredReason[access] = "the loop runs past the end of '" + name + "'";
+                continue;
+            }
+            if (!guarded) {
+                end = genExpr(shape.bound);
+                if (shape.cc == Cond::LE) end = binary(IROp::Add, end, IRValue::I(1));
+                emitBranch(var, end, Cond::GE, skip);
+                guarded = true;
+                note(boundsStats.guards, loop);
+            }
+            if (!lowOk) emitBranch(k ? binary(IROp::Add, var, IRValue::I(k)) : var, IRValue::I(0), Cond::LT, "node_rt_bounds_fail");
+            if (!highOk) {
+                IRValue count = known != knownCounts.end() ? IRValue::I(known->second) : IRValue{};
+                if (count.kind == IRValue::None) {
+                    IRInst load{ IROp::Load };
+                    load.a = IRValue::T(lookup(name));
+                    load.b = IRValue::I(-1);
+                    load.dst = fn->newTemp();
+                    emit(load);
+                    count = IRValue::T(load.dst);
+                }
+                emitBranch(k ? binary(IROp::Add, end, IRValue::I(k)) : end, count, Cond::GT, "node_rt_bounds_fail");
+            }
+            for (const ASTNode* access : group.second) {
+                coveredAccesses.insert(access);
+                note(boundsStats.guarded, access);
+            }
+        }
+        if (guarded) {
+            emitLabel(skip);
+            module.runtime.insert("node_rt_bounds_fail");
+        }
+    }
+
+    // Vector loops index without per-element checks, so every checked access must be covered.
+    bool allCovered(const ASTNode* body) const {
+        if (!options.boundsChecks) return true;
+        std::vector<const ASTNode*> accesses;
+        collectAccesses(body, accesses);
+        return accesses.empty();
+    }
+
+    // Literal, or a name bound with `==` to a compile-time value.
+    bool constantOf(const ASTNode* node, int64_t& value) const {
+        if (node->kind == "Number") {
+            value = std::stoll(node->value, nullptr, 0);
+            return true;
+        }
+        auto it = node->kind == "Identifier" ? constants.find(node->value) : constants.end();
+        if (it == constants.end()) return false;
+        value = it->second;
+        return true;
+    }
+
+    bool analyzeLoop(ASTNode* loop, LoopShape& shape) const {
+        ASTNode *init = loop->children[0], *cond = loop->children[1], *step = loop->children[2], *body = loop->children[3];
+        shape.var = init->value;
+        if (cond->kind != "Binary" || !comparison(cond->value, shape.cc) || shape.cc == Cond::EQ) return false;
+        if (cond->children[0]->kind != "Identifier" || cond->children[0]->value != shape.var) return false;
+        shape.bound = cond->children[1];
+        if (shape.bound->kind != "Number" && shape.bound->kind != "Identifier") return false;
+
+        if (step->value != shape.var) return false;
+        ASTNode* inc = step->children[0];
+        if (inc->kind != "Binary" || (inc->value != "+" && inc->value != "-")) return false;
+        ASTNode *lhs = inc->children[0], *rhs = inc->children[1];
+        if (inc->value == "+" && lhs->kind == "Number") std::swap(lhs, rhs);
+        if (lhs->kind != "Identifier" || lhs->value != shape.var || rhs->kind != "Number") return false;
+        shape.delta = std::stoll(rhs->value, nullptr, 0) * (inc->value == "-" ? -1 : 1);
+        if (shape.delta == 0) return false;
+        bool upward = shape.cc == Cond::LT || shape.cc == Cond::LE;
+        bool downward = shape.cc == Cond::GT || shape.cc == Cond::GE;
+        if ((upward && shape.delta < 0) || (downward && shape.delta > 0)) return false;
+
+        std::unordered_set<std::string> written;
+        collectWrites(body, written);
+        if (written.count(shape.var) || (shape.bound->kind == "Identifier" && written.count(shape.bound->value))) return false;
+
+        int64_t v, b;
+        if (constantOf(init->children[0], v) && constantOf(shape.bound, b)) {
+            auto holds = [&](int64_t x) {
+                switch (shape.cc) {
+                case Cond::LT: return x < b;
+                case Cond::LE: return x <= b;
+                case Cond::GT: return x > b;
+                case Cond::GE: return x >= b;
+                case Cond::NE: return x != b;
+                default: return false;
+                }
+            };
+            shape.trip = 0;
+            while (holds(v) && shape.trip <= 4096) { v += shape.delta; ++shape.trip; }
+            shape.constantTrip = shape.trip <= 4096;
+        }
+        // `not_eq` loops are only safe to unroll when the exit value is known to be hit exactly.
+        return shape.cc != Cond::NE || shape.constantTrip;
+    }
+
+    // One copy of the body followed by the step; `continue` lands on this copy's step.
+    void genIteration(ASTNode* loop, const std::string& exit) {
+        std::string step = newLabel();
+        loops.emplace_back(step, exit);
+        emitCounter(loop, 1);
+        genStmt(loop->children[3]);
+        loops.pop_back();
+        emitLabel(step);
+        genStmt(loop->children[2]);
+    }
+
+    void genFor(ASTNode* node) {
+        int requested = 0;
+        if (!node->value.empty() && node->value != "auto") requested = std::stoi(node->value);   // checked by the parser
+        bool explicitUnroll = !node->value.empty();
+
+        // Profile: loops that never ran stay compact; hot loops with long trips get unrolled.
+        bool coldLoop = haveProfile() && profileCount(node, 1) == 0, profileUnroll = false;
+        if (haveProfile() && !explicitUnroll && options.autoUnroll) {
+            uint64_t entries = profileCount(node, 0), iterations = profileCount(node, 1);
+            if (coldLoop) {
+                note(profileStats.coldLoops, node);
+            } else if (iterations >= hotLoopIterations && iterations / std::max<uint64_t>(entries, 1) >= hotLoopTrip) {
+                requested = hotLoopFactor;
+                explicitUnroll = profileUnroll = true;
+                note(profileStats.hotLoops, node);
+            }
+        }
+
+        LoopShape shape;
+        bool canonical = analyzeLoop(node, shape);
+        emitCounter(node, 0);
+        genStmt(node->children[0]);
+        if (canonical) coverAccesses(node, shape);
+        if (!canonical) {
+            if (explicitUnroll)
+                log << "[Line " << node->line << "] Warning: loop is not a counted for-loop; 'unroll' ignored\n";
+            genLoop(node);
+            return;
+        }
+
+        if (options.vectorize && !options.instrument && !coldLoop && vectorizable(node, shape) && allCovered(node->children[3])) {
+            genVectorLoop(node, shape);
+            loopStats.vectorized++;
+            return;
+        }
+
+        // Cost model: the unrolled body may not exceed the node budget.
+        int size = countNodes(node->children[3]) + countNodes(node->children[2]);
+        int affordable = std::max(1, options.unrollBudget / size);
+
+        if (shape.constantTrip && shape.trip * size <= options.unrollBudget &&
+            ((options.autoUnroll && !coldLoop && shape.trip <= maxFullUnrollTrips) || (explicitUnroll && shape.trip <= std::max(requested, maxFullUnrollTrips)))) {
+            std::string exit = newLabel();
+            for (int64_t i = 0; i < shape.trip; ++i) genIteration(node, exit);
+            emitLabel(exit);
+            loopStats.full++;
+            return;
+        }
+
+        int factor = explicitUnroll ? (requested ? requested : maxUnrollFactor) : 1;
+        if (factor > affordable) {
+            if (requested && !profileUnroll) {
+                log << "[Line " << node->line << "] Warning: unroll(" << requested << ") capped to " << affordable
+                    << " by the code-size budget\n";
+                loopStats.capped++;
+            }
+            factor = affordable;
+        }
+        if (shape.constantTrip) factor = static_cast<int>(std::min<int64_t>(factor, std::max<int64_t>(shape.trip, 1)));
+        if (factor <= 1) {
+            genLoop(node);
+            return;
+        }
+
+        // Main loop runs `factor` iterations while the last of them still satisfies the condition;
+        // the remainder loop finishes the leftover trips one at a time.
+        std::string top = newLabel(), rem = newLabel(), exit = newLabel();
+        IRValue bound = genExpr(shape.bound);
+        IRValue var = IRValue::T(lookup(shape.var));
+        emitLabel(top);
+        IRValue last = binary(IROp::Add, var, IRValue::I(shape.delta * (factor - 1)));
+        emitBranch(last, bound, invertCond(shape.cc), rem);
+        for (int i = 0; i < factor; ++i) genIteration(node, exit);
+        emitJump(top);
+        emitLabel(rem);
+        emitBranch(var, bound, invertCond(shape.cc), exit);
+        genIteration(node, exit);
+        emitJump(rem);
+        emitLabel(exit);
+        loopStats.partial++;
+    }
+
+    // Lays out an if. With a profile the likelier arm falls through, and an arm taken on fewer
+    // than 1% of visits moves out of line behind the function's return.
+    void genIf(ASTNode* node) {
+        bool hasElse = node->children.size() > 2;
+        ASTNode *cond = node->children[0], *thenArm = node->children[1], *elseArm = hasElse ? node->children[2] : nullptr;
+        std::string endLabel = newLabel();
+        emitCounter(node, 0);
+
+        if (haveProfile()) {
+            uint64_t reached = profileCount(node, 0), taken = profileCount(node, 1);
+            uint64_t skipped = reached > taken ? reached - taken : 0;
+            auto rare = [&](uint64_t n, ASTNode* arm) { return reached > 0 && n * 100 < reached && !declaresVariables(arm); };
+            if (rare(taken, thenArm)) {
+                std::string cold = newLabel();
+                genBranch(cond, cold, true);
+                if (hasElse) genStmt(elseArm);
+                emitLabel(endLabel);
+                deferCold(node, cold, endLabel, [=] { emitCounter(node, 1); genStmt(thenArm); });
+                return;
+            }
+            if (hasElse && rare(skipped, elseArm)) {
+                std::string cold = newLabel();
+                genBranch(cond, cold, false);
+                emitCounter(node, 1);
+                genStmt(thenArm);
+                emitLabel(endLabel);
+                deferCold(node, cold, endLabel, [=] { genStmt(elseArm); });
+                return;
+            }
+            if (hasElse && skipped > taken) {
+                std::string thenLabel = newLabel();
+                genBranch(cond, thenLabel, true);
+                genStmt(elseArm);
+                emitJump(endLabel);
+                emitLabel(thenLabel);
+                emitCounter(node, 1);
+                genStmt(thenArm);
+                emitLabel(endLabel);
+                note(profileStats.swappedBranches, node);
+                return;
+            }
+        }
+
+        std::string elseLabel = newLabel();
+        genBranch(cond, hasElse ? elseLabel : endLabel, false);
+        emitCounter(node, 1);
+        genStmt(thenArm);
+        if (hasElse) {
+            emitJump(endLabel);
+            emitLabel(elseLabel);
+            genStmt(elseArm);
+        }
+        emitLabel(endLabel);
+    }
+
+    static bool declaresVariables(const ASTNode* node) {
+        if (node->kind == "Init") return true;
+        for (const ASTNode* child : node->children) if (declaresVariables(child)) return true;
+        return false;
+    }
+
+    // Queues `body` to be emitted after the function's return, entered at `label` and
+    // resuming at `resume`. The enclosing loop targets are captured for break/continue.
+    void deferCold(const ASTNode* node, const std::string& label, const std::string& resume, std::function<void()> body) {
+        auto enclosing = loops;
+        coldRegions.push_back([=] {
+            auto saved = loops;
+            loops = enclosing;
+            emitLabel(label);
+            body();
+            emitJump(resume);
+            loops = saved;
+        });
+        note(profileStats.coldBlocks, node);
+    }
+
+    void genLoop(ASTNode* node) {
+        std::string top = newLabel(), step = newLabel(), exit = newLabel();
+        emitLabel(top);
+        genBranch(node->children[1], exit, false);
+        loops.emplace_back(step, exit);
+        emitCounter(node, 1);
+        genStmt(node->children[3]);
+        loops.pop_back();
+        emitLabel(step);
+        genStmt(node->children[2]);
+        emitJump(top);
+        emitLabel(exit);
+    }
+
+    // -- Auto-vectorization -----------------------------------------------
+    //
+    // A counted loop whose body is only `dst[i] = expr` stores, where expr combines `buf[i]`
+    // loads, loop-invariant scalars and constants with xor/and/or/+/-/*, runs four 64-bit lanes
+    // per 256-bit register (2 with SSE2, 8 with AVX-512). A scalar prologue walks `i` until the
+    // first store buffer is aligned to the register width; the main loop then uses aligned loads
+    // when every buffer shares that alignment and unaligned loads otherwise; a scalar epilogue
+    // finishes the tail.
+
+    static constexpr int vectorRegs = 14;     // registers 14 and 15 are multiply scratch
+    static constexpr int minVectorTrips = 16;
+
+    int lanes() const { return vectorBytes / 8; }
+
+    static bool vectorOp(const std::string& op) {
+        return op == "xor" || op == "and" || op == "or" || op == "+" || op == "-" || op == "*";
+    }
+
+    // Registers needed to evaluate `node` (the left result stays live while the right one is computed).
+    static bool vectorExpr(const ASTNode* node, const LoopShape& shape, const std::unordered_set<std::string>& written,
+                           std::vector<const ASTNode*>& splats, int& need) {
+        if (node->kind == "Number" || (node->kind == "Identifier" && node->value != shape.var && !written.count(node->value))) {
+            splats.push_back(node);
+            need = 0;
+            return true;
+        }
+        if (node->kind == "Index") {
+            const ASTNode* idx = node->children[0];
+            need = 1;
+            return node->value != shape.var && idx->kind == "Identifier" && idx->value == shape.var;
+        }
+        if (node->kind == "Binary" && vectorOp(node->value)) {
+            int l, r;
+            if (!vectorExpr(node->children[0], shape, written, splats, l) ||
+                !vectorExpr(node->children[1], shape, written, splats, r)) return false;
+            need = std::max({ l, r + (l > 0 ? 1 : 0), 1 });
+            return true;
+        }
+        return false;
+    }
+
+    bool vectorizable(ASTNode* loop, const LoopShape& shape) {
+        if (shape.delta != 1 || (shape.cc != Cond::LT && shape.cc != Cond::LE)) return false;
+        if (shape.constantTrip && shape.trip < minVectorTrips) return false;
+        ASTNode* body = loop->children[3];
+        if (body->children.empty()) return false;
+        std::unordered_set<std::string> written;
+        collectWrites(body, written);
+        std::vector<const ASTNode*> splats;
+        int need = 0;
+        for (ASTNode* stmt : body->children) {
+            if (stmt->kind != "Store" || stmt->value == shape.var) return false;
+            const ASTNode* idx = stmt->children[0];
+            if (idx->kind != "Identifier" || idx->value != shape.var) return false;
+            int n;
+            if (!vectorExpr(stmt->children[1], shape, written, splats, n)) return false;
+            need = std::max(need, std::max(n, 1));
+        }
+        std::set<std::string> distinct;
+        for (const ASTNode* leaf : splats) distinct.insert(leaf->kind + ":" + leaf->value);
+        return static_cast<int>(distinct.size()) + need <= vectorRegs;
+    }
+
+    static void collectBuffers(const ASTNode* node, std::vector<std::string>& buffers) {
+        if ((node->kind == "Index" || node->kind == "Store") &&
+            std::find(buffers.begin(), buffers.end(), node->value) == buffers.end())
+            buffers.push_back(node->value);
+        for (const ASTNode* child : node->children) collectBuffers(child, buffers);
+    }
+
+    struct VectorState {
+        std::map<std::string, int> splatRegs;
+        uint32_t freeRegs = 0;
+        bool aligned = false;
+        std::string anchor;   // first store buffer, vector-aligned once the prologue is done
+        IRValue index;
+        int64_t offset = 0;   // element offset of the unrolled copy being emitted
+    };
+
+    int takeVectorReg(VectorState& vs) {
+        for (int r = 0; r < vectorRegs; ++r)
+            if (vs.freeRegs & (1u << r)) { vs.freeRegs &= ~(1u << r); return r; }
+        throw std::runtime_error("vector register budget exceeded");
+    }
+
+    // Returns the vector register holding `node`; `temp` is false for shared broadcast registers.
+    int genVectorExpr(ASTNode* node, VectorState& vs, bool& temp) {
+        if (node->kind == "Number" || node->kind == "Identifier") {
+            temp = false;
+            return vs.splatRegs.at(node->kind + ":" + node->value);
+        }
+        if (node->kind == "Index") {
+            IRInst in{ IROp::VLoad };
+            in.a = IRValue::T(lookup(node->value));
+            in.b = vs.index;
+            in.args.push_back(IRValue::I(vs.offset));
+            in.vd = takeVectorReg(vs);
+            in.sym = vs.aligned || node->value == vs.anchor ? "aligned" : "unaligned";
+            emit(in);
+            temp = true;
+            return in.vd;
+        }
+        bool lt, rt;
+        int l = genVectorExpr(node->children[0], vs, lt);
+        int r = genVectorExpr(node->children[1], vs, rt);
+        IRInst in{ IROp::VArith };
+        in.va = l;
+        in.vb = r;
+        in.vd = lt ? l : rt ? r : takeVectorReg(vs);
+        in.sym = node->value;
+        emit(in);
+        if (rt && in.vd != r) vs.freeRegs |= 1u << r;
+        temp = true;
+        return in.vd;
+    }
+
+    // Broadcast every invariant operand once, ahead of the vector loop.
+    void genBroadcasts(ASTNode* body, const LoopShape& shape, VectorState& vs) {
+        vs.splatRegs.clear();
+        vs.freeRegs = (1u << vectorRegs) - 1;
+        std::vector<const ASTNode*> splats;
+        std::unordered_set<std::string> written;
+        for (ASTNode* stmt : body->children) {
+            int need;
+            vectorExpr(stmt->children[1], shape, written, splats, need);
+        }
+        for (const ASTNode* leaf : splats) {
+            std::string key = leaf->kind + ":" + leaf->value;
+            if (vs.splatRegs.count(key)) continue;
+            IRInst in{ IROp::VSplat };
+            in.vd = takeVectorReg(vs);
+            in.a = leaf->kind == "Number" ? IRValue::I(std::stoll(leaf->value, nullptr, 0)) : valueOf(leaf->value);
+            vs.splatRegs[key] = in.vd;
+            emit(in);
+        }
+    }
+
+    void genVectorStores(ASTNode* body, VectorState& vs) {
+        for (ASTNode* stmt : body->children) {
+            bool temp;
+            int r = genVectorExpr(stmt->children[1], vs, temp);
+            IRInst in{ IROp::VStore };
+            in.a = IRValue::T(lookup(stmt->value));
+            in.b = vs.index;
+            in.args.push_back(IRValue::I(vs.offset));
+            in.va = r;
+            in.sym = vs.aligned || stmt->value == vs.anchor ? "aligned" : "unaligned";
+            emit(in);
+            if (temp) vs.freeRegs |= 1u << r;
+        }
+    }
+
+    void genVectorLoop(ASTNode* node, const LoopShape& shape) {
+        ASTNode* body = node->children[3];
+        std::vector<std::string> buffers, stores;
+        collectBuffers(body, buffers);
+        for (ASTNode* stmt : body->children)
+            if (std::find(stores.begin(), stores.end(), stmt->value) == stores.end()) stores.push_back(stmt->value);
+        const std::string& first = stores.front();
+
+        IRValue var = IRValue::T(lookup(shape.var));
+        IRValue end = genExpr(shape.bound);
+        if (shape.cc == Cond::LE) end = binary(IROp::Add, end, IRValue::I(1));
+        auto bump = [&](int64_t by) {
+            IRInst in{ IROp::Add };
+            in.dst = var.temp;
+            in.a = var;
+            in.b = IRValue::I(by);
+            emit(in);
+        };
+        std::string prologue = newLabel(), vecEntry = newLabel(), unaligned = newLabel();
+        std::string done = newLabel(), scalar = newLabel(), exit = newLabel();
+
+        // Buffers written through one name and read through another must be the same
+        // allocation or at least one vector apart, or the lanes would observe each other.
+        for (const std::string& d : stores) {
+            for (const std::string& other : buffers) {
+                if (other == d) continue;
+                std::string ok = newLabel();
+                IRValue diff = binary(IROp::Sub, IRValue::T(lookup(d)), IRValue::T(lookup(other)));
+                emitBranch(diff, IRValue::I(0), Cond::EQ, ok);
+                emitBranch(diff, IRValue::I(-8 * lanes()), Cond::LE, ok);
+                emitBranch(diff, IRValue::I(8 * lanes()), Cond::LT, scalar);
+                emitLabel(ok);
+            }
+        }
+
+        emitLabel(prologue);
+        emitBranch(var, end, Cond::GE, exit);
+        IRValue addr = binary(IROp::Add, IRValue::T(lookup(first)), binary(IROp::Shl, var, IRValue::I(3)));
+        emitBranch(binary(IROp::And, addr, IRValue::I(8 * lanes() - 1)), IRValue::I(0), Cond::EQ, vecEntry);
+        genStmt(body);
+        bump(1);
+        emitJump(prologue);
+
+        emitLabel(vecEntry);
+        // Two vectors per iteration when the body is small enough to repeat. The bound is set
+        // before the alignment test because both the aligned and the unaligned loop read it.
+        int copies = countNodes(body) * 2 <= options.unrollBudget ? 2 : 1;
+        IRValue vectorEnd = materialize(binary(IROp::Sub, end, IRValue::I(copies * lanes() - 1)));
+        IRValue skew = IRValue::I(0);
+        for (const std::string& other : buffers) {
+            if (other == first) continue;
+            skew = binary(IROp::Or, skew, binary(IROp::Xor, IRValue::T(lookup(other)), IRValue::T(lookup(first))));
+        }
+        if (skew.isTemp()) emitBranch(binary(IROp::And, skew, IRValue::I(8 * lanes() - 1)), IRValue::I(0), Cond::NE, unaligned);
+
+        for (int pass = 0; pass < 2; ++pass) {
+            VectorState vs;
+            vs.aligned = pass == 0;
+            vs.anchor = first;
+            vs.index = var;
+            if (pass == 1) emitLabel(unaligned);
+            genBroadcasts(body, shape, vs);
+            std::string top = newLabel();
+            emitLabel(top);
+            emitBranch(var, vectorEnd, Cond::GE, done);
+            for (int c = 0; c < copies; ++c) {
+                vs.offset = c * lanes();
+                genVectorStores(body, vs);
+            }
+            bump(copies * lanes());
+            emitJump(top);
+            if (!skew.isTemp()) break;
+        }
+
+        emitLabel(done);
+        if (vectorBytes > 16) emit(IRInst{ IROp::VZeroUpper });
+        emitLabel(scalar);
+        emitBranch(var, end, Cond::GE, exit);
+        genStmt(body);
+        bump(1);
+        emitJump(scalar);
+        emitLabel(exit);
+    }
+
+    // Table keywords were lowered by the parser; what is left is text no statement matched.
+    void genLegacy(ASTNode* node) {
+        if (!node->value.empty())
+            log << "[Line " << node->line << "] Warning: No recognized NODE operation in: " << node->value << "\n";
+    }
+};
+
+// -----------------------------
+// INLINING
+// -----------------------------
+
+struct InlineStats {
+    int inlined = 0, kept = 0;
+    std::vector<std::string> decisions;   // one line per distinct call site, for --profile
+};
+
+// Bottom-up inliner over the IR: callees are processed before their callers, so a helper that
+// only forwards to smaller helpers is measured after they have been folded into it.
+class Inliner {
+    IRModule& module;
+    InlineStats& stats;
+    AnalysisCache& analyses;
+    std::unordered_map<std::string, IRFunction*> bySymbol;
+    std::set<std::string> reported;
+
+    // Cost model, in IR instructions of the callee body (labels, counters and the final return
+    // are free). Tiny bodies are cheaper than the argument moves, call and frame they replace.
+    static constexpr int alwaysInlineSize = 6;
+    static constexpr int inlineSize = 16;
+    static constexpr int hotInlineSize = 48;        // call sites inside a loop, or callees hot in the profile
+    static constexpr int64_t hotEntries = 10000;
+    static constexpr int maxCallerGrowth = 400;
+
+public:
+    Inliner(IRModule& mod, InlineStats& st, AnalysisCache& an) : module(mod), stats(st), analyses(an) {}
+
+    void Run() {
+        for (IRFunction& f : module.functions) bySymbol[f.symbol] = &f;
+        std::vector<IRFunction*> order;
+        std::set<IRFunction*> visited;
+        for (IRFunction& f : module.functions) postorder(&f, visited, order);
+        for (IRFunction* f : order) inlineInto(*f);
+    }
+
+private:
+    std::vector<IRFunction*> callees(const IRFunction& f) const {
+        std::vector<IRFunction*> out;
+        for (const IRInst& in : f.code) {
+            if (in.op != IROp::Call) continue;
+            auto it = bySymbol.find(in.sym);
+            if (it != bySymbol.end()) out.push_back(it->second);
+        }
+        return out;
+    }
+
+    void postorder(IRFunction* f, std::set<IRFunction*>& visited, std::vector<IRFunction*>& order) {
+        if (!visited.insert(f).second) return;
+        for (IRFunction* callee : callees(*f)) postorder(callee, visited, order);
+        order.push_back(f);
+    }
+
+    bool reaches(IRFunction* from, IRFunction* to) const {
+        std::vector<IRFunction*> work = { from };
+        std::set<IRFunction*> seen;
+        while (!work.empty()) {
+            IRFunction* f = work.back();
+            work.pop_back();
+            for (IRFunction* callee : callees(*f)) {
+                if (callee == to) return true;
+                if (seen.insert(callee).second) work.push_back(callee);
+            }
+        }
+        return false;
+    }
+
+    static int bodySize(const IRFunction& f) {
+        int n = 0;
+        for (const IRInst& in : f.code)
+            if (in.op != IROp::Label && in.op != IROp::Count && in.op != IROp::Param) n++;
+        return n - 1;   // the closing Ret
+    }
+
+    // Empty when the call may be inlined, otherwise the reason it is kept.
+    std::string refuse(IRFunction& caller, IRFunction* callee, const std::string& symbol, bool inLoop, int size,
+                       int growth) const {
+        if (!callee) {
+            for (const DispatchEntry& entry : module.dispatch)
+                if (entry.symbol == symbol) return "dispatched by CPU";
+            return "not a routine of this module";
+        }
+        if (callee->noinline) return "@noinline";
+        if (callee == &caller || reaches(callee, callee)) return "recursive";
+        for (const IRInst& in : callee->code) {
+            if (in.op == IROp::Raw) return "contains legacy instructions";
+            if (in.op >= IROp::VLoad) return "contains vector loops";
+        }
+        if (callee->entries == 0 || caller.entries == 0) return "cold in the profile";
+        if (size <= alwaysInlineSize) return "";
+        int limit = (inLoop || callee->entries >= hotEntries) ? hotInlineSize : inlineSize;
+        if (size > limit) return "size " + std::to_string(size) + " over " + std::to_string(limit);
+        if (growth + size > maxCallerGrowth) return "caller growth budget spent";
+        return "";
+    }
+
+    void inlineInto(IRFunction& caller) {
+        int& growth = caller.inlineGrowth;
+        std::vector<char> inLoop = analyses.loops(caller);   // a copy: the caller's code is replaced below
+        std::vector<IRInst> out;
+        out.reserve(caller.code.size());
+        for (size_t i = 0; i < caller.code.size(); ++i) {
+            const IRInst& in = caller.code[i];
+            if (in.op != IROp::Call || module.runtime.count(in.sym)) { out.push_back(in); continue; }
+            auto it = bySymbol.find(in.sym);
+            IRFunction* callee = it == bySymbol.end() ? nullptr : it->second;
+            int size = callee ? bodySize(*callee) : 0;
+            std::string reason = refuse(caller, callee, in.sym, inLoop[i], size, growth);
+            std::string site = caller.name + " -> " + (callee ? callee->name : in.sym) + " (line " + std::to_string(in.line) + ")";
+            if (!reason.empty()) {
+                stats.kept++;
+                if (reported.insert(site).second) stats.decisions.push_back("kept " + site + ": " + reason);
+                out.push_back(in);
+                continue;
+            }
+            stats.inlined++;
+            growth += size;
+            if (reported.insert(site).second)
+                stats.decisions.push_back("inlined " + site + ": size " + std::to_string(size) + (inLoop[i] ? ", in loop" : ""));
+            expand(caller, *callee, in, out);
+        }
+        caller.code = std::move(out);
+        analyses.invalidate(caller);
+    }
+
+    // Copies the callee body in place of `call`: parameters become copies of the arguments,
+    // temps and labels are renamed, and each return assigns the result and jumps past the body.
+    void expand(IRFunction& caller, const IRFunction& callee, const IRInst& call, std::vector<IRInst>& out) {
+        int site = caller.passLabels++;
+        std::string suffix = "_i" + std::to_string(site);
+        std::string done = ".Linl" + std::to_string(site);
+        std::vector<int> temp(callee.tempNames.size());
+        for (size_t t = 0; t < temp.size(); ++t)
+            temp[t] = caller.newTemp(callee.tempNames[t].empty() ? "" : callee.name + "." + callee.tempNames[t]);
+        std::set<std::string> local;
+        for (const IRInst& in : callee.code) if (in.op == IROp::Label) local.insert(in.sym);
+        auto value = [&](IRValue v) { if (v.isTemp()) v.temp = temp[v.temp]; return v; };
+        bool jumped = false;
+
+        for (size_t i = 0; i < callee.code.size(); ++i) {
+            IRInst in = callee.code[i];
+            in.line = call.line;
+            if (in.op == IROp::Param) {
+                size_t n = static_cast<size_t>(in.a.imm);
+                IRValue arg = n < call.args.size() ? call.args[n] : IRValue::I(0);
+                in.op = arg.isImm() ? IROp::Const : IROp::Copy;
+                in.a = arg;
+                in.dst = temp[in.dst];
+                out.push_back(in);
+                continue;
+            }
+            if (in.op == IROp::Ret) {
+                if (call.dst >= 0) {
+                    IRInst result{ in.a.kind == IRValue::None || in.a.isImm() ? IROp::Const : IROp::Copy };
+                    result.dst = call.dst;
+                    result.a = in.a.kind == IRValue::None ? IRValue::I(0) : value(in.a);
+                    result.line = call.line;
+                    out.push_back(result);
+                }
+                if (i + 1 < callee.code.size()) {
+                    jumped = true;
+                    IRInst jump{ IROp::Jump };
+                    jump.sym = done;
+                    jump.line = call.line;
+                    out.push_back(jump);
+                }
+                continue;
+            }
+            if (in.dst >= 0) in.dst = temp[in.dst];
+            in.a = value(in.a);
+            in.b = value(in.b);
+            for (IRValue& v : in.args) v = value(v);
+            if ((in.op == IROp::Label || in.op == IROp::Jump || in.op == IROp::Branch) && local.count(in.sym)) in.sym += suffix;
+            out.push_back(in);
+        }
+        if (!jumped) return;
+        IRInst end{ IROp::Label };
+        end.sym = done;
+        end.line = call.line;
+        out.push_back(end);
+    }
+};
+
+// -----------------------------
+// SCALAR OPTIMIZATION (live-range webs, value numbering, loop-invariant code motion)
+// -----------------------------
+
+struct ScalarStats {
+    int webs = 0, propagated = 0, folded = 0, reused = 0, removed = 0, hoisted = 0;
+};
+
+static bool isPure(IROp op) {
+    switch (op) {
+    case IROp::Const: case IROp::Copy: case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::Div:
+    case IROp::Mod: case IROp::And: case IROp::Or: case IROp::Xor: case IROp::Shl: case IROp::Shr:
+    case IROp::Neg: case IROp::Not: case IROp::SetCC: case IROp::AddrOf: case IROp::FrameAddr:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool commutative(IROp op) {
+    return op == IROp::Add || op == IROp::Mul || op == IROp::And || op == IROp::Or || op == IROp::Xor;
+}
+
+static void forEachUse(IRInst& in, const std::function<void(IRValue&)>& f) {
+    f(in.a);
+    f(in.b);
+    for (IRValue& v : in.args) f(v);
+}
+
+static std::vector<std::vector<int>> definitions(const IRFunction& fn) {
+    std::vector<std::vector<int>> defs(fn.tempNames.size());
+    for (size_t i = 0; i < fn.code.size(); ++i)
+        if (fn.code[i].dst >= 0) defs[fn.code[i].dst].push_back(static_cast<int>(i));
+    return defs;
+}
+
+class ScalarOptimizer {
+    IRFunction& fn;
+    ScalarStats& stats;
+
+    static constexpr int maxHoistPerLoop = 8;
+
+public:
+    ScalarOptimizer(IRFunction& f, ScalarStats& st) : fn(f), stats(st) {}
+
+    // A variable reused for unrelated purposes (the `i` of two loops, say) is one temp with
+    // one long live interval. Each group of definitions that reach common uses becomes its
+    // own temp, so the allocator sees separate, shorter ranges.
+    void splitWebs() {
+        std::vector<std::vector<int>> defs = definitions(fn);
+        std::vector<int> siteOf(fn.code.size(), -1), siteInst, siteTemp;
+        for (size_t t = 0; t < defs.size(); ++t) {
+            if (defs[t].size() < 2) continue;
+            for (int i : defs[t]) {
+                siteOf[i] = static_cast<int>(siteInst.size());
+                siteInst.push_back(i);
+                siteTemp.push_back(static_cast<int>(t));
+            }
+        }
+        if (siteInst.empty()) return;
+        size_t sites = siteInst.size(), words = (sites + 63) / 64;
+        using Bits = std::vector<uint64_t>;
+        auto set = [](Bits& b, size_t k) { b[k / 64] |= uint64_t(1) << (k % 64); };
+        auto test = [](const Bits& b, size_t k) { return (b[k / 64] >> (k % 64)) & 1; };
+        std::vector<Bits> kills(defs.size());   // per temp: all of its definition sites
+        std::vector<std::vector<int>> sitesOf(defs.size());
+        for (size_t k = 0; k < sites; ++k) {
+            Bits& kb = kills[siteTemp[k]];
+            if (kb.empty()) kb.assign(words, 0);
+            set(kb, k);
+            sitesOf[siteTemp[k]].push_back(static_cast<int>(k));
+        }
+
+        std::vector<BasicBlock> blocks = buildBlocks(fn);
+        std::vector<Bits> gen(blocks.size(), Bits(words, 0)), kill(blocks.size(), Bits(words, 0));
+        std::vector<Bits> in(blocks.size(), Bits(words, 0)), out(blocks.size(), Bits(words, 0));
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            for (int i = blocks[b].first; i <= blocks[b].last; ++i) {
+                int k = siteOf[i];
+                if (k < 0) continue;
+                const Bits& kt = kills[siteTemp[k]];
+                for (size_t w = 0; w < words; ++w) { gen[b][w] &= ~kt[w]; kill[b][w] |= kt[w]; }
+                set(gen[b], k);
+            }
+        }
+        std::vector<std::vector<int>> preds(blocks.size());
+        for (size_t b = 0; b < blocks.size(); ++b)
+            for (int s : blocks[b].succ) preds[s].push_back(static_cast<int>(b));
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t b = 0; b < blocks.size(); ++b) {
+                Bits next(words, 0);
+                for (int p : preds[b]) for (size_t w = 0; w < words; ++w) next[w] |= out[p][w];
+                in[b] = next;
+                for (size_t w = 0; w < words; ++w) next[w] = gen[b][w] | (next[w] & ~kill[b][w]);
+                if (next != out[b]) { out[b] = next; changed = true; }
+            }
+        }
+
+        std::vector<int> parent(sites);
+        for (size_t k = 0; k < sites; ++k) parent[k] = static_cast<int>(k);
+        std::function<int(int)> find = [&](int k) { return parent[k] == k ? k : parent[k] = find(parent[k]); };
+        std::vector<int> ops;
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            Bits live = in[b];
+            for (int i = blocks[b].first; i <= blocks[b].last; ++i) {
+                irUses(fn.code[i], ops);
+                for (int t : ops) {
+                    if (kills[t].empty()) continue;
+                    int first = -1;
+                    for (int k : sitesOf[t]) {
+                        if (!test(live, k)) continue;
+                        if (first < 0) first = find(k);
+                        else parent[find(k)] = first;
+                    }
+                }
+                int k = siteOf[i];
+                if (k < 0) continue;
+                const Bits& kt = kills[siteTemp[k]];
+                for (size_t w = 0; w < words; ++w) live[w] &= ~kt[w];
+                set(live, k);
+            }
+        }
+
+        // Rename: the web holding a temp's first definition keeps the temp, the others get new ones.
+        std::vector<int> webTemp(sites, -1);
+        for (size_t t = 0; t < defs.size(); ++t) {
+            if (defs[t].size() < 2) continue;
+            int keep = find(siteOf[defs[t][0]]);
+            for (int i : defs[t]) {
+                int root = find(siteOf[i]);
+                if (webTemp[root] >= 0) continue;
+                webTemp[root] = root == keep ? static_cast<int>(t) : fn.newTemp(fn.tempNames[t]);
+                if (root != keep) stats.webs++;
+            }
+        }
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            Bits live = in[b];
+            for (int i = blocks[b].first; i <= blocks[b].last; ++i) {
+                IRInst& inst = fn.code[i];
+                forEachUse(inst, [&](IRValue& v) {
+                    if (!v.isTemp() || v.temp >= static_cast<int>(kills.size()) || kills[v.temp].empty()) return;
+                    for (int k : sitesOf[v.temp])
+                        if (test(live, k)) { v.temp = webTemp[find(k)]; return; }
+                });
+                int k = siteOf[i];
+                if (k < 0) continue;
+                const Bits& kt = kills[siteTemp[k]];
+                for (size_t w = 0; w < words; ++w) live[w] &= ~kt[w];
+                set(live, k);
+                inst.dst = webTemp[find(k)];
+            }
+        }
+    }
+
+    // Dominator-scoped value numbering. Temps with one definition that dominates every use are
+    // values in the SSA sense: constants and copies among them are propagated, and a repeated
+    // expression over them reuses the earlier result. Expressions over reassigned variables
+    // (and loads, which stores and calls can invalidate) are only matched within a block.
+    void numberValues(const DominatorTree& dom) {
+        std::vector<std::vector<int>> defs = definitions(fn);
+        size_t temps = fn.tempNames.size();
+        std::vector<char> stable(temps, 0);
+        for (size_t t = 0; t < temps; ++t) stable[t] = defs[t].size() == 1 && dom.reachable(dom.blockOf[defs[t][0]]);
+        std::vector<int> ops;
+        for (size_t i = 0; i < fn.code.size(); ++i) {
+            irUses(fn.code[i], ops);
+            for (int t : ops)
+                if (stable[t] && !dom.dominatesInst(defs[t][0], static_cast<int>(i))) stable[t] = 0;
+        }
+        std::vector<IRValue> repl(temps);
+        std::vector<int> version(temps, 0);
+        struct Entry { int temp, block, version; };
+        std::unordered_map<std::string, Entry> table;
+        std::vector<std::vector<std::pair<std::string, std::unique_ptr<Entry>>>> undo(dom.blocks.size());
+        int memoryEpoch = 0;
+
+        auto operand = [&](const IRValue& v, int block) {
+            if (v.isImm()) return "#" + std::to_string(v.imm);
+            if (!v.isTemp()) return std::string("_");
+            if (stable[v.temp]) return "t" + std::to_string(v.temp);
+            return "t" + std::to_string(v.temp) + "@" + std::to_string(block) + "." + std::to_string(version[v.temp]);
+        };
+
+        std::function<void(int)> visit = [&](int b) {
+            for (int i = dom.blocks[b].first; i <= dom.blocks[b].last; ++i) {
+                IRInst& in = fn.code[i];
+                forEachUse(in, [&](IRValue& v) {
+                    if (v.isTemp() && repl[v.temp].kind != IRValue::None) { v = repl[v.temp]; stats.propagated++; }
+                });
+                if (in.op == IROp::Store || in.op == IROp::VStore || in.op == IROp::Call || in.op == IROp::TailCall ||
+                    in.op == IROp::Raw)
+                    memoryEpoch++;
+                if (in.op == IROp::Branch && in.a.isImm() && in.b.isImm()) {
+                    // Decided at compile time; the dominator tree stays a safe over-approximation.
+                    // A branch never taken becomes an empty Copy for removeDeadCode to drop.
+                    if (holdsCond(in.a.imm, in.b.imm, in.cc)) in.op = IROp::Jump;
+                    else in.op = IROp::Copy, in.sym.clear();
+                    in.a = in.b = IRValue{};
+                    stats.folded++;
+                    continue;
+                }
+                if (in.dst < 0) continue;
+                int d = in.dst;
+                int64_t folded;
+                if (isPure(in.op) && in.op != IROp::Const && in.op != IROp::Copy && foldConstant(in, folded)) {
+                    in.op = IROp::Const;
+                    in.a = IRValue::I(folded);
+                    in.b = IRValue{};
+                    stats.folded++;
+                }
+                if ((in.op == IROp::Const || in.op == IROp::Copy) && stable[d] && (in.a.isImm() || stable[in.a.temp])) {
+                    repl[d] = in.a;
+                    version[d]++;
+                    continue;
+                }
+                bool keyed = (isPure(in.op) && in.op != IROp::Const && in.op != IROp::Copy) || in.op == IROp::Load;
+                if (keyed) {
+                    std::string x = operand(in.a, b), y = operand(in.b, b);
+                    if (commutative(in.op) && y < x) std::swap(x, y);
+                    std::string key = std::to_string(static_cast<int>(in.op)) + ":" + std::to_string(static_cast<int>(in.cc)) +
+                                      ":" + x + ":" + y + ":" + in.sym;
+                    if (in.op == IROp::Load) key += "@" + std::to_string(b) + "m" + std::to_string(memoryEpoch);
+                    auto it = table.find(key);
+                    bool valid = it != table.end() &&
+                                 (stable[it->second.temp] ||
+                                  (it->second.block == b && version[it->second.temp] == it->second.version));
+                    if (valid) {
+                        int r = it->second.temp;
+                        stats.reused++;
+                        if (stable[d] && stable[r]) {
+                            repl[d] = IRValue::T(r);
+                        } else {
+                            in.op = IROp::Copy;
+                            in.a = IRValue::T(r);
+                            in.b = IRValue{};
+                            in.sym.clear();
+                        }
+                        version[d]++;
+                        continue;
+                    }
+                    version[d]++;
+                    std::unique_ptr<Entry> old = it == table.end() ? nullptr : std::make_unique<Entry>(it->second);
+                    table[key] = Entry{ d, b, version[d] };
+                    undo[b].emplace_back(key, std::move(old));
+                    continue;
+                }
+                version[d]++;
+            }
+            for (int c : dom.children[b]) visit(c);
+            for (auto it = undo[b].rbegin(); it != undo[b].rend(); ++it) {
+                if (it->second) table[it->first] = *it->second;
+                else table.erase(it->first);
+            }
+        };
+        if (!dom.blocks.empty()) visit(0);
+    }
+
+    void removeDeadCode() {
+        for (bool changed = true; changed;) {
+            changed = false;
+            std::vector<int> uses(fn.tempNames.size(), 0), ops;
+            for (const IRInst& in : fn.code) {
+                irUses(in, ops);
+                for (int t : ops) uses[t]++;
+            }
+            std::vector<IRInst> out;
+            out.reserve(fn.code.size());
+            for (IRInst& in : fn.code) {
+                if ((isPure(in.op) || in.op == IROp::Load) && (in.dst < 0 || !uses[in.dst])) {
+                    stats.removed++;
+                    changed = true;
+                    continue;
+                }
+                out.push_back(std::move(in));
+            }
+            fn.code = std::move(out);
+        }
+    }
+
+    // Hoists pure computations whose operands do not change inside a loop into a preheader in
+    // front of the loop header. One natural loop per round; the CFG is rebuilt after each.
+    void hoistInvariants() {
+        std::set<std::string> done;
+        for (int round = 0; round < 256; ++round) {
+            DominatorTree dom(fn);
+            int header = -1;
+            std::vector<char> body(dom.blocks.size(), 0);
+            std::vector<int> work;
+            for (size_t h = 0; h < dom.blocks.size() && header < 0; ++h) {
+                const IRInst& head = fn.code[dom.blocks[h].first];
+                if (head.op != IROp::Label || done.count(head.sym)) continue;
+                for (int p : dom.preds[h])
+                    if (dom.dominates(static_cast<int>(h), p) && !body[p]) { body[p] = 1; work.push_back(p); }
+                if (!work.empty()) header = static_cast<int>(h);
+            }
+            if (header < 0) break;
+            done.insert(fn.code[dom.blocks[header].first].sym);
+            body[header] = 1;
+            while (!work.empty()) {
+                int b = work.back();
+                work.pop_back();
+                if (b == header) continue;
+                for (int p : dom.preds[b]) if (!body[p]) { body[p] = 1; work.push_back(p); }
+            }
+            hoistLoop(dom, definitions(fn), header, body);
+        }
+    }
+
+private:
+    void hoistLoop(const DominatorTree& dom, const std::vector<std::vector<int>>& defs, int header,
+                   const std::vector<char>& body) {
+        int first = dom.blocks[header].first;
+        // The preheader must only be reachable from outside the loop.
+        if (first > 0) {
+            const IRInst& before = fn.code[first - 1];
+            if (!isTerminator(before.op) && body[dom.blockOf[first - 1]]) return;
+        }
+        auto inLoop = [&](int i) { return body[dom.blockOf[i]] != 0; };
+        auto invariant = [&](const IRValue& v, const std::set<int>& hoisted) {
+            if (!v.isTemp()) return true;
+            if (hoisted.count(v.temp)) return true;
+            for (int d : defs[v.temp]) if (inLoop(d)) return false;
+            return true;
+        };
+        std::vector<int> picked;
+        std::set<int> hoisted;
+        for (bool grew = true; grew && static_cast<int>(picked.size()) < maxHoistPerLoop;) {
+            grew = false;
+            for (size_t i = 0; i < fn.code.size() && static_cast<int>(picked.size()) < maxHoistPerLoop; ++i) {
+                const IRInst& in = fn.code[i];
+                if (!inLoop(static_cast<int>(i)) || !isPure(in.op) || in.op == IROp::Const || in.op == IROp::Copy) continue;
+                if (in.dst < 0 || defs[in.dst].size() != 1 || hoisted.count(in.dst)) continue;
+                if ((in.op == IROp::Div || in.op == IROp::Mod) && (!in.b.isImm() || in.b.imm == 0 || in.b.imm == -1)) continue;
+                if (!invariant(in.a, hoisted) || !invariant(in.b, hoisted)) continue;
+                hoisted.insert(in.dst);
+                picked.push_back(static_cast<int>(i));
+                grew = true;
+            }
+        }
+        if (picked.empty()) return;
+
+        std::string headLabel = fn.code[first].sym, pre = headLabel + "_pre" + std::to_string(fn.passLabels++);
+        std::vector<IRInst> moved;   // in discovery order, so operands precede their users
+        for (int i : picked) moved.push_back(fn.code[i]);
+        std::set<int> pickedSet(picked.begin(), picked.end());
+        std::vector<IRInst> out;
+        out.reserve(fn.code.size() + 1);
+        for (size_t i = 0; i < fn.code.size(); ++i) {
+            if (static_cast<int>(i) == first) {
+                IRInst label{ IROp::Label };
+                label.sym = pre;
+                label.line = fn.code[first].line;
+                out.push_back(label);
+                out.insert(out.end(), moved.begin(), moved.end());
+            }
+            if (pickedSet.count(static_cast<int>(i))) continue;
+            IRInst in = fn.code[i];
+            if ((in.op == IROp::Jump || in.op == IROp::Branch) && in.sym == headLabel && !inLoop(static_cast<int>(i))) in.sym = pre;
+            out.push_back(in);
+        }
+        fn.code = std::move(out);
+        stats.hoisted += static_cast<int>(picked.size());
+    }
+};
+
+// -----------------------------
+// ESCAPE ANALYSIS
+// -----------------------------
+
+struct EscapeStats {
+    int stack = 0, arena = 0, escaped = 0, deletesRemoved = 0;
+};
+
+// Finds `new[N]` results that never leave the function: the pointer is only copied between
+// temps, indexed, compared and deleted, never passed to a call, stored, printed or returned.
+// Small constant-size buffers outside loops get zeroed stack storage and lose their delete;
+// the rest bump a scoped arena that the function rewinds on return, with delete becoming a
+// pop of the arena top.
+class EscapeAnalysis {
+    IRFunction& fn;
+    IRModule& module;
+    EscapeStats& stats;
+    int labels = 0;
+
+    static constexpr int64_t maxStackElements = 512;    // per buffer
+    static constexpr int maxStackWords = 2048;          // per function
+
+public:
+    EscapeAnalysis(IRFunction& f, IRModule& mod, EscapeStats& st) : fn(f), module(mod), stats(st) {}
+
+    // `inLoop` is the natural-loop membership of fn's code as it is now.
+    void Run(const std::vector<char>& inLoop) {
+        std::vector<size_t> sites;
+        for (size_t i = 0; i < fn.code.size(); ++i)
+            if (fn.code[i].op == IROp::Call && fn.code[i].sym == "node_rt_new") sites.push_back(i);
+        if (sites.empty()) return;
+
+        // Per instruction: what replaces it (empty = keep), decided before anything moves.
+        std::vector<std::vector<IRInst>> replace(fn.code.size());
+        std::vector<char> drop(fn.code.size(), 0);
+        bool arena = false;
+        for (size_t site : sites) {
+            std::set<int> aliases;
+            if (!contained(site, aliases)) { stats.escaped++; continue; }
+            const IRInst& call = fn.code[site];
+            const IRValue& count = call.args[0];
+            bool onStack = !inLoop[site] && count.isImm() && count.imm >= 0 && count.imm <= maxStackElements &&
+                           fn.bufferWords + 2 + ((count.imm + 1) & ~int64_t(1)) <= maxStackWords;
+            for (size_t i = 0; i < fn.code.size(); ++i) {
+                IRInst& in = fn.code[i];
+                if (in.op != IROp::Call || in.sym != "node_rt_delete" || !in.args[0].isTemp() || !aliases.count(in.args[0].temp)) continue;
+                if (onStack) { drop[i] = 1; stats.deletesRemoved++; }
+                else in.sym = "node_rt_arena_pop";
+            }
+            if (onStack) {
+                replace[site] = stackBuffer(call.dst, count.imm, call.line);
+                stats.stack++;
+            } else {
+                fn.code[site].sym = "node_rt_arena_new";
+                arena = true;
+                stats.arena++;
+            }
+        }
+
+        std::vector<IRInst> out;
+        int mark = arena ? fn.newTemp() : -1;
+        size_t entry = 0;   // the arena mark is taken once the parameters have arrived
+        while (entry < fn.code.size() && fn.code[entry].op == IROp::Param) ++entry;
+        for (size_t i = 0; i < fn.code.size(); ++i) {
+            const IRInst& in = fn.code[i];
+            if (arena && i == entry) takeMark(mark, in.line, out);
+            if (arena && in.op == IROp::Ret) rewind(mark, in.line, out);
+            if (drop[i]) continue;
+            if (!replace[i].empty()) out.insert(out.end(), replace[i].begin(), replace[i].end());
+            else out.push_back(in);
+        }
+        fn.code = std::move(out);
+        if (arena) {
+            module.runtime.insert("node_rt_arena_new");
+            module.runtime.insert("node_rt_arena_pop");
+            module.runtime.insert("node_rt_delete");
+            module.runtime.insert("node_arena_top");
+        }
+    }
+
+private:
+    // Collects the temps that hold the allocation made at `site` and reports whether its
+    // address stays inside the function. Values computed from the address (alignment and
+    // overlap checks) are followed too, so they cannot smuggle it out.
+    bool contained(size_t site, std::set<int>& aliases) const {
+        aliases = { fn.code[site].dst };
+        std::set<int> derived;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const IRInst& in : fn.code) {
+                auto holds = [&](const IRValue& v) { return v.isTemp() && (aliases.count(v.temp) || derived.count(v.temp)); };
+                bool reads = holds(in.a) || holds(in.b);
+                for (const IRValue& v : in.args) reads = reads || holds(v);
+                if (!reads) continue;
+                switch (in.op) {
+                case IROp::Copy:
+                    if (aliases.count(in.a.temp) ? aliases.insert(in.dst).second : derived.insert(in.dst).second) changed = true;
+                    break;
+                case IROp::Call:
+                    if (in.sym != "node_rt_delete" || !in.args[0].isTemp() || !aliases.count(in.args[0].temp)) return false;
+                    break;
+                case IROp::Store:
+                    if (holds(in.args[0])) return false;
+                    break;
+                case IROp::Ret: case IROp::Print: case IROp::VSplat: case IROp::Raw:
+                    return false;
+                case IROp::Load: case IROp::VLoad: case IROp::VStore: case IROp::Branch:
+                    break;
+                default:
+                    if (in.dst >= 0 && derived.insert(in.dst).second) changed = true;
+                    break;
+                }
+            }
+        }
+        // Every value in an alias must come from this allocation, or delete could see another pointer.
+        for (size_t i = 0; i < fn.code.size(); ++i) {
+            const IRInst& in = fn.code[i];
+            if (in.dst < 0 || !aliases.count(in.dst) || i == site) continue;
+            if (in.op != IROp::Copy || !in.a.isTemp() || !aliases.count(in.a.temp)) return false;
+        }
+        return true;
+    }
+
+    // Header word with the element count below the data, like node_rt_new, then zeroed elements.
+    std::vector<IRInst> stackBuffer(int dst, int64_t count, int line) {
+        std::vector<IRInst> code;
+        auto add = [&](IRInst in) { in.line = line; code.push_back(in); };
+        IRInst addr{ IROp::FrameAddr };
+        addr.dst = dst;
+        addr.a = IRValue::I(fn.bufferWords + 2);
+        add(addr);
+        fn.bufferWords += 2 + static_cast<int>((count + 1) & ~int64_t(1));
+        auto store = [&](IRValue index, int64_t value) {
+            IRInst st{ IROp::Store };
+            st.a = IRValue::T(dst);
+            st.b = index;
+            st.args.push_back(IRValue::I(value));
+            add(st);
+        };
+        store(IRValue::I(-1), count);
+        if (count <= 8) {
+            for (int64_t k = 0; k < count; ++k) store(IRValue::I(k), 0);
+            return code;
+        }
+        int i = fn.newTemp();
+        std::string top = ".Lstk" + std::to_string(labels++) + "_" + fn.symbol;
+        IRInst zero{ IROp::Const };
+        zero.dst = i;
+        zero.a = IRValue::I(0);
+        add(zero);
+        IRInst label{ IROp::Label };
+        label.sym = top;
+        add(label);
+        store(IRValue::T(i), 0);
+        IRInst next{ IROp::Add };
+        next.dst = i;
+        next.a = IRValue::T(i);
+        next.b = IRValue::I(1);
+        add(next);
+        IRInst loop{ IROp::Branch };
+        loop.a = IRValue::T(i);
+        loop.b = IRValue::I(count);
+        loop.cc = Cond::LT;
+        loop.sym = top;
+        add(loop);
+        return code;
+    }
+
+    void takeMark(int mark, int line, std::vector<IRInst>& out) {
+        IRInst addr{ IROp::AddrOf };
+        addr.dst = fn.newTemp();
+        addr.sym = "node_arena_top";
+        addr.line = line;
+        IRInst load{ IROp::Load };
+        load.dst = mark;
+        load.a = IRValue::T(addr.dst);
+        load.b = IRValue::I(0);
+        load.line = line;
+        out.push_back(addr);
+        out.push_back(load);
+    }
+
+    void rewind(int mark, int line, std::vector<IRInst>& out) {
+        IRInst addr{ IROp::AddrOf };
+        addr.dst = fn.newTemp();
+        addr.sym = "node_arena_top";
+        addr.line = line;
+        out.push_back(addr);
+        IRInst store{ IROp::Store };
+        store.a = IRValue::T(addr.dst);
+        store.b = IRValue::I(0);
+        store.args.push_back(IRValue::T(mark));
+        store.line = line;
+        out.push_back(store);
+    }
+};
+
+// -----------------------------
+// TAIL CALLS
+// -----------------------------
+
+// True when control falls from instruction `i` to a return of `value` (or of whatever the
+// call left in RAX) through nothing but labels and jumps, as inlined bodies produce.
+static bool returnsAfter(const IRFunction& fn, size_t i, int value,
+                         const std::unordered_map<std::string, size_t>& labelAt) {
+    size_t j = i + 1;
+    for (int hops = 0; j < fn.code.size() && hops < 16;) {
+        const IRInst& in = fn.code[j];
+        if (in.op == IROp::Label) { ++j; continue; }
+        if (in.op == IROp::Ret) return in.a.kind == IRValue::None || (in.a.isTemp() && in.a.temp == value);
+        if (in.op != IROp::Jump) return false;
+        auto it = labelAt.find(in.sym);
+        if (it == labelAt.end()) return false;
+        j = it->second;
+        ++hops;
+    }
+    return false;
+}
+
+// Turns `call f; Return` (and `Return f(...)`) into a jump that reuses the caller's return
+// address, so chains of routines and self-recursion in tail position run in constant stack.
+static int markTailCalls(IRFunction& fn) {
+    std::unordered_map<std::string, size_t> labelAt;
+    for (size_t i = 0; i < fn.code.size(); ++i)
+        if (fn.code[i].op == IROp::Label) labelAt[fn.code[i].sym] = i;
+    int converted = 0;
+    std::vector<IRInst> out;
+    out.reserve(fn.code.size());
+    for (size_t i = 0; i < fn.code.size(); ++i) {
+        IRInst in = fn.code[i];
+        if (in.op == IROp::Call && returnsAfter(fn, i, in.dst, labelAt)) {
+            in.op = IROp::TailCall;
+            in.dst = -1;
+            converted++;
+            out.push_back(in);
+            if (i + 1 < fn.code.size() && fn.code[i + 1].op == IROp::Ret) ++i;   // unreachable now
+            continue;
+        }
+        out.push_back(in);
+    }
+    fn.code = std::move(out);
+    return converted;
+}
+
+// -----------------------------
+// PASS MANAGER
+// -----------------------------
+
+static long peakResidentKiB() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss;
+#endif
+    return 0;
+}
+
+// Wall time and peak-RSS growth per phase, in first-run order; repeated passes accumulate.
+struct PassTimings {
+    struct Entry {
+        std::string name;
+        int runs = 0;
+        double seconds = 0;
+        long rssKiB = 0;
+        long irAfter = -1;   // IR instructions in the module after the last run; -1 outside the IR
+    };
+    std::vector<Entry> entries;
+
+    Entry& measure(const std::string& name, const std::function<void()>& body) {
+        auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.name == name; });
+        if (it == entries.end()) it = entries.insert(entries.end(), Entry{ name });
+        long rss = peakResidentKiB();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        // `body` may have added entries of its own; look ours up again.
+        Entry& entry = *std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.name == name; });
+        entry.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        entry.rssKiB += peakResidentKiB() - rss;
+        entry.runs++;
+        return entry;
+    }
+
+    // Folds in the phases timed on another thread; runs and times add up.
+    void Add(const PassTimings& other) {
+        for (const Entry& e : other.entries) {
+            auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& mine) { return mine.name == e.name; });
+            if (it == entries.end()) { entries.push_back(e); continue; }
+            it->runs += e.runs;
+            it->seconds += e.seconds;
+            it->rssKiB += e.rssKiB;
+        }
+    }
+
+    void Print(std::ostream& out) const {
+        double total = 0;
+        for (const Entry& e : entries) total += e.seconds;
+        char row[160];
+        std::snprintf(row, sizeof row, "[Time] %-14s %5s %11s %7s %12s %10s\n", "phase", "runs", "wall ms", "share",
+                      "peak RSS +KiB", "IR insts");
+        out << row;
+        for (const Entry& e : entries) {
+            std::string ir = e.irAfter < 0 ? "-" : std::to_string(e.irAfter);
+            std::snprintf(row, sizeof row, "[Time] %-14s %5d %11.3f %6.1f%% %12ld %10s\n", e.name.c_str(), e.runs,
+                          e.seconds * 1000, total > 0 ? 100 * e.seconds / total : 0.0, e.rssKiB, ir.c_str());
+            out << row;
+        }
+        std::snprintf(row, sizeof row, "[Time] %-14s %5s %11.3f\n", "total", "", total * 1000);
+        out << row;
+    }
+};
+
+struct PassContext {
+    IRModule& module;
+    AnalysisCache& analyses;
+    InlineStats inlining;
+    ScalarStats scalar;
+    EscapeStats escapes;
+    int tailCalls = 0;
+};
+
+// A transform reports whether it changed the IR; module passes get a null function.
+struct PassInfo {
+    const char* name;
+    const char* summary;
+    bool perFunction;
+    bool (*run)(PassContext& ctx, IRFunction* fn);
+};
+
+static const PassInfo passRegistry[] = {
+    { "inline", "inline small routines at their call sites", false, [](PassContext& c, IRFunction*) {
+        int before = c.inlining.inlined;
+        Inliner(c.module, c.inlining, c.analyses).Run();
+        return c.inlining.inlined != before;
+    } },
+    { "webs", "split reused variables into independent live ranges", true, [](PassContext& c, IRFunction* fn) {
+        int before = c.scalar.webs;
+        ScalarOptimizer(*fn, c.scalar).splitWebs();
+        return c.scalar.webs != before;
+    } },
+    { "gvn", "value numbering with constant and copy propagation", true, [](PassContext& c, IRFunction* fn) {
+        ScalarStats before = c.scalar;
+        ScalarOptimizer(*fn, c.scalar).numberValues(c.analyses.dominators(*fn));
+        return c.scalar.propagated != before.propagated || c.scalar.folded != before.folded ||
+               c.scalar.reused != before.reused;
+    } },
+    { "dce", "remove pure instructions whose results are unused", true, [](PassContext& c, IRFunction* fn) {
+        int before = c.scalar.removed;
+        ScalarOptimizer(*fn, c.scalar).removeDeadCode();
+        return c.scalar.removed != before;
+    } },
+    { "licm", "hoist loop-invariant arithmetic into preheaders", true, [](PassContext& c, IRFunction* fn) {
+        int before = c.scalar.hoisted;
+        ScalarOptimizer(*fn, c.scalar).hoistInvariants();
+        return c.scalar.hoisted != before;
+    } },
+    { "escape", "stack or arena storage for buffers that stay local", true, [](PassContext& c, IRFunction* fn) {
+        int before = c.escapes.stack + c.escapes.arena;
+        EscapeAnalysis(*fn, c.module, c.escapes).Run(c.analyses.loops(*fn));
+        return c.escapes.stack + c.escapes.arena != before;
+    } },
+    { "tailcalls", "turn calls in tail position into jumps", true, [](PassContext& c, IRFunction* fn) {
+        int converted = markTailCalls(*fn);
+        c.tailCalls += converted;
+        return converted > 0;
+    } },
+};
+
+static const PassInfo* findPass(const std::string& name) {
+    for (const PassInfo& pass : passRegistry) if (name == pass.name) return &pass;
+    return nullptr;
+}
+
+// IR pipelines per -O level; code-generation switches are set alongside in applyOptLevel.
+// Every level keeps tailcalls: chained `call next; Return;` code relies on it for stack depth.
+static std::vector<std::string> pipelineFor(int level) {
+    switch (level) {
+    case 0: return { "tailcalls" };
+    case 1: return { "webs", "gvn", "dce", "tailcalls" };
+    case 3: return { "inline", "webs", "gvn", "dce", "licm", "escape", "gvn", "dce", "tailcalls" };
+    default: return { "inline", "webs", "gvn", "dce", "licm", "escape", "tailcalls" };
+    }
+}
+
+static void applyOptLevel(CompileOptions& options, int level) {
+    options.optLevel = level;
+    options.passes = pipelineFor(level);
+    options.spillEverything = level == 0;
+    options.peephole = level >= 1;
+    options.treeSelection = level >= 1;
+    options.strengthReduce = level >= 1;
+    options.autoUnroll = level >= 2;
+    options.vectorize = level >= 2;
+    options.schedule = level >= 2;
+    options.unrollBudget = level >= 3 ? 320 : 160;
+}
+
+static bool runsPass(const CompileOptions& options, const char* name) {
+    return std::find(options.passes.begin(), options.passes.end(), name) != options.passes.end();
+}
+
+static long irSize(const IRModule& module) {
+    long n = 0;
+    for (const IRFunction& f : module.functions) n += static_cast<long>(f.code.size());
+    return n;
+}
+
+static void runPipeline(const std::vector<std::string>& passes, PassContext& ctx, PassTimings& timings) {
+    for (const std::string& name : passes) {
+        const PassInfo* pass = findPass(name);
+        PassTimings::Entry& entry = timings.measure(name, [&] {
+            if (!pass->perFunction) {
+                if (pass->run(ctx, nullptr)) ctx.analyses.invalidateAll();
+                return;
+            }
+            for (IRFunction& f : ctx.module.functions)
+                if (pass->run(ctx, &f)) ctx.analyses.invalidate(f);
+        });
+        entry.irAfter = irSize(ctx.module);
+    }
+}
+
+// -----------------------------
+// x86-64 MACHINE MODEL
+// -----------------------------
+
+enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15, NoReg = -1 };
+
+static const char* regName64[16] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+static const char* regName32[16] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+static const char* regName8[16] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+};
+
+static inline uint32_t regBit(int r) { return 1u << r; }
+
+// SysV AMD64: RSP/RBP hold the frame, RAX and R11 are reserved as lowering scratch,
+// everything else is handed to the allocator.
+static const int allocationOrder[] = { RCX, RDX, RSI, RDI, R8, R9, R10, RBX, R12, R13, R14, R15 };
+static const uint32_t callerSaved = regBit(RAX) | regBit(RCX) | regBit(RDX) | regBit(RSI) | regBit(RDI) |
+                                    regBit(R8) | regBit(R9) | regBit(R10) | regBit(R11);
+static const uint32_t calleeSaved = regBit(RBX) | regBit(R12) | regBit(R13) | regBit(R14) | regBit(R15);
+static const uint32_t allocatable = (callerSaved | calleeSaved) & ~(regBit(RAX) | regBit(R11));
+static const int argRegs[6] = { RDI, RSI, RDX, RCX, R8, R9 };
+
+struct MOperand {
+    enum Kind { None, Reg, Imm, Mem, Label, Vec } kind = None;
+    int reg = NoReg;      // Reg: register number; Mem: base register (NoReg = rip-relative symbol); Vec: xmm/ymm/zmm number
+    int index = NoReg;    // Mem: index register
+    int scale = 8;        // Mem: index multiplier (1, 2, 4 or 8)
+    int64_t imm = 0;      // Imm: value; Mem: displacement
+    int size = 64;        // register width for Reg and Vec operands
+    std::string sym;      // Label name or rip-relative symbol
+
+    static MOperand R(int r, int size = 64) { MOperand o; o.kind = Reg; o.reg = r; o.size = size; return o; }
+    static MOperand I(int64_t v) { MOperand o; o.kind = Imm; o.imm = v; return o; }
+    static MOperand M(int base, int64_t disp) { MOperand o; o.kind = Mem; o.reg = base; o.imm = disp; return o; }
+    static MOperand Rip(const std::string& s) { MOperand o; o.kind = Mem; o.sym = s; return o; }
+    static MOperand L(const std::string& s) { MOperand o; o.kind = Label; o.sym = s; return o; }
+    static MOperand V(int n, int size = 256) { MOperand o; o.kind = Vec; o.reg = n; o.size = size; return o; }
+
+    bool isReg(int r) const { return kind == Reg && reg == r; }
+    bool uses(int r) const { return (kind == Reg || kind == Mem) && (reg == r || (kind == Mem && index == r)); }
+    bool operator==(const MOperand& o) const {
+        return kind == o.kind && reg == o.reg && index == o.index && scale == o.scale && imm == o.imm && size == o.size &&
+               sym == o.sym;
+    }
+    bool operator!=(const MOperand& o) const { return !(*this == o); }
+};
+
+struct MInst {
+    std::string op;                 // lower-case mnemonic; "label" and "raw" are pseudo-ops
+    std::vector<MOperand> ops;
+    std::string text;               // raw NASM for "raw"
+    int line = 0;                   // NODE source line, 0 when none (for -g)
+};
+
+static void printOperand(EmitBuffer& out, const MOperand& o, bool sized) {
+    switch (o.kind) {
+    case MOperand::Reg: out << (o.size == 8 ? regName8[o.reg] : o.size == 32 ? regName32[o.reg] : regName64[o.reg]); break;
+    case MOperand::Imm: out << o.imm; break;
+    case MOperand::Label: out << o.sym; break;
+    case MOperand::Vec: out << (o.size == 128 ? "xmm" : o.size == 256 ? "ymm" : "zmm") << o.reg; break;
+    case MOperand::Mem:
+        out << (sized ? "qword [" : "[");
+        if (o.reg == NoReg) {
+            out << "rel " << o.sym;
+            if (o.imm) out << '+' << o.imm;
+        } else {
+            out << regName64[o.reg];
+            if (o.index != NoReg) out << '+' << regName64[o.index] << '*' << o.scale;
+            if (o.imm > 0) out << '+';
+            if (o.imm) out << o.imm;
+        }
+        out << ']';
+        break;
+    default: break;
+    }
+}
+
+static void printInst(EmitBuffer& out, const MInst& in) {
+    if (in.op == "label") { out << in.ops[0].sym << ":\n"; return; }
+    if (in.op == "raw") {
+        for (size_t start = 0; start < in.text.size();) {
+            size_t end = std::min(in.text.find('\n', start), in.text.size());
+            out << "    ";
+            out.append(in.text.data() + start, end - start);
+            out << '\n';
+            start = end + 1;
+        }
+        return;
+    }
+    // Vector forms take their memory width from the register operand.
+    bool sized = in.op != "lea";
+    for (const MOperand& o : in.ops) if (o.kind == MOperand::Vec) sized = false;
+    out << "    " << in.op;
+    for (size_t i = 0; i < in.ops.size(); ++i) {
+        out << (i ? ", " : " ");
+        printOperand(out, in.ops[i], sized);
+    }
+    out << '\n';
+}
+
+static bool touchesMemory(const MInst& in) {
+    if (in.op == "push" || in.op == "pop" || in.op == "call" || in.op == "ret") return true;
+    for (const MOperand& o : in.ops) if (o.kind == MOperand::Mem && in.op != "lea") return true;
+    return false;
+}
+
+// -----------------------------
+// INSTRUCTION SELECTION (tree patterns over the IR)
+// -----------------------------
+
+// How a matched rule is lowered; Default leaves the root to the per-instruction lowering.
+enum class SelectEmit { Default, Lea, OpMem, LoadMem, MemOperand, StoreOffset, ReadModifyWrite, Test, TestAnd, CmpMem, MemCmp };
+
+// A rule covers the IR tree `pattern` with the nonterminal `result` ("reg": value in a location,
+// "mem": memory operand, "stmt": no value) at `cost`, in half-instructions: 2 per instruction,
+// one less for a shorter encoding. Patterns nest IR operators over leaves tagged with a role
+// letter: `reg` (any value, computed by its own rule), `mem` (a load folded as a memory operand),
+// `imm` (32-bit immediate), `zero`, `shift` (1-3) and `scale` (2, 4 or 8). A pattern that is
+// just `mem` is the chain rule loading a memory operand into a register.
+struct SelectionRule {
+    const char* name;
+    const char* result;
+    const char* pattern;
+    int cost;
+    SelectEmit emit;
+};
+
+static constexpr SelectionRule selectionRules[] = {
+    { "add", "reg", "Add(reg:a,reg:b)", 2, SelectEmit::Default },
+    { "sub", "reg", "Sub(reg:a,reg:b)", 2, SelectEmit::Default },
+    { "mul", "reg", "Mul(reg:a,reg:b)", 2, SelectEmit::Default },
+    { "and", "reg", "And(reg:a,reg:b)", 2, SelectEmit::Default },
+    { "or", "reg", "Or(reg:a,reg:b)", 2, SelectEmit::Default },
+    { "xor", "reg", "Xor(reg:a,reg:b)", 2, SelectEmit::Default },
+    { "shl", "reg", "Shl(reg:a,reg:b)", 2, SelectEmit::Default },
+    { "load", "reg", "Load(reg:p,reg:i)", 2, SelectEmit::Default },
+    { "store", "stmt", "Store(reg:p,reg:i,reg:v)", 2, SelectEmit::Default },
+    { "branch", "stmt", "Branch(reg:a,reg:b)", 4, SelectEmit::Default },
+    { "setcc", "reg", "SetCC(reg:a,reg:b)", 8, SelectEmit::Default },
+
+    { "lea-shift", "reg", "Add(reg:a,Shl(reg:x,shift:s))", 2, SelectEmit::Lea },
+    { "lea-shift", "reg", "Add(Shl(reg:x,shift:s),reg:a)", 2, SelectEmit::Lea },
+    { "lea-scale", "reg", "Add(reg:a,Mul(reg:x,scale:k))", 2, SelectEmit::Lea },
+    { "lea-scale", "reg", "Add(Mul(reg:x,scale:k),reg:a)", 2, SelectEmit::Lea },
+    { "lea-disp", "reg", "Add(Add(reg:a,reg:x),imm:d)", 2, SelectEmit::Lea },
+
+    { "element", "mem", "Load(reg:p,reg:i)", 0, SelectEmit::MemOperand },
+    { "element-offset", "mem", "Load(reg:p,Add(reg:i,imm:o))", 0, SelectEmit::MemOperand },
+    { "element-offset", "mem", "Load(reg:p,Sub(reg:i,imm:n))", 0, SelectEmit::MemOperand },
+    { "load-offset", "reg", "mem:m", 2, SelectEmit::LoadMem },
+    { "store-offset", "stmt", "Store(reg:p,Add(reg:i,imm:o),reg:v)", 2, SelectEmit::StoreOffset },
+    { "store-offset", "stmt", "Store(reg:p,Sub(reg:i,imm:n),reg:v)", 2, SelectEmit::StoreOffset },
+
+    { "add-mem", "reg", "Add(reg:a,mem:m)", 2, SelectEmit::OpMem },
+    { "add-mem", "reg", "Add(mem:m,reg:a)", 2, SelectEmit::OpMem },
+    { "sub-mem", "reg", "Sub(reg:a,mem:m)", 2, SelectEmit::OpMem },
+    { "mul-mem", "reg", "Mul(reg:a,mem:m)", 2, SelectEmit::OpMem },
+    { "mul-mem", "reg", "Mul(mem:m,reg:a)", 2, SelectEmit::OpMem },
+    { "and-mem", "reg", "And(reg:a,mem:m)", 2, SelectEmit::OpMem },
+    { "and-mem", "reg", "And(mem:m,reg:a)", 2, SelectEmit::OpMem },
+    { "or-mem", "reg", "Or(reg:a,mem:m)", 2, SelectEmit::OpMem },
+    { "or-mem", "reg", "Or(mem:m,reg:a)", 2, SelectEmit::OpMem },
+    { "xor-mem", "reg", "Xor(reg:a,mem:m)", 2, SelectEmit::OpMem },
+    { "xor-mem", "reg", "Xor(mem:m,reg:a)", 2, SelectEmit::OpMem },
+
+    { "add-to-mem", "stmt", "Store(reg:p,reg:i,Add(mem:m,reg:v))", 2, SelectEmit::ReadModifyWrite },
+    { "add-to-mem", "stmt", "Store(reg:p,reg:i,Add(reg:v,mem:m))", 2, SelectEmit::ReadModifyWrite },
+    { "sub-from-mem", "stmt", "Store(reg:p,reg:i,Sub(mem:m,reg:v))", 2, SelectEmit::ReadModifyWrite },
+    { "and-to-mem", "stmt", "Store(reg:p,reg:i,And(mem:m,reg:v))", 2, SelectEmit::ReadModifyWrite },
+    { "and-to-mem", "stmt", "Store(reg:p,reg:i,And(reg:v,mem:m))", 2, SelectEmit::ReadModifyWrite },
+    { "or-to-mem", "stmt", "Store(reg:p,reg:i,Or(mem:m,reg:v))", 2, SelectEmit::ReadModifyWrite },
+    { "or-to-mem", "stmt", "Store(reg:p,reg:i,Or(reg:v,mem:m))", 2, SelectEmit::ReadModifyWrite },
+    { "xor-to-mem", "stmt", "Store(reg:p,reg:i,Xor(mem:m,reg:v))", 2, SelectEmit::ReadModifyWrite },
+    { "xor-to-mem", "stmt", "Store(reg:p,reg:i,Xor(reg:v,mem:m))", 2, SelectEmit::ReadModifyWrite },
+
+    { "test", "stmt", "Branch(reg:a,zero)", 3, SelectEmit::Test },
+    { "test-and", "stmt", "Branch(And(reg:a,reg:b),zero)", 3, SelectEmit::TestAnd },
+    { "cmp-mem", "stmt", "Branch(reg:a,mem:m)", 4, SelectEmit::CmpMem },
+    { "cmp-mem", "stmt", "Branch(mem:m,reg:b)", 4, SelectEmit::MemCmp },
+    { "test", "reg", "SetCC(reg:a,zero)", 7, SelectEmit::Test },
+    { "test-and", "reg", "SetCC(And(reg:a,reg:b),zero)", 7, SelectEmit::TestAnd },
+    { "cmp-mem", "reg", "SetCC(reg:a,mem:m)", 8, SelectEmit::CmpMem },
+    { "cmp-mem", "reg", "SetCC(mem:m,reg:b)", 8, SelectEmit::MemCmp },
+};
+
+// Pattern text with the role tags skipped: `Add(reg:a,reg:b)` and `Add(reg:x,reg:y)` are one tree.
+constexpr bool samePattern(const char* a, const char* b) {
+    for (;; ++a, ++b) {
+        if (*a == ':') a += 2;
+        if (*b == ':') b += 2;
+        if (*a != *b) return false;
+        if (!*a) return true;
+    }
+}
+
+constexpr bool wellFormedPattern(const char* p) {
+    int depth = 0;
+    for (; *p; ++p) {
+        if (*p == '(') ++depth;
+        else if (*p == ')' && --depth < 0) return false;
+        else if (*p == ':' && !(p[1] >= 'a' && p[1] <= 'z')) return false;
+    }
+    return depth == 0;
+}
+
+template <size_t N>
+constexpr bool distinctPatterns(const SelectionRule (&rules)[N]) {
+    for (size_t i = 0; i < N; ++i)
+        for (size_t j = 0; j < i; ++j)
+            if (sameText(rules[i].result, rules[j].result) && samePattern(rules[i].pattern, rules[j].pattern))
+                return false;
+    return true;
+}
+
+template <size_t N>
+constexpr bool wellFormedPatterns(const SelectionRule (&rules)[N]) {
+    for (size_t i = 0; i < N; ++i) if (!wellFormedPattern(rules[i].pattern)) return false;
+    return true;
+}
+
+static_assert(distinctPatterns(selectionRules), "selectionRules: two rules cover the same tree with the same result");
+static_assert(wellFormedPatterns(selectionRules), "selectionRules: unbalanced parentheses or bad role tag");
+
+static const size_t selectionRuleCount = sizeof(selectionRules) / sizeof(selectionRules[0]);
+
+struct PatternNode {
+    std::string op;                 // IR operator name, or a leaf kind
+    char role = 0;
+    std::vector<PatternNode> kids;
+};
+
+static PatternNode parsePattern(const char*& p) {
+    PatternNode n;
+    while (isalpha(static_cast<unsigned char>(*p))) n.op += *p++;
+    if (*p == ':') { n.role = p[1]; p += 2; }
+    if (*p == '(') {
+        do { ++p; n.kids.push_back(parsePattern(p)); } while (*p == ',');
+        ++p;
+    }
+    return n;
+}
+
+static const std::vector<PatternNode>& patternTrees() {
+    static const std::vector<PatternNode> trees = [] {
+        std::vector<PatternNode> t;
+        for (const SelectionRule& rule : selectionRules) {
+            const char* p = rule.pattern;
+            t.push_back(parsePattern(p));
+        }
+        return t;
+    }();
+    return trees;
+}
+
+static bool irOpNamed(const std::string& name, IROp& op) {
+    static const std::pair<const char*, IROp> names[] = {
+        { "Add", IROp::Add }, { "Sub", IROp::Sub }, { "Mul", IROp::Mul }, { "And", IROp::And },
+        { "Or", IROp::Or }, { "Xor", IROp::Xor }, { "Shl", IROp::Shl }, { "Load", IROp::Load },
+        { "Store", IROp::Store }, { "Branch", IROp::Branch }, { "SetCC", IROp::SetCC },
+    };
+    for (const auto& n : names) if (name == n.first) { op = n.second; return true; }
+    return false;
+}
+
+// One matched rule: the values bound to its leaves and the instructions it absorbs.
+struct Cover {
+    static constexpr const char* roles = "abdikmnopsvx";
+    int rule = -1;
+    int cost = INT_MAX / 2;
+    IRValue leaf[12];
+    int mem = -1;                   // load supplying the `mem` leaf's memory operand
+    std::vector<int> folded;
+
+    IRValue& at(char role) { return leaf[std::strchr(roles, role) - roles]; }
+    const IRValue& at(char role) const { return leaf[std::strchr(roles, role) - roles]; }
+};
+
+struct Selection {
+    std::vector<Cover> covers;      // rule for each emitted instruction (rule -1: lowered one by one)
+    std::vector<Cover> memCovers;   // memory operand of each load, for the rules that fold it
+    std::vector<int> foldedInto;    // instruction that absorbed this one, -1 when emitted itself
+    std::vector<char> virtualTemp;  // results of absorbed instructions: never given a location
+    std::vector<int> hits = std::vector<int>(selectionRuleCount, 0);
+};
+
+static bool sameValue(const IRValue& a, const IRValue& b) {
+    return a.kind == b.kind && (a.kind != IRValue::Temp || a.temp == b.temp) && (a.kind != IRValue::Imm || a.imm == b.imm);
+}
+
+// Bottom-up labelling then top-down reduction (BURS) over expression trees. A tree edge is a temp
+// with one definition and one use in the same block, close enough that stretching the operands'
+// live ranges to the use stays cheap; all other values are leaves. Each instruction is labelled
+// with its cheapest cover per nonterminal, counting the covers of the subtrees left in registers,
+// and each root then takes its cheapest cover and absorbs the instructions the cover folds.
+class InstructionSelector {
+    const IRFunction& fn;
+    Selection& sel;
+    std::vector<int> defAt, useAt, blockOf;
+    static constexpr int maxDistance = 24;
+
+public:
+    InstructionSelector(const IRFunction& f, Selection& s) : fn(f), sel(s) {}
+
+    void Run() {
+        size_t n = fn.code.size(), temps = fn.tempNames.size();
+        sel.covers.assign(n, Cover());
+        sel.memCovers.assign(n, Cover());
+        sel.foldedInto.assign(n, -1);
+        sel.virtualTemp.assign(temps, 0);
+        defAt.assign(temps, -1);
+        useAt.assign(temps, -1);
+        blockOf.assign(n, 0);
+        std::vector<BasicBlock> blocks = buildBlocks(fn);
+        for (size_t b = 0; b < blocks.size(); ++b)
+            for (int i = blocks[b].first; i <= blocks[b].last; ++i) blockOf[i] = static_cast<int>(b);
+        std::vector<int> uses;
+        for (size_t i = 0; i < n; ++i) {
+            const IRInst& in = fn.code[i];
+            irUses(in, uses);
+            for (int t : uses) useAt[t] = useAt[t] == -1 ? static_cast<int>(i) : -2;
+            if (in.dst >= 0) defAt[in.dst] = defAt[in.dst] == -1 ? static_cast<int>(i) : -2;
+        }
+        for (size_t i = 0; i < n; ++i) label(static_cast<int>(i));
+        for (size_t i = n; i-- > 0;) {
+            const Cover& c = sel.covers[i];
+            if (sel.foldedInto[i] >= 0 || c.rule < 0) continue;
+            for (int f : c.folded) {
+                sel.foldedInto[f] = static_cast<int>(i);
+                sel.virtualTemp[fn.code[f].dst] = 1;
+            }
+            if (selectionRules[c.rule].emit != SelectEmit::Default) sel.hits[c.rule]++;
+        }
+    }
+
+private:
+    // The instruction defining `v` when it can be folded into its only use.
+    int candidate(const IRValue& v) const {
+        if (!v.isTemp()) return -1;
+        int d = defAt[v.temp], u = useAt[v.temp];
+        if (d < 0 || u < 0 || d >= u || u - d > maxDistance || blockOf[d] != blockOf[u]) return -1;
+        switch (fn.code[d].op) {
+        case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::And: case IROp::Or: case IROp::Xor:
+        case IROp::Shl: case IROp::Load:
+            return d;
+        default:
+            return -1;
+        }
+    }
+
+    static bool writesMemory(IROp op) {
+        return op == IROp::Store || op == IROp::VStore || op == IROp::Call || op == IROp::TailCall ||
+               op == IROp::Input || op == IROp::Print || op == IROp::Raw;
+    }
+
+    // Whether instruction `f` computes the same value at `root`: no operand is redefined in
+    // between and, for a load, nothing in between writes memory.
+    bool stable(int f, int root) const {
+        std::vector<int> uses;
+        irUses(fn.code[f], uses);
+        bool load = fn.code[f].op == IROp::Load;
+        for (int k = f + 1; k < root; ++k) {
+            const IRInst& in = fn.code[k];
+            if (load && writesMemory(in.op)) return false;
+            if (in.dst >= 0 && std::find(uses.begin(), uses.end(), in.dst) != uses.end()) return false;
+        }
+        return true;
+    }
+
+    bool matchValue(const PatternNode& p, const IRValue& v, Cover& c) const {
+        if (p.kids.empty()) {
+            const std::string& kind = p.op;
+            if (kind == "reg") {
+                int d = candidate(v);
+                if (d >= 0) c.cost += sel.covers[d].cost;
+            } else if (kind == "mem") {
+                int d = candidate(v);
+                if (d < 0 || fn.code[d].op != IROp::Load || sel.memCovers[d].rule < 0) return false;
+                const Cover& m = sel.memCovers[d];
+                c.mem = d;
+                c.folded.push_back(d);
+                c.folded.insert(c.folded.end(), m.folded.begin(), m.folded.end());
+                c.cost += m.cost;
+            } else {
+                if (!v.isImm() || v.imm < INT32_MIN || v.imm > INT32_MAX) return false;
+                if (kind == "zero" && v.imm != 0) return false;
+                if (kind == "shift" && (v.imm < 1 || v.imm > 3)) return false;
+                if (kind == "scale" && v.imm != 2 && v.imm != 4 && v.imm != 8) return false;
+            }
+            if (p.role) c.at(p.role) = v;
+            return true;
+        }
+        int d = candidate(v);
+        IROp op;
+        if (d < 0 || !irOpNamed(p.op, op) || fn.code[d].op != op) return false;
+        c.folded.push_back(d);
+        return matchOperands(p, fn.code[d], c);
+    }
+
+    bool matchOperands(const PatternNode& p, const IRInst& in, Cover& c) const {
+        IRValue operands[3] = { in.a, in.b, in.args.empty() ? IRValue() : in.args[0] };
+        size_t count = in.op == IROp::Store ? 3 : 2;
+        if (p.kids.size() != count) return false;
+        for (size_t k = 0; k < count; ++k)
+            if (!matchValue(p.kids[k], operands[k], c)) return false;
+        return true;
+    }
+
+    bool admissible(const SelectionRule& rule, const Cover& c, int root) const {
+        for (int f : c.folded) if (!stable(f, root)) return false;
+        if (rule.emit == SelectEmit::MemOperand || rule.emit == SelectEmit::StoreOffset) {
+            int64_t offset = c.at('o').isImm() ? c.at('o').imm : c.at('n').isImm() ? -c.at('n').imm : 0;
+            if (offset * 8 < INT32_MIN || offset * 8 > INT32_MAX) return false;
+        }
+        if (rule.emit == SelectEmit::ReadModifyWrite) {
+            // The folded load must read the very element the store writes.
+            const Cover& m = sel.memCovers[c.mem];
+            if (!sameValue(m.at('p'), c.at('p')) || !sameValue(m.at('i'), c.at('i')) || m.at('o').kind != IRValue::None ||
+                m.at('n').kind != IRValue::None)
+                return false;
+        }
+        return true;
+    }
+
+    void label(int i) {
+        const IRInst& in = fn.code[i];
+        const std::vector<PatternNode>& trees = patternTrees();
+        IROp op;
+        for (size_t r = 0; r < selectionRuleCount; ++r) {
+            const SelectionRule& rule = selectionRules[r];
+            const PatternNode& tree = trees[r];
+            if (!irOpNamed(tree.op, op) || op != in.op) continue;
+            Cover c;
+            c.rule = static_cast<int>(r);
+            c.cost = rule.cost;
+            if (!matchOperands(tree, in, c) || !admissible(rule, c, i)) continue;
+            Cover& best = sameText(rule.result, "mem") ? sel.memCovers[i] : sel.covers[i];
+            if (c.cost < best.cost) best = std::move(c);
+        }
+        // Chain rules: a memory operand loaded into a register.
+        if (in.op != IROp::Load || sel.memCovers[i].rule < 0) return;
+        for (size_t r = 0; r < selectionRuleCount; ++r) {
+            if (trees[r].op != "mem" || !trees[r].kids.empty()) continue;
+            int cost = selectionRules[r].cost + sel.memCovers[i].cost;
+            if (cost >= sel.covers[i].cost) continue;
+            Cover c;
+            c.rule = static_cast<int>(r);
+            c.cost = cost;
+            c.mem = i;
+            c.folded = sel.memCovers[i].folded;
+            sel.covers[i] = std::move(c);
+        }
+    }
+};
+
+// -----------------------------
+// LIVENESS + LINEAR-SCAN REGISTER ALLOCATION
+// -----------------------------
+
+struct LiveInterval {
+    int temp;
+    int start, end;
+    uint32_t forbidden = 0;   // registers clobbered while this value is live
+};
+
+struct Allocation {
+    std::vector<int> reg;        // physical register per temp, NoReg when spilled
+    std::vector<int> slot;       // frame slot per spilled temp, -1 otherwise
+    std::vector<int> savedRegs;  // callee-saved registers the function must preserve
+    int spillSlots = 0;
+    int bufferWords = 0;
+    int intervals = 0;
+
+    // [rbp-8*(k+1)]: callee-saved save area first, then spill slots, then 16-byte aligned
+    // stack buffers at the bottom of the frame.
+    int64_t slotOffset(int s) const { return -8 * (static_cast<int64_t>(savedRegs.size()) + s + 1); }
+    int64_t frameBytes() const {
+        return (8 * (static_cast<int64_t>(savedRegs.size()) + spillSlots + bufferWords) + 15) & ~int64_t(15);
+    }
+    int64_t bufferOffset(int64_t word) const { return -frameBytes() + 8 * word; }
+};
+
+static void computeLiveness(const IRFunction& fn, std::vector<BasicBlock>& blocks) {
+    size_t temps = fn.tempNames.size();
+    std::vector<std::vector<char>> use(blocks.size(), std::vector<char>(temps, 0));
+    std::vector<std::vector<char>> def(blocks.size(), std::vector<char>(temps, 0));
+    std::vector<int> uses;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        for (int i = blocks[b].first; i <= blocks[b].last; ++i) {
+            irUses(fn.code[i], uses);
+            for (int t : uses) if (!def[b][t]) use[b][t] = 1;
+            if (fn.code[i].dst >= 0) def[b][fn.code[i].dst] = 1;
+        }
+        blocks[b].liveIn.assign(temps, 0);
+        blocks[b].liveOut.assign(temps, 0);
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;) {
+            BasicBlock& bb = blocks[b];
+            for (int s : bb.succ)
+                for (size_t t = 0; t < temps; ++t)
+                    if (blocks[s].liveIn[t] && !bb.liveOut[t]) { bb.liveOut[t] = 1; changed = true; }
+            for (size_t t = 0; t < temps; ++t) {
+                char in = use[b][t] || (bb.liveOut[t] && !def[b][t]);
+                if (in && !bb.liveIn[t]) { bb.liveIn[t] = 1; changed = true; }
+            }
+        }
+    }
+}
+
+// Registers an instruction destroys for values that stay live across it (`across`),
+// and for operands it reads after clobbering them (`reads`).
+static void clobbers(const IRInst& in, uint32_t& across, uint32_t& reads) {
+    across = reads = 0;
+    switch (in.op) {
+    case IROp::Div: case IROp::Mod:
+        across = reads = regBit(RAX) | regBit(RDX);
+        break;
+    case IROp::Shl: case IROp::Shr:
+        if (in.b.isTemp()) across = reads = regBit(RCX);
+        break;
+    case IROp::Call: case IROp::TailCall: case IROp::Print: case IROp::Input:
+        across = callerSaved;
+        break;
+    case IROp::Raw:
+        across = allocatable;
+        break;
+    default:
+        break;
+    }
+}
+
+class LinearScanAllocator {
+    const IRFunction& fn;
+    bool spillEverything;
+    const Selection* selection;
+
+public:
+    LinearScanAllocator(const IRFunction& f, bool spillAll, const Selection* sel = nullptr)
+        : fn(f), spillEverything(spillAll), selection(sel) {}
+
+    Allocation Run() {
+        Allocation alloc;
+        size_t temps = fn.tempNames.size();
+        alloc.bufferWords = fn.bufferWords;
+        alloc.reg.assign(temps, NoReg);
+        alloc.slot.assign(temps, -1);
+
+        std::vector<LiveInterval> intervals = buildIntervals();
+        alloc.intervals = static_cast<int>(intervals.size());
+        std::sort(intervals.begin(), intervals.end(),
+                  [](const LiveInterval& a, const LiveInterval& b) { return a.start < b.start || (a.start == b.start && a.temp < b.temp); });
+
+        std::vector<LiveInterval*> active;   // sorted by increasing end
+        uint32_t used = 0;
+        for (LiveInterval& cur : intervals) {
+            if (spillEverything) { spill(alloc, cur.temp); continue; }
+
+            for (size_t i = 0; i < active.size();) {
+                if (active[i]->end <= cur.start) {
+                    used &= ~regBit(alloc.reg[active[i]->temp]);
+                    active.erase(active.begin() + i);
+                } else {
+                    ++i;
+                }
+            }
+
+            int chosen = NoReg;
+            for (int r : allocationOrder) {
+                if (!(used & regBit(r)) && !(cur.forbidden & regBit(r))) { chosen = r; break; }
+            }
+            if (chosen == NoReg) {
+                // Steal from the active interval that ends furthest away, if it outlives us.
+                LiveInterval* victim = nullptr;
+                for (auto it = active.rbegin(); it != active.rend(); ++it) {
+                    if (!(cur.forbidden & regBit(alloc.reg[(*it)->temp]))) { victim = *it; break; }
+                }
+                if (victim && victim->end > cur.end) {
+                    chosen = alloc.reg[victim->temp];
+                    alloc.reg[victim->temp] = NoReg;
+                    spill(alloc, victim->temp);
+                    active.erase(std::find(active.begin(), active.end(), victim));
+                } else {
+                    spill(alloc, cur.temp);
+                    continue;
+                }
+            }
+            alloc.reg[cur.temp] = chosen;
+            used |= regBit(chosen);
+            if ((calleeSaved & regBit(chosen)) &&
+                std::find(alloc.savedRegs.begin(), alloc.savedRegs.end(), chosen) == alloc.savedRegs.end())
+                alloc.savedRegs.push_back(chosen);
+            active.insert(std::upper_bound(active.begin(), active.end(), &cur,
+                                           [](const LiveInterval* a, const LiveInterval* b) { return a->end < b->end; }),
+                          &cur);
+        }
+        return alloc;
+    }
+
+private:
+    static void spill(Allocation& alloc, int temp) {
+        alloc.slot[temp] = alloc.spillSlots++;
+    }
+
+    std::vector<LiveInterval> buildIntervals() {
+        size_t temps = fn.tempNames.size();
+        std::vector<BasicBlock> blocks = buildBlocks(fn);
+        computeLiveness(fn, blocks);
+
+        std::vector<int> lo(temps, INT32_MAX), hi(temps, -1);
+        auto touch = [&](int t, int pos) { lo[t] = std::min(lo[t], pos); hi[t] = std::max(hi[t], pos); };
+        std::vector<int> uses;
+        for (const BasicBlock& bb : blocks) {
+            for (size_t t = 0; t < temps; ++t) {
+                if (bb.liveIn[t]) touch(static_cast<int>(t), bb.first);
+                if (bb.liveOut[t]) touch(static_cast<int>(t), bb.last);
+            }
+            for (int i = bb.first; i <= bb.last; ++i) {
+                irUses(fn.code[i], uses);
+                // An absorbed instruction reads its operands where the instruction absorbing it runs.
+                int at = selection && selection->foldedInto[i] >= 0 ? selection->foldedInto[i] : i;
+                for (int t : uses) if (!selection || !selection->virtualTemp[t]) touch(t, at);
+                int d = fn.code[i].dst;
+                if (d >= 0 && (!selection || !selection->virtualTemp[d])) touch(d, i);
+            }
+        }
+
+        // Arguments arrive together, so every parameter is live from entry until the last one is taken.
+        int lastParam = -1;
+        for (size_t i = 0; i < fn.code.size() && fn.code[i].op == IROp::Param; ++i) lastParam = static_cast<int>(i);
+        for (int i = 0; i <= lastParam; ++i) {
+            touch(fn.code[i].dst, 0);
+            touch(fn.code[i].dst, lastParam);
+        }
+
+        std::vector<int> clobberPos;
+        std::vector<uint32_t> clobberAcross, clobberReads;
+        for (size_t i = 0; i < fn.code.size(); ++i) {
+            uint32_t across, reads;
+            clobbers(fn.code[i], across, reads);
+            if (across | reads) {
+                clobberPos.push_back(static_cast<int>(i));
+                clobberAcross.push_back(across);
+                clobberReads.push_back(reads);
+            }
+        }
+
+        std::vector<LiveInterval> intervals;
+        for (size_t t = 0; t < temps; ++t) {
+            if (hi[t] < 0) continue;
+            LiveInterval li{ static_cast<int>(t), lo[t], hi[t], 0 };
+            auto it = std::upper_bound(clobberPos.begin(), clobberPos.end(), li.start);
+            for (; it != clobberPos.end() && *it <= li.end; ++it) {
+                size_t k = it - clobberPos.begin();
+                li.forbidden |= (*it < li.end) ? clobberAcross[k] : clobberReads[k];
+            }
+            intervals.push_back(li);
+        }
+        return intervals;
+    }
+};
+
+// -----------------------------
+// LOWERING (IR + allocation -> x86-64)
+// -----------------------------
+
+class FunctionLowering {
+    const IRFunction& fn;
+    const Allocation& alloc;
+    std::vector<MInst>& out;
+    bool strengthReduce;
+    const Selection* selection;
+    int line = 0;                   // NODE line of the IR being lowered
+
+public:
+    FunctionLowering(const IRFunction& f, const Allocation& a, std::vector<MInst>& o, bool reduce = true,
+                     const Selection* sel = nullptr)
+        : fn(f), alloc(a), out(o), strengthReduce(reduce), selection(sel) {}
+
+    void Run() {
+        for (const IRInst& in : fn.code) if (in.line) { line = in.line; break; }
+        label(fn.symbol);
+        emit("push", { MOperand::R(RBP) });
+        emit("mov", { MOperand::R(RBP), MOperand::R(RSP) });
+        int64_t frame = alloc.frameBytes();
+        if (frame) emit("sub", { MOperand::R(RSP), MOperand::I(frame) });
+        for (size_t i = 0; i < alloc.savedRegs.size(); ++i)
+            emit("mov", { MOperand::M(RBP, -8 * static_cast<int64_t>(i + 1)), MOperand::R(alloc.savedRegs[i]) });
+
+        for (size_t i = 0; i < fn.code.size(); ++i) {
+            if (fn.code[i].op == IROp::Param) {
+                size_t j = i;
+                while (j < fn.code.size() && fn.code[j].op == IROp::Param) ++j;
+                lowerParams(i, j);
+                i = j - 1;
+                continue;
+            }
+            if (selection && selection->foldedInto[i] >= 0) continue;
+            if (fn.code[i].line) line = fn.code[i].line;
+            if (selection && selection->covers[i].rule >= 0 &&
+                selectionRules[selection->covers[i].rule].emit != SelectEmit::Default) {
+                lowerCover(fn.code[i], selection->covers[i]);
+                continue;
+            }
+            lower(fn.code[i]);
+        }
+    }
+
+private:
+    void emit(const std::string& op, std::vector<MOperand> ops = {}) {
+        out.push_back(MInst{ op, std::move(ops), "", line });
+    }
+    void label(const std::string& name) { emit("label", { MOperand::L(name) }); }
+
+    MOperand loc(int temp) const {
+        if (alloc.reg[temp] != NoReg) return MOperand::R(alloc.reg[temp]);
+        if (alloc.slot[temp] >= 0) return MOperand::M(RBP, alloc.slotOffset(alloc.slot[temp]));
+        return MOperand::R(RAX);   // dead value
+    }
+    MOperand val(const IRValue& v) const {
+        return v.isTemp() ? loc(v.temp) : MOperand::I(v.imm);
+    }
+    static bool fitsImm32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+    // Operand usable as the source of an ALU op: wide immediates go through R11.
+    MOperand src(const IRValue& v) {
+        MOperand o = val(v);
+        if (o.kind == MOperand::Imm && !fitsImm32(o.imm)) {
+            emit("mov", { MOperand::R(R11), o });
+            return MOperand::R(R11);
+        }
+        return o;
+    }
+
+    void move(const MOperand& dst, const MOperand& s) {
+        if (dst == s) return;
+        if (dst.kind == MOperand::Mem && (s.kind == MOperand::Mem || (s.kind == MOperand::Imm && !fitsImm32(s.imm)))) {
+            emit("mov", { MOperand::R(RAX), s });
+            emit("mov", { dst, MOperand::R(RAX) });
+            return;
+        }
+        emit("mov", { dst, s });
+    }
+
+    void lowerParams(size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) emit("push", { MOperand::R(argRegs[fn.code[i].a.imm]) });
+        for (size_t i = to; i-- > from;) {
+            MOperand d = loc(fn.code[i].dst);
+            if (d.kind == MOperand::Reg && d.reg == RAX) emit("add", { MOperand::R(RSP), MOperand::I(8) });
+            else emit("pop", { d });
+        }
+    }
+
+    void binary(const IRInst& in, const std::string& op, bool commutative) {
+        MOperand d = loc(in.dst);
+        MOperand a = val(in.a);
+        MOperand b = val(in.b);
+        bool imul = op == "imul";
+        if (d.kind == MOperand::Reg && !(d == b && d != a && !commutative)) {
+            if (d == b && d != a) {
+                emit(op, { d, src(in.a) });
+                return;
+            }
+            move(d, a);
+            emit(op, { d, src(in.b) });
+            return;
+        }
+        if (d.kind == MOperand::Mem && d == a && !imul && b.kind != MOperand::Mem) {
+            emit(op, { d, src(in.b) });
+            return;
+        }
+        emit("mov", { MOperand::R(RAX), a });
+        emit(op, { MOperand::R(RAX), src(in.b) });
+        move(d, MOperand::R(RAX));
+    }
+
+    // -- Strength reduction for constant operands ----------------------------
+
+    static bool powerOfTwo(uint64_t v, int& k) {
+        if (v == 0 || (v & (v - 1))) return false;
+        k = __builtin_ctzll(v);
+        return true;
+    }
+
+    // x * c with c in {3, 5, 9} times a power of two becomes lea (+ shl); 2^k +/- 1 becomes shl and add/sub.
+    bool multiplyConst(const IRInst& in) {
+        IRValue x = in.a, c = in.b;
+        if (x.isImm()) std::swap(x, c);
+        if (!c.isImm() || x.isImm()) return false;
+        int64_t k = c.imm;
+        MOperand d = loc(in.dst);
+        MOperand r = d.kind == MOperand::Reg ? d : MOperand::R(RAX);
+        if (k == 0) {
+            move(d, MOperand::I(0));
+            return true;
+        }
+        if (k == INT64_MIN) return false;
+        bool negate = k < 0;
+        uint64_t m = static_cast<uint64_t>(negate ? -k : k);
+        int shift = 0;
+        while (!(m & 1)) { m >>= 1; ++shift; }
+        MOperand src = val(x);
+        auto finish = [&] {
+            if (shift) emit("shl", { r, MOperand::I(shift) });
+            if (negate) emit("neg", { r });
+            move(d, r);
+        };
+        if (m == 1) {
+            move(r, src);
+            finish();
+            return true;
+        }
+        if (m == 3 || m == 5 || m == 9) {
+            MOperand base = src;
+            if (base.kind != MOperand::Reg) {
+                move(r, src);
+                base = r;
+            }
+            MOperand addr = MOperand::M(base.reg, 0);
+            addr.index = base.reg;
+            addr.scale = static_cast<int>(m - 1);
+            emit("lea", { r, addr });
+            finish();
+            return true;
+        }
+        int high;
+        bool plus = powerOfTwo(m - 1, high), minus = !plus && powerOfTwo(m + 1, high);
+        if ((plus || minus) && !(src.kind == MOperand::Reg && src.reg == r.reg)) {
+            move(r, src);
+            emit("shl", { r, MOperand::I(high) });
+            emit(plus ? "add" : "sub", { r, src });
+            finish();
+            return true;
+        }
+        if (k < INT32_MIN || k > INT32_MAX) return false;
+        // Three-operand imul still beats a register-register multiply after a constant load.
+        emit("imul", { r, src, MOperand::I(k) });
+        move(d, r);
+        return true;
+    }
+
+    // Signed magic number for truncating division by d (|d| >= 2), after Granlund & Montgomery.
+    static void signedMagic(int64_t d, int64_t& magic, int& shift) {
+        const uint64_t two63 = 1ull << 63;
+        uint64_t ad = d < 0 ? 0 - static_cast<uint64_t>(d) : static_cast<uint64_t>(d);
+        uint64_t t = two63 + (static_cast<uint64_t>(d) >> 63);
+        uint64_t anc = t - 1 - t % ad;
+        int p = 63;
+        uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+        uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+        uint64_t delta;
+        do {
+            ++p;
+            q1 *= 2; r1 *= 2;
+            if (r1 >= anc) { ++q1; r1 -= anc; }
+            q2 *= 2; r2 *= 2;
+            if (r2 >= ad) { ++q2; r2 -= ad; }
+            delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+        magic = static_cast<int64_t>(q2 + 1);
+        if (d < 0) magic = -magic;
+        shift = p - 64;
+    }
+
+    // Division and modulo by a constant without idiv. Div/Mod already reserve RAX and RDX.
+    bool divideConst(const IRInst& in) {
+        if (!in.b.isImm() || in.a.isImm()) return false;
+        int64_t d = in.b.imm;
+        bool mod = in.op == IROp::Mod;
+        MOperand a = val(in.a);
+        if (d == 0 || d == INT64_MIN) return false;
+        if (d == 1 || d == -1) {
+            if (mod) {
+                move(loc(in.dst), MOperand::I(0));
+            } else {
+                emit("mov", { MOperand::R(RAX), a });
+                if (d == -1) emit("neg", { MOperand::R(RAX) });
+                move(loc(in.dst), MOperand::R(RAX));
+            }
+            return true;
+        }
+        int k;
+        uint64_t ad = d < 0 ? 0 - static_cast<uint64_t>(d) : static_cast<uint64_t>(d);
+        if (powerOfTwo(ad, k)) {
+            // Bias negative dividends by 2^k - 1 so the arithmetic shift truncates toward zero.
+            emit("mov", { MOperand::R(RAX), a });
+            emit("mov", { MOperand::R(RDX), MOperand::R(RAX) });
+            emit("sar", { MOperand::R(RDX), MOperand::I(63) });
+            emit("shr", { MOperand::R(RDX), MOperand::I(64 - k) });
+            emit("add", { MOperand::R(RDX), MOperand::R(RAX) });
+            if (mod) {
+                emit("mov", { MOperand::R(R11), MOperand::I(-static_cast<int64_t>(ad)) });
+                emit("and", { MOperand::R(RDX), MOperand::R(R11) });
+                emit("sub", { MOperand::R(RAX), MOperand::R(RDX) });
+                move(loc(in.dst), MOperand::R(RAX));
+            } else {
+                emit("sar", { MOperand::R(RDX), MOperand::I(k) });
+                if (d < 0) emit("neg", { MOperand::R(RDX) });
+                move(loc(in.dst), MOperand::R(RDX));
+            }
+            return true;
+        }
+        int64_t magic;
+        int shift;
+        signedMagic(d, magic, shift);
+        MOperand x = a;
+        if (x.kind == MOperand::Imm) {
+            emit("mov", { MOperand::R(R11), x });
+            x = MOperand::R(R11);
+        }
+        emit("mov", { MOperand::R(RAX), MOperand::I(magic) });
+        emit("imul", { x });
+        if (d > 0 && magic < 0) emit("add", { MOperand::R(RDX), x });
+        if (d < 0 && magic > 0) emit("sub", { MOperand::R(RDX), x });
+        if (shift) emit("sar", { MOperand::R(RDX), MOperand::I(shift) });
+        emit("mov", { MOperand::R(RAX), MOperand::R(RDX) });
+        emit("shr", { MOperand::R(RAX), MOperand::I(63) });
+        emit("add", { MOperand::R(RDX), MOperand::R(RAX) });
+        if (!mod) {
+            move(loc(in.dst), MOperand::R(RDX));
+            return true;
+        }
+        // remainder = a - q * d
+        if (fitsImm32(d)) {
+            emit("imul", { MOperand::R(RDX), MOperand::R(RDX), MOperand::I(d) });
+        } else {
+            emit("mov", { MOperand::R(RAX), MOperand::I(d) });
+            emit("imul", { MOperand::R(RDX), MOperand::R(RAX) });
+        }
+        emit("mov", { MOperand::R(RAX), x });
+        emit("sub", { MOperand::R(RAX), MOperand::R(RDX) });
+        move(loc(in.dst), MOperand::R(RAX));
+        return true;
+    }
+
+    void divide(const IRInst& in) {
+        emit("mov", { MOperand::R(RAX), val(in.a) });
+        emit("cqo");
+        MOperand b = val(in.b);
+        if (b.kind == MOperand::Imm) {
+            emit("mov", { MOperand::R(R11), b });
+            b = MOperand::R(R11);
+        }
+        emit("idiv", { b });
+        move(loc(in.dst), MOperand::R(in.op == IROp::Div ? RAX : RDX));
+    }
+
+    void shift(const IRInst& in) {
+        std::string op = in.op == IROp::Shl ? "shl" : "shr";
+        if (in.b.isImm()) {
+            IRInst copy = in;
+            copy.b = IRValue::I(in.b.imm & 63);
+            binary(copy, op, false);
+            return;
+        }
+        emit("mov", { MOperand::R(RCX), val(in.b) });
+        emit("mov", { MOperand::R(RAX), val(in.a) });
+        emit(op, { MOperand::R(RAX), MOperand::R(RCX, 8) });
+        move(loc(in.dst), MOperand::R(RAX));
+    }
+
+    // `[base + index*8]` with both parts in registers; RAX and R11 stand in for values that live in memory.
+    MOperand element(const IRValue& base, const IRValue& index, int64_t offset = 0) {
+        MOperand b = val(base);
+        if (b.kind != MOperand::Reg) {
+            emit("mov", { MOperand::R(RAX), b });
+            b = MOperand::R(RAX);
+        }
+        MOperand m = MOperand::M(b.reg, 0);
+        if (index.isImm() && fitsImm32((index.imm + offset) * 8)) {
+            m.imm = (index.imm + offset) * 8;
+            return m;
+        }
+        m.imm = offset * 8;
+        MOperand x = val(index);
+        if (x.kind != MOperand::Reg) {
+            emit("mov", { MOperand::R(R11), x });
+            x = MOperand::R(R11);
+        }
+        m.index = x.reg;
+        return m;
+    }
+
+    // Unsigned compare against the count below the buffer, so negative indices fail too.
+    void boundsCheck(const IRInst& in) {
+        MOperand b = val(in.a);
+        if (b.kind != MOperand::Reg) {
+            emit("mov", { MOperand::R(RAX), b });
+            b = MOperand::R(RAX);
+        }
+        MOperand count = MOperand::M(b.reg, -8);
+        MOperand x = val(in.b);
+        if (x.kind == MOperand::Imm && fitsImm32(x.imm)) {
+            emit("cmp", { count, x });
+            emit("jbe", { MOperand::L("node_rt_bounds_fail") });
+            return;
+        }
+        if (x.kind != MOperand::Reg) {
+            emit("mov", { MOperand::R(R11), x });
+            x = MOperand::R(R11);
+        }
+        emit("cmp", { x, count });
+        emit("jae", { MOperand::L("node_rt_bounds_fail") });
+    }
+
+    void store(const IRValue& base, const IRValue& index, int64_t offset, const IRValue& value) {
+        MOperand m = element(base, index, offset);
+        MOperand v = val(value);
+        if (v.kind == MOperand::Reg || (v.kind == MOperand::Imm && fitsImm32(v.imm))) {
+            emit("mov", { m, v });
+            return;
+        }
+        emit("lea", { MOperand::R(RAX), m });
+        emit("mov", { MOperand::R(R11), v });
+        emit("mov", { MOperand::M(RAX, 0), MOperand::R(R11) });
+    }
+
+    // Mnemonics per register width: SSE2 (16 bytes), AVX2 (32) and AVX-512 (64).
+    struct VectorForms {
+        int bytes;
+        const char *load, *loadUnaligned, *bxor, *band, *bor, *add, *sub;
+    };
+    const VectorForms& forms() const {
+        static const VectorForms table[] = {
+            { 16, "movdqa", "movdqu", "pxor", "pand", "por", "paddq", "psubq" },
+            { 32, "vmovdqa", "vmovdqu", "vpxor", "vpand", "vpor", "vpaddq", "vpsubq" },
+            { 64, "vmovdqa64", "vmovdqu64", "vpxorq", "vpandq", "vporq", "vpaddq", "vpsubq" },
+        };
+        for (const VectorForms& f : table) if (f.bytes == fn.vectorBytes) return f;
+        return table[1];
+    }
+    MOperand vreg(int n) const { return MOperand::V(n, fn.vectorBytes * 8); }
+
+    // SSE2 ops are destructive: d = a op b becomes a copy plus a two-operand op.
+    void sseOp(const std::string& op, MOperand d, MOperand a, MOperand b, bool commutative) {
+        if (d == a) { emit(op, { d, b }); return; }
+        if (d == b && commutative) { emit(op, { d, a }); return; }
+        if (d == b) {
+            MOperand t = vreg(14);
+            emit("movdqa", { t, a });
+            emit(op, { t, b });
+            emit("movdqa", { d, t });
+            return;
+        }
+        emit("movdqa", { d, a });
+        emit(op, { d, b });
+    }
+
+    void vectorArith(const IRInst& in) {
+        const VectorForms& f = forms();
+        MOperand d = vreg(in.vd), a = vreg(in.va), b = vreg(in.vb);
+        const std::string& op = in.sym;
+        bool sse = fn.vectorBytes == 16;
+        if (op != "*") {
+            const char* m = op == "xor" ? f.bxor : op == "and" ? f.band : op == "or" ? f.bor : op == "+" ? f.add : f.sub;
+            if (sse) sseOp(m, d, a, b, op != "-");
+            else emit(m, { d, a, b });
+            return;
+        }
+        if (fn.vectorBytes == 64) {
+            emit("vpmullq", { d, a, b });
+            return;
+        }
+        // No 64-bit low multiply before AVX-512DQ: lo*lo + ((hi*lo + lo*hi) << 32).
+        MOperand t = vreg(14), u = vreg(15);
+        if (sse) {
+            emit("movdqa", { t, a });
+            emit("psrlq", { t, MOperand::I(32) });
+            emit("pmuludq", { t, b });
+            emit("movdqa", { u, b });
+            emit("psrlq", { u, MOperand::I(32) });
+            emit("pmuludq", { u, a });
+            emit("paddq", { t, u });
+            emit("psllq", { t, MOperand::I(32) });
+            sseOp("pmuludq", d, a, b, true);
+            emit("paddq", { d, t });
+            return;
+        }
+        emit("vpsrlq", { t, a, MOperand::I(32) });
+        emit("vpmuludq", { t, t, b });
+        emit("vpsrlq", { u, b, MOperand::I(32) });
+        emit("vpmuludq", { u, a, u });
+        emit("vpaddq", { t, t, u });
+        emit("vpsllq", { t, t, MOperand::I(32) });
+        emit("vpmuludq", { d, a, b });
+        emit("vpaddq", { d, d, t });
+    }
+
+    void vectorSplat(const IRInst& in) {
+        MOperand d = vreg(in.vd);
+        MOperand v = val(in.a);
+        if (v.kind == MOperand::Imm) {
+            emit("mov", { MOperand::R(RAX), v });
+            v = MOperand::R(RAX);
+        }
+        if (fn.vectorBytes == 64) {
+            emit("vpbroadcastq", { d, v });
+        } else if (fn.vectorBytes == 32) {
+            if (v.kind == MOperand::Mem) {
+                emit("vpbroadcastq", { d, v });
+                return;
+            }
+            emit("vmovq", { MOperand::V(in.vd, 128), v });
+            emit("vpbroadcastq", { d, MOperand::V(in.vd, 128) });
+        } else {
+            emit("movq", { d, v });
+            emit("punpcklqdq", { d, d });
+        }
+    }
+
+    void compare(const IRValue& av, const IRValue& bv) {
+        MOperand a = val(av);
+        MOperand b = val(bv);
+        if (a.kind == MOperand::Imm || (a.kind == MOperand::Mem && b.kind == MOperand::Mem)) {
+            emit("mov", { MOperand::R(RAX), a });
+            a = MOperand::R(RAX);
+        }
+        emit("cmp", { a, src(bv) });
+    }
+
+    static std::string condSuffix(Cond c) {
+        switch (c) {
+        case Cond::EQ: return "e";
+        case Cond::NE: return "ne";
+        case Cond::LT: return "l";
+        case Cond::LE: return "le";
+        case Cond::GT: return "g";
+        case Cond::GE: return "ge";
+        }
+        return "e";
+    }
+
+    void epilogue(const std::string& exit = "ret", const std::string& target = "") {
+        for (size_t i = 0; i < alloc.savedRegs.size(); ++i)
+            emit("mov", { MOperand::R(alloc.savedRegs[i]), MOperand::M(RBP, -8 * static_cast<int64_t>(i + 1)) });
+        emit("leave");
+        if (target.empty()) emit(exit);
+        else emit(exit, { MOperand::L(target) });
+    }
+
+    // -- Covers chosen by instruction selection ---------------------------------
+
+    static int64_t coverOffset(const Cover& c) {
+        return c.at('o').isImm() ? c.at('o').imm : c.at('n').isImm() ? -c.at('n').imm : 0;
+    }
+    MOperand memOperand(int load) {
+        const Cover& m = selection->memCovers[load];
+        return element(m.at('p'), m.at('i'), coverOffset(m));
+    }
+    static const char* aluMnemonic(IROp op) {
+        switch (op) {
+        case IROp::Add: return "add";
+        case IROp::Sub: return "sub";
+        case IROp::Mul: return "imul";
+        case IROp::And: return "and";
+        case IROp::Or: return "or";
+        default: return "xor";
+        }
+    }
+    static Cond mirrorCond(Cond c) {
+        switch (c) {
+        case Cond::LT: return Cond::GT;
+        case Cond::LE: return Cond::GE;
+        case Cond::GT: return Cond::LT;
+        case Cond::GE: return Cond::LE;
+        default: return c;
+        }
+    }
+
+    // Sets the flags for a Branch/SetCC cover; returns the condition to test them with.
+    Cond coverFlags(const IRInst& in, const Cover& c, SelectEmit kind) {
+        if (kind == SelectEmit::Test) {
+            MOperand a = val(c.at('a'));
+            if (a.kind != MOperand::Reg) { compare(in.a, in.b); return in.cc; }
+            emit("test", { a, a });
+            return in.cc;
+        }
+        if (kind == SelectEmit::TestAnd) {
+            MOperand a = val(c.at('a')), b = val(c.at('b'));
+            if (a.kind == MOperand::Imm || (b.kind == MOperand::Mem && a.kind == MOperand::Reg)) std::swap(a, b);
+            if (a.kind == MOperand::Mem && b.kind == MOperand::Mem) {
+                emit("mov", { MOperand::R(RAX), b });   // test takes memory first: test [a], rax
+                b = MOperand::R(RAX);
+            } else if (a.kind == MOperand::Imm) {
+                emit("mov", { MOperand::R(RAX), a });
+                a = MOperand::R(RAX);
+            }
+            if (b.kind == MOperand::Imm && !fitsImm32(b.imm)) {
+                emit("mov", { MOperand::R(R11), b });
+                b = MOperand::R(R11);
+            }
+            emit("test", { a, b });
+            return in.cc;
+        }
+        MOperand m = memOperand(c.mem);
+        if (kind == SelectEmit::CmpMem) {
+            MOperand a = val(c.at('a'));
+            if (a.kind == MOperand::Reg) { emit("cmp", { a, m }); return in.cc; }
+            if (a.kind == MOperand::Imm && fitsImm32(a.imm)) { emit("cmp", { m, a }); return mirrorCond(in.cc); }
+            emit("mov", { MOperand::R(RAX), m });
+            if (a.kind == MOperand::Imm) {
+                emit("mov", { MOperand::R(R11), a });
+                a = MOperand::R(R11);
+            }
+            emit("cmp", { a, MOperand::R(RAX) });
+            return in.cc;
+        }
+        MOperand b = val(c.at('b'));
+        if (b.kind == MOperand::Reg || (b.kind == MOperand::Imm && fitsImm32(b.imm))) {
+            emit("cmp", { m, b });
+            return in.cc;
+        }
+        emit("mov", { MOperand::R(RAX), m });
+        emit("cmp", { MOperand::R(RAX), src(c.at('b')) });
+        return in.cc;
+    }
+
+    void lowerCover(const IRInst& in, const Cover& c) {
+        SelectEmit kind = selectionRules[c.rule].emit;
+        MOperand d = in.dst >= 0 ? loc(in.dst) : MOperand();
+        switch (kind) {
+        case SelectEmit::Lea: {
+            MOperand base = val(c.at('a')), index = val(c.at('x'));
+            if (base.kind != MOperand::Reg) {
+                emit("mov", { MOperand::R(RAX), base });
+                base = MOperand::R(RAX);
+            }
+            if (index.kind != MOperand::Reg) {
+                emit("mov", { MOperand::R(R11), index });
+                index = MOperand::R(R11);
+            }
+            MOperand m = MOperand::M(base.reg, c.at('d').isImm() ? c.at('d').imm : 0);
+            m.index = index.reg;
+            m.scale = c.at('s').isImm() ? 1 << c.at('s').imm : c.at('k').isImm() ? static_cast<int>(c.at('k').imm) : 1;
+            if (d.kind == MOperand::Reg) {
+                emit("lea", { d, m });
+            } else {
+                emit("lea", { MOperand::R(RAX), m });
+                move(d, MOperand::R(RAX));
+            }
+            break;
+        }
+        case SelectEmit::OpMem: {
+            // d = a op [m] in place when d already holds a or the address does not use d.
+            MOperand m = memOperand(c.mem), a = val(c.at('a'));
+            std::string op = aluMnemonic(in.op);
+            if (d.kind == MOperand::Reg && (d == a || !m.uses(d.reg))) {
+                move(d, a);
+                emit(op, { d, m });
+                break;
+            }
+            emit("mov", { MOperand::R(RAX), m });
+            if (in.op == IROp::Sub) {
+                emit("neg", { MOperand::R(RAX) });
+                op = "add";
+            }
+            emit(op, { MOperand::R(RAX), src(c.at('a')) });
+            move(d, MOperand::R(RAX));
+            break;
+        }
+        case SelectEmit::LoadMem: {
+            MOperand m = memOperand(c.mem);
+            if (d.kind == MOperand::Reg) {
+                emit("mov", { d, m });
+            } else {
+                emit("mov", { MOperand::R(RAX), m });
+                move(d, MOperand::R(RAX));
+            }
+            break;
+        }
+        case SelectEmit::StoreOffset:
+            store(c.at('p'), c.at('i'), coverOffset(c), c.at('v'));
+            break;
+        case SelectEmit::ReadModifyWrite: {
+            IROp op = IROp::Add;
+            for (int f : c.folded) if (fn.code[f].dst == in.args[0].temp) op = fn.code[f].op;
+            MOperand m = memOperand(c.mem), v = val(c.at('v'));
+            if (v.kind == MOperand::Mem || (v.kind == MOperand::Imm && !fitsImm32(v.imm))) {
+                emit("lea", { MOperand::R(RAX), m });
+                emit("mov", { MOperand::R(R11), v });
+                m = MOperand::M(RAX, 0);
+                v = MOperand::R(R11);
+            }
+            emit(aluMnemonic(op), { m, v });
+            break;
+        }
+        case SelectEmit::Test: case SelectEmit::TestAnd: case SelectEmit::CmpMem: case SelectEmit::MemCmp: {
+            Cond cc = coverFlags(in, c, kind);
+            if (in.op == IROp::Branch) {
+                emit("j" + condSuffix(cc), { MOperand::L(in.sym) });
+                break;
+            }
+            emit("set" + condSuffix(cc), { MOperand::R(RAX, 8) });
+            emit("movzx", { MOperand::R(RAX), MOperand::R(RAX, 8) });
+            move(d, MOperand::R(RAX));
+            break;
+        }
+        default:
+            lower(in);
+            break;
+        }
+    }
+
+    void lower(const IRInst& in) {
+        switch (in.op) {
+        case IROp::Const:
+        case IROp::Copy:
+            if (in.dst >= 0) move(loc(in.dst), val(in.a));
+            break;
+        case IROp::Add: binary(in, "add", true); break;
+        case IROp::Sub: binary(in, "sub", false); break;
+        case IROp::Mul:
+            if (!strengthReduce || !multiplyConst(in)) binary(in, "imul", true);
+            break;
+        case IROp::And: binary(in, "and", true); break;
+        case IROp::Or:  binary(in, "or", true); break;
+        case IROp::Xor: binary(in, "xor", true); break;
+        case IROp::Div: case IROp::Mod:
+            if (!strengthReduce || !divideConst(in)) divide(in);
+            break;
+        case IROp::Shl: case IROp::Shr: shift(in); break;
+        case IROp::Neg: case IROp::Not: {
+            MOperand d = loc(in.dst);
+            std::string op = in.op == IROp::Neg ? "neg" : "not";
+            if (d.kind == MOperand::Reg) {
+                move(d, val(in.a));
+                emit(op, { d });
+            } else {
+                emit("mov", { MOperand::R(RAX), val(in.a) });
+                emit(op, { MOperand::R(RAX) });
+                move(d, MOperand::R(RAX));
+            }
+            break;
+        }
+        case IROp::SetCC:
+            compare(in.a, in.b);
+            emit("set" + condSuffix(in.cc), { MOperand::R(RAX, 8) });
+            emit("movzx", { MOperand::R(RAX), MOperand::R(RAX, 8) });
+            move(loc(in.dst), MOperand::R(RAX));
+            break;
+        case IROp::Branch:
+            compare(in.a, in.b);
+            emit("j" + condSuffix(in.cc), { MOperand::L(in.sym) });
+            break;
+        case IROp::Jump:
+            emit("jmp", { MOperand::L(in.sym) });
+            break;
+        case IROp::Label:
+            label(in.sym);
+            break;
+        case IROp::Call:
+            for (const IRValue& v : in.args) emit("push", { src(v) });
+            for (size_t i = in.args.size(); i-- > 0;) emit("pop", { MOperand::R(argRegs[i]) });
+            emit("call", { MOperand::L(in.sym) });
+            if (in.dst >= 0) move(loc(in.dst), MOperand::R(RAX));
+            break;
+        case IROp::TailCall:
+            // Arguments travel in registers only, so any callee fits in our caller's slot.
+            for (const IRValue& v : in.args) emit("push", { src(v) });
+            for (size_t i = in.args.size(); i-- > 0;) emit("pop", { MOperand::R(argRegs[i]) });
+            epilogue("jmp", in.sym);
+            break;
+        case IROp::Ret:
+            if (in.a.kind != IRValue::None) emit("mov", { MOperand::R(RAX), val(in.a) });
+            epilogue();
+            break;
+        case IROp::Print:
+            emit("mov", { MOperand::R(RDI), val(in.a) });
+            emit("call", { MOperand::L(in.sym) });
+            break;
+        case IROp::Input:
+            emit("call", { MOperand::L("input") });
+            move(loc(in.dst), MOperand::R(RAX));
+            break;
+        case IROp::FrameAddr: {
+            MOperand d = loc(in.dst);
+            MOperand m = MOperand::M(RBP, alloc.bufferOffset(in.a.imm));
+            if (d.kind == MOperand::Reg) {
+                emit("lea", { d, m });
+            } else {
+                emit("lea", { MOperand::R(RAX), m });
+                move(d, MOperand::R(RAX));
+            }
+            break;
+        }
+        case IROp::AddrOf: {
+            MOperand d = loc(in.dst);
+            if (d.kind == MOperand::Reg) {
+                emit("lea", { d, MOperand::Rip(in.sym) });
+            } else {
+                emit("lea", { MOperand::R(RAX), MOperand::Rip(in.sym) });
+                move(d, MOperand::R(RAX));
+            }
+            break;
+        }
+        case IROp::Raw:
+            out.push_back(MInst{ "raw", {}, in.sym, line });
+            break;
+        case IROp::Load: {
+            MOperand m = element(in.a, in.b);
+            MOperand d = loc(in.dst);
+            if (d.kind == MOperand::Reg) {
+                emit("mov", { d, m });
+            } else {
+                emit("mov", { MOperand::R(RAX), m });
+                move(d, MOperand::R(RAX));
+            }
+            break;
+        }
+        case IROp::Store:
+            store(in.a, in.b, 0, in.args[0]);
+            break;
+        case IROp::BoundsCheck:
+            boundsCheck(in);
+            break;
+        case IROp::VLoad:
+            emit(in.sym == "aligned" ? forms().load : forms().loadUnaligned, { vreg(in.vd), element(in.a, in.b, in.args[0].imm) });
+            break;
+        case IROp::VStore:
+            emit(in.sym == "aligned" ? forms().load : forms().loadUnaligned, { element(in.a, in.b, in.args[0].imm), vreg(in.va) });
+            break;
+        case IROp::VSplat:
+            vectorSplat(in);
+            break;
+        case IROp::VArith:
+            vectorArith(in);
+            break;
+        case IROp::VZeroUpper:
+            emit("vzeroupper");
+            break;
+        case IROp::Count: {
+            MOperand counter = MOperand::Rip("node_prof_counters");
+            counter.imm = 8 * in.a.imm;
+            emit("inc", { counter });
+            break;
+        }
+        case IROp::Param:
+            break;
+        }
+    }
+};
+
+// -----------------------------
+// PEEPHOLE OPTIMIZER
+// -----------------------------
+
+static bool readsFlags(const std::string& op) {
+    return (op[0] == 'j' && op != "jmp") || op.compare(0, 3, "set") == 0 || op.compare(0, 4, "cmov") == 0 ||
+           op == "adc" || op == "sbb";
+}
+
+static bool writesFlags(const std::string& op) {
+    static const char* writers[] = { "add", "sub", "and", "or", "xor", "cmp", "test", "inc", "dec", "neg",
+                                     "imul", "shl", "shr", "sar", "idiv", "adc", "sbb" };
+    for (const char* w : writers) if (op == w) return true;
+    return false;
+}
+
+// True when nothing after `i` can observe the flags before they are rewritten.
+static bool flagsDeadAfter(const std::vector<MInst>& code, size_t i) {
+    for (size_t k = i + 1; k < code.size(); ++k) {
+        const std::string& op = code[k].op;
+        if (readsFlags(op)) return false;
+        if (writesFlags(op) || op == "call" || op == "ret") return true;
+        if (op == "jmp" || op == "raw") return false;   // labels only add predecessors; keep scanning
+    }
+    return true;
+}
+
+static bool readsOperand(const MInst& in, const MOperand& reg) {
+    for (size_t k = 0; k < in.ops.size(); ++k) {
+        const MOperand& o = in.ops[k];
+        if (o.kind == MOperand::Mem && o.uses(reg.reg)) return true;
+        if (o.kind == MOperand::Reg && o.reg == reg.reg && (k > 0 || in.op != "mov")) return true;
+    }
+    return false;
+}
+
+static Cond condFromSuffix(const std::string& s, bool& ok) {
+    static const std::pair<const char*, Cond> table[] = {
+        {"e", Cond::EQ}, {"ne", Cond::NE}, {"l", Cond::LT}, {"le", Cond::LE}, {"g", Cond::GT}, {"ge", Cond::GE},
+    };
+    for (const auto& entry : table) if (s == entry.first) { ok = true; return entry.second; }
+    ok = false;
+    return Cond::EQ;
+}
+
+static std::string suffixFromCond(Cond c) {
+    switch (c) {
+    case Cond::EQ: return "e";
+    case Cond::NE: return "ne";
+    case Cond::LT: return "l";
+    case Cond::LE: return "le";
+    case Cond::GT: return "g";
+    case Cond::GE: return "ge";
+    }
+    return "e";
+}
+
+// A rule matches a window of instructions whose mnemonics fit `shape` ("jcc" matches any
+// conditional jump), then `apply` checks operand constraints and rewrites in place.
+struct PeepholeRule {
+    const char* name;
+    std::vector<std::string> shape;
+    bool (*apply)(std::vector<MInst>& code, size_t i);
+};
+
+static const PeepholeRule peepholeRules[] = {
+    { "self-move", { "mov" }, [](std::vector<MInst>& c, size_t i) {
+        if (c[i].ops[0] != c[i].ops[1]) return false;
+        c.erase(c.begin() + i);
+        return true;
+    } },
+    { "overwritten-move", { "mov", "mov" }, [](std::vector<MInst>& c, size_t i) {
+        const MOperand& d = c[i].ops[0];
+        if (d.kind != MOperand::Reg || c[i + 1].ops[0] != d || readsOperand(c[i + 1], d)) return false;
+        c.erase(c.begin() + i);
+        return true;
+    } },
+    { "store-reload", { "mov", "mov" }, [](std::vector<MInst>& c, size_t i) {
+        if (c[i].ops[0].kind != MOperand::Mem || c[i + 1].ops[1] != c[i].ops[0] || c[i + 1].ops[0] != c[i].ops[1]) return false;
+        c.erase(c.begin() + i + 1);
+        return true;
+    } },
+    { "push-pop", { "push", "pop" }, [](std::vector<MInst>& c, size_t i) {
+        MOperand s = c[i].ops[0], d = c[i + 1].ops[0];
+        if (s.kind == MOperand::Mem && d.kind == MOperand::Mem) return false;
+        c[i] = MInst{ "mov", { d, s }, "", c[i].line };
+        c.erase(c.begin() + i + 1);
+        return true;
+    } },
+    { "fold-add-chain", { "add", "add" }, [](std::vector<MInst>& c, size_t i) {
+        const MInst &a = c[i], &b = c[i + 1];
+        if (a.ops[0] != b.ops[0] || a.ops[1].kind != MOperand::Imm || b.ops[1].kind != MOperand::Imm) return false;
+        int64_t sum = a.ops[1].imm + b.ops[1].imm;
+        if (sum < INT32_MIN || sum > INT32_MAX || !flagsDeadAfter(c, i + 1)) return false;
+        c[i].ops[1].imm = sum;
+        c.erase(c.begin() + i + 1);
+        return true;
+    } },
+    { "redundant-compare", { "", "cmp", "jcc" }, [](std::vector<MInst>& c, size_t i) {
+        // Logic ops clear OF/CF, so `cmp r, 0` after them only repeats their flags.
+        // After add/sub only ZF is guaranteed equivalent.
+        const MInst &def = c[i], &cmp = c[i + 1], &jcc = c[i + 2];
+        if (cmp.ops[1].kind != MOperand::Imm || cmp.ops[1].imm != 0 || def.ops.empty() || def.ops[0] != cmp.ops[0]) return false;
+        bool logic = def.op == "and" || def.op == "or" || def.op == "xor";
+        bool arith = def.op == "add" || def.op == "sub" || def.op == "inc" || def.op == "dec" || def.op == "neg";
+        bool zeroTest = jcc.op == "je" || jcc.op == "jne";
+        if (!logic && !(arith && zeroTest)) return false;
+        c.erase(c.begin() + i + 1);
+        return true;
+    } },
+    { "jump-to-next", { "jmp", "label" }, [](std::vector<MInst>& c, size_t i) {
+        if (c[i].ops[0].sym != c[i + 1].ops[0].sym) return false;
+        c.erase(c.begin() + i);
+        return true;
+    } },
+    { "jcc-over-jmp", { "jcc", "jmp", "label" }, [](std::vector<MInst>& c, size_t i) {
+        bool ok;
+        Cond cc = condFromSuffix(c[i].op.substr(1), ok);
+        if (!ok || c[i].ops[0].sym != c[i + 2].ops[0].sym) return false;
+        c[i] = MInst{ "j" + suffixFromCond(invertCond(cc)), { c[i + 1].ops[0] }, "", c[i].line };
+        c.erase(c.begin() + i + 1);
+        return true;
+    } },
+    { "zero-idiom", { "mov" }, [](std::vector<MInst>& c, size_t i) {
+        MInst& in = c[i];
+        if (in.ops[0].kind != MOperand::Reg || in.ops[0].size != 64 || in.ops[1].kind != MOperand::Imm ||
+            in.ops[1].imm != 0 || !flagsDeadAfter(c, i)) return false;
+        MOperand r = MOperand::R(in.ops[0].reg, 32);
+        in = MInst{ "xor", { r, r }, "", in.line };
+        return true;
+    } },
+};
+
+struct PeepholeStats {
+    std::vector<int> hits = std::vector<int>(sizeof(peepholeRules) / sizeof(peepholeRules[0]), 0);
+};
+
+static bool shapeMatches(const std::vector<MInst>& code, size_t i, const std::vector<std::string>& shape) {
+    if (i + shape.size() > code.size()) return false;
+    for (size_t k = 0; k < shape.size(); ++k) {
+        const std::string& want = shape[k];
+        const std::string& op = code[i + k].op;
+        if (want.empty()) { if (op == "label" || op == "raw") return false; continue; }
+        if (want == "jcc") { if (op[0] != 'j' || op == "jmp") return false; continue; }
+        if (op != want) return false;
+    }
+    return true;
+}
+
+static void runPeephole(std::vector<MInst>& code, PeepholeStats& stats) {
+    const size_t ruleCount = sizeof(peepholeRules) / sizeof(peepholeRules[0]);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < code.size(); ++i) {
+            for (size_t r = 0; r < ruleCount; ++r) {
+                if (!shapeMatches(code, i, peepholeRules[r].shape) || !peepholeRules[r].apply(code, i)) continue;
+                stats.hits[r]++;
+                changed = true;
+                i = i >= 2 ? i - 2 : 0;   // the rewrite may enable a match that starts just before it
+                r = ruleCount;
+            }
+        }
+    }
+}
+
+// -----------------------------
+// INSTRUCTION SCHEDULING
+// -----------------------------
+
+// Latency, reciprocal throughput and execution ports of one mnemonic.
+struct InstrCost {
+    int latency = 1;
+    double throughput = 1;   // cycles between two independent instances
+    uint32_t ports = 0x63;   // bit p set: may issue on port p (default p0156)
+};
+
+// A copy of machine/skylake.costs without its comments; keep the two in step. --cost-model=FILE
+// is read over this table and overrides only the entries the file names. To check the copy,
+// `--cost-model=machine/skylake.costs --profile` must report 0 entries changed and 0 kept.
+static const char* builtinCostModel = R"(
+issue-width 4
+load         5   0.5   p23
+store        4   1     p4
+mov          1   0.25  p0156
+movzx        1   0.25  p0156
+lea          1   0.5   p15
+add          1   0.25  p0156
+sub          1   0.25  p0156
+and          1   0.25  p0156
+or           1   0.25  p0156
+xor          1   0.25  p0156
+cmp          1   0.25  p0156
+test         1   0.25  p0156
+inc          1   0.25  p0156
+neg          1   0.25  p0156
+not          1   0.25  p0156
+shl          1   0.5   p06
+shr          1   0.5   p06
+sar          1   0.5   p06
+setcc        1   0.5   p06
+cqo          1   0.5   p06
+imul         3   1     p1
+idiv         42  24    p0
+movq         2   1     p5
+vmovq        2   1     p5
+movdqa       1   0.33  p015
+movdqu       1   0.33  p015
+vmovdqa      1   0.33  p015
+vmovdqu      1   0.33  p015
+vmovdqa64    1   0.33  p05
+vmovdqu64    1   0.33  p05
+vpbroadcastq 3   1     p5
+punpcklqdq   1   1     p5
+pxor         1   0.33  p015
+pand         1   0.33  p015
+por          1   0.33  p015
+paddq        1   0.33  p015
+psubq        1   0.33  p015
+vpxor        1   0.33  p015
+vpand        1   0.33  p015
+vpor         1   0.33  p015
+vpxorq       1   0.5   p05
+vpandq       1   0.5   p05
+vporq        1   0.5   p05
+vpaddq       1   0.33  p015
+vpsubq       1   0.33  p015
+psrlq        1   0.5   p01
+psllq        1   0.5   p01
+vpsrlq       1   0.5   p01
+vpsllq       1   0.5   p01
+pmuludq      5   0.5   p01
+vpmuludq     5   0.5   p01
+vpmullq      15  1.5   p0
+)";
+
+class CostModel {
+    std::unordered_map<std::string, InstrCost> table;
+
+public:
+    int issueWidth = 4;
+    std::string source = "built-in";
+    int changed = 0;         // entries the last Parse added or changed, issue-width included
+    int kept = 0;            // entries already in the table that the last Parse did not name
+
+    // "mnemonic latency throughput pPORTS" per line, `#` comments, plus `issue-width N`.
+    bool Parse(std::istream& in, const std::string& name, std::string& error) {
+        std::string line;
+        std::unordered_set<std::string> named;
+        int previousWidth = issueWidth;
+        changed = 0;
+        for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            std::string op, ports;
+            if (!(fields >> op)) continue;
+            if (op == "issue-width") {
+                if (!(fields >> issueWidth) || issueWidth < 1) {
+                    error = name + ":" + std::to_string(lineNo) + ": issue-width needs a positive count";
+                    return false;
+                }
+                continue;
+            }
+            InstrCost cost;
+            cost.ports = 0;
+            if (!(fields >> cost.latency >> cost.throughput >> ports) || cost.latency < 0 || cost.throughput <= 0 ||
+                ports.size() < 2 || ports[0] != 'p') {
+                error = name + ":" + std::to_string(lineNo) + ": expected `mnemonic latency throughput pPORTS`";
+                return false;
+            }
+            for (size_t k = 1; k < ports.size(); ++k) {
+                if (ports[k] < '0' || ports[k] > '7') {
+                    error = name + ":" + std::to_string(lineNo) + ": ports are digits 0-7 after `p`";
+                    return false;
+                }
+                cost.ports |= 1u << (ports[k] - '0');
+            }
+            auto it = table.find(op);
+            if (it == table.end() || it->second.latency != cost.latency || it->second.throughput != cost.throughput ||
+                it->second.ports != cost.ports)
+                ++changed;
+            named.insert(op);
+            table[op] = cost;
+        }
+        kept = 0;
+        for (const auto& entry : table) kept += !named.count(entry.first);
+        changed += issueWidth != previousWidth;
+        source = name;
+        return true;
+    }
+
+    bool Load(const std::string& path, std::string& error) {
+        std::ifstream in(path);
+        if (!in.is_open()) { error = "cannot open " + path; return false; }
+        return Parse(in, path, error);
+    }
+
+    const InstrCost& of(const std::string& op) const {
+        static const InstrCost unknown;
+        auto it = table.find(op.compare(0, 3, "set") == 0 ? "setcc" : op);
+        return it == table.end() ? unknown : it->second;
+    }
+};
+
+// Registers, flags and memory an instruction reads and writes. Returns false for anything the
+// scheduler must not move across (labels, jumps, calls, push/pop, raw text, vzeroupper).
+struct InstEffects {
+    uint32_t uses = 0, defs = 0;        // general registers
+    uint32_t vecUses = 0, vecDefs = 0;  // xmm/ymm/zmm registers
+    bool readsFlags = false, writesFlags = false;
+    bool load = false, store = false;
+    const MOperand* mem = nullptr;
+    int memBytes = 8;
+};
+
+static bool instEffects(const MInst& in, InstEffects& e) {
+    static const std::unordered_set<std::string> moves = {
+        "mov", "movzx", "lea", "movq", "vmovq", "movdqa", "movdqu", "vmovdqa", "vmovdqu", "vmovdqa64", "vmovdqu64",
+        "vpbroadcastq",
+    };
+    static const std::unordered_set<std::string> alu = {
+        "add", "sub", "and", "or", "xor", "cmp", "test", "inc", "neg", "not", "imul", "shl", "shr", "sar",
+        "pxor", "pand", "por", "paddq", "psubq", "pmuludq", "psrlq", "psllq", "punpcklqdq",
+        "vpxor", "vpand", "vpor", "vpxorq", "vpandq", "vporq", "vpaddq", "vpsubq", "vpmuludq", "vpsrlq", "vpsllq",
+        "vpmullq",
+    };
+    const std::string& op = in.op;
+    if (op == "cqo") {
+        e.uses = regBit(RAX);
+        e.defs = regBit(RDX);
+        return true;
+    }
+    if (op == "idiv" || (op == "imul" && in.ops.size() == 1)) {
+        const MOperand& x = in.ops[0];
+        e.uses = regBit(RAX) | (op == "idiv" ? regBit(RDX) : 0);
+        if (x.kind == MOperand::Reg) e.uses |= regBit(x.reg);
+        if (x.kind == MOperand::Mem) { e.mem = &x; e.load = true; }
+        e.defs = regBit(RAX) | regBit(RDX);
+        e.writesFlags = true;
+    } else if (op.compare(0, 3, "set") == 0 && in.ops.size() == 1) {
+        e.readsFlags = true;
+        e.uses = e.defs = regBit(in.ops[0].reg);   // writes the low byte only
+        return true;
+    } else if (!moves.count(op) && !alu.count(op)) {
+        return false;
+    }
+    bool move = moves.count(op) > 0;
+    bool compare = op == "cmp" || op == "test";
+    bool threeOperand = in.ops.size() == 3;
+    bool zeroIdiom = (op == "xor" || op == "sub" || op == "pxor") && in.ops.size() == 2 && in.ops[0] == in.ops[1];
+    if (!e.defs) {
+        for (size_t k = 0; k < in.ops.size(); ++k) {
+            const MOperand& o = in.ops[k];
+            bool dst = k == 0 && !compare;
+            bool read = !dst || !(move || threeOperand || zeroIdiom) || (o.kind == MOperand::Reg && o.size == 8);
+            if (o.kind == MOperand::Reg) {
+                if (dst) e.defs |= regBit(o.reg);
+                if (read) e.uses |= regBit(o.reg);
+            } else if (o.kind == MOperand::Vec) {
+                if (dst) e.vecDefs |= 1u << o.reg;
+                if (read) e.vecUses |= 1u << o.reg;
+                e.memBytes = std::max(e.memBytes, o.size / 8);
+            } else if (o.kind == MOperand::Mem) {
+                if (o.reg != NoReg) e.uses |= regBit(o.reg);
+                if (o.index != NoReg) e.uses |= regBit(o.index);
+                if (op == "lea") continue;
+                e.mem = &o;
+                if (dst) e.store = true;
+                if (read) e.load = true;
+            }
+        }
+    }
+    if (!move && op[0] != 'p' && op[0] != 'v' && op != "not") e.writesFlags = true;
+    return true;
+}
+
+// Whether two memory operands can overlap. Same base and index with disjoint displacements are
+// apart; if the base changes between them, the register dependences already keep their order.
+static bool mayAlias(const InstEffects& a, const InstEffects& b) {
+    const MOperand &x = *a.mem, &y = *b.mem;
+    if (x.reg == NoReg || y.reg == NoReg) {
+        if (x.reg != y.reg) return true;
+        if (x.sym != y.sym) return false;
+    } else if (x.reg != y.reg || x.index != y.index || (x.index != NoReg && x.scale != y.scale)) {
+        return true;
+    }
+    return x.imm < y.imm + b.memBytes && y.imm < x.imm + a.memBytes;
+}
+
+struct ScheduleStats {
+    int regions = 0, reordered = 0, moved = 0;
+    long cyclesBefore = 0, cyclesAfter = 0;   // estimated issue cycles of the scheduled regions
+};
+
+// List scheduler over straight-line regions of lowered code. Each region becomes a dependence
+// graph (register, flag and memory edges weighted by producer latency); instructions are then
+// issued cycle by cycle, longest remaining latency path first, subject to the issue width and
+// the ports in the cost model. A region keeps its order unless the new one is estimated faster.
+class ListScheduler {
+    const CostModel& costs;
+    ScheduleStats& stats;
+    static constexpr size_t maxRegion = 256;   // keeps the quadratic graph build cheap
+
+    struct Node {
+        InstEffects fx;
+        int latency = 1, occupancy = 1;
+        uint32_t ports = 0;
+        std::vector<std::pair<int, int>> succs;   // (node, edge latency)
+        int preds = 0;
+        long priority = 0;
+    };
+
+public:
+    ListScheduler(const CostModel& c, ScheduleStats& s) : costs(c), stats(s) {}
+
+    void Run(std::vector<MInst>& code) {
+        size_t start = 0;
+        for (size_t i = 0; i <= code.size(); ++i) {
+            InstEffects fx;
+            bool barrier = i == code.size() || !instEffects(code[i], fx);
+            if (!barrier && i - start < maxRegion) continue;
+            if (i - start >= 2) scheduleRegion(code, start, i);
+            start = barrier ? i + 1 : i;
+        }
+    }
+
+private:
+    static int portCount(uint32_t ports) { return __builtin_popcount(ports); }
+
+    void build(const std::vector<MInst>& code, size_t from, size_t to, std::vector<Node>& nodes) const {
+        const InstrCost& load = costs.of("load");
+        const InstrCost& store = costs.of("store");
+        for (size_t i = from; i < to; ++i) {
+            Node& n = nodes[i - from];
+            instEffects(code[i], n.fx);
+            const InstrCost& c = costs.of(code[i].op);
+            n.latency = c.latency + (n.fx.load ? load.latency : 0);
+            n.ports = c.ports;
+            n.occupancy = std::max(1, static_cast<int>(std::lround(c.throughput * portCount(c.ports))));
+        }
+        for (size_t j = 0; j < nodes.size(); ++j) {
+            for (size_t i = 0; i < j; ++i) {
+                const InstEffects &a = nodes[i].fx, &b = nodes[j].fx;
+                int edge = -1;
+                if ((a.defs & b.uses) || (a.vecDefs & b.vecUses) || (a.writesFlags && b.readsFlags))
+                    edge = nodes[i].latency;
+                else if ((a.uses & b.defs) || (a.defs & b.defs) || (a.vecUses & b.vecDefs) || (a.vecDefs & b.vecDefs) ||
+                         (a.readsFlags && b.writesFlags) || (a.writesFlags && b.writesFlags))
+                    edge = 0;
+                if (a.mem && b.mem && (a.store || b.store) && mayAlias(a, b))
+                    edge = std::max(edge, a.store && b.load ? store.latency : 0);
+                if (edge < 0) continue;
+                nodes[i].succs.push_back({ static_cast<int>(j), edge });
+                nodes[j].preds++;
+            }
+        }
+        for (size_t i = nodes.size(); i-- > 0;) {
+            Node& n = nodes[i];
+            n.priority = n.latency;
+            for (const auto& s : n.succs) n.priority = std::max(n.priority, s.second + nodes[s.first].priority);
+        }
+    }
+
+    // Issues the graph cycle by cycle and returns the cycle count; `inOrder` only ever considers
+    // the next instruction of the original sequence, which estimates the unscheduled code.
+    long simulate(const std::vector<Node>& nodes, bool inOrder, std::vector<int>& order) const {
+        const InstrCost& load = costs.of("load");
+        const InstrCost& store = costs.of("store");
+        std::vector<int> preds(nodes.size());
+        std::vector<long> earliest(nodes.size(), 0);
+        for (size_t i = 0; i < nodes.size(); ++i) preds[i] = nodes[i].preds;
+        std::vector<long> portFree(8, 0);
+        std::vector<int> ready;
+        for (size_t i = 0; i < nodes.size(); ++i) if (!preds[i]) ready.push_back(static_cast<int>(i));
+        order.clear();
+        long cycle = 0, finish = 0;
+        // A free port from `mask` at this cycle, or -1.
+        auto port = [&](uint32_t mask) {
+            for (int p = 0; p < 8; ++p) if ((mask >> p & 1) && portFree[p] <= cycle) return p;
+            return -1;
+        };
+        while (order.size() < nodes.size()) {
+            int issued = 0;
+            for (bool progress = true; progress && issued < costs.issueWidth;) {
+                progress = false;
+                int best = -1;
+                for (int n : ready) {
+                    if (earliest[n] > cycle) continue;
+                    if (inOrder && n != static_cast<int>(order.size())) continue;
+                    if (best < 0 || nodes[n].priority > nodes[best].priority ||
+                        (nodes[n].priority == nodes[best].priority && n < best)) best = n;
+                }
+                if (best < 0) break;
+                const Node& n = nodes[best];
+                int exec = port(n.ports);
+                int loadPort = n.fx.load ? port(load.ports) : 8;
+                int storePort = n.fx.store ? port(store.ports) : 8;
+                if (exec < 0 || loadPort < 0 || storePort < 0) {
+                    if (inOrder) break;
+                    // Blocked on ports: let the next candidate try by deferring this one a cycle.
+                    earliest[best] = cycle + 1;
+                    progress = true;
+                    continue;
+                }
+                portFree[exec] = cycle + n.occupancy;
+                if (loadPort < 8) portFree[loadPort] = cycle + 1;
+                if (storePort < 8) portFree[storePort] = cycle + 1;
+                ready.erase(std::find(ready.begin(), ready.end(), best));
+                order.push_back(best);
+                finish = std::max(finish, cycle + n.latency);
+                for (const auto& s : n.succs) {
+                    earliest[s.first] = std::max(earliest[s.first], cycle + s.second);
+                    if (--preds[s.first] == 0) ready.push_back(s.first);
+                }
+                issued++;
+                progress = true;
+            }
+            cycle++;
+        }
+        return std::max(cycle, finish);
+    }
+
+    void scheduleRegion(std::vector<MInst>& code, size_t from, size_t to) {
+        std::vector<Node> nodes(to - from);
+        build(code, from, to, nodes);
+        std::vector<int> original, scheduled;
+        long before = simulate(nodes, true, original);
+        long after = simulate(nodes, false, scheduled);
+        stats.regions++;
+        stats.cyclesBefore += before;
+        if (after >= before) {
+            stats.cyclesAfter += before;
+            return;
+        }
+        stats.cyclesAfter += after;
+        stats.reordered++;
+        std::vector<MInst> region(code.begin() + from, code.begin() + to);
+        for (size_t k = 0; k < scheduled.size(); ++k) {
+            if (scheduled[k] != static_cast<int>(k)) stats.moved++;
+            code[from + k] = std::move(region[scheduled[k]]);
+        }
+    }
+};
+
+// -----------------------------
+// MACHINE CODE (x86-64 encoder + ELF64 writer)
+// -----------------------------
+
+// Condition suffixes in encoding order: jcc is 0x70+cc (rel8) or 0F 80+cc (rel32), setcc 0F 90+cc.
+static const char* conditionCodes[16] = { "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g" };
+
+static int conditionCode(const std::string& suffix) {
+    static const std::pair<const char*, int> aliases[] = {
+        { "c", 2 }, { "nae", 2 }, { "nb", 3 }, { "nc", 3 }, { "z", 4 }, { "nz", 5 }, { "na", 6 }, { "nbe", 7 },
+        { "pe", 10 }, { "po", 11 }, { "nge", 12 }, { "nl", 13 }, { "ng", 14 }, { "nle", 15 },
+    };
+    for (int cc = 0; cc < 16; ++cc) if (suffix == conditionCodes[cc]) return cc;
+    for (const auto& alias : aliases) if (suffix == alias.first) return alias.second;
+    return -1;
+}
+
+// Two-operand ALU group: opcode of the `r/m, r` form (the byte form is one less, `r, r/m` two
+// more) and the /digit of the 0x80/0x81/0x83 immediate forms.
+struct AluEncoding { const char* op; uint8_t opcode; int digit; };
+static const AluEncoding aluEncodings[] = {
+    { "add", 0x01, 0 }, { "or", 0x09, 1 }, { "adc", 0x11, 2 }, { "sbb", 0x19, 3 },
+    { "and", 0x21, 4 }, { "sub", 0x29, 5 }, { "xor", 0x31, 6 }, { "cmp", 0x39, 7 },
+};
+// /digit of the one-operand F7 group and of the shift group (D1 by one, D3 by cl, C1 by imm8).
+static const std::pair<const char*, int> unaryEncodings[] = {
+    { "not", 2 }, { "neg", 3 }, { "mul", 4 }, { "imul", 5 }, { "div", 6 }, { "idiv", 7 },
+};
+static const std::pair<const char*, int> shiftEncodings[] = {
+    { "rol", 0 }, { "ror", 1 }, { "shl", 4 }, { "sal", 4 }, { "shr", 5 }, { "sar", 7 },
+};
+
+// Packed-integer operations. SSE2 mnemonics use the legacy 66 0F encoding (two operands); the
+// v-forms use VEX for xmm/ymm and EVEX for zmm. `map` is 1 for 0F and 2 for 0F38; `evexW` is
+// EVEX.W, or -1 for mnemonics without a 512-bit form.
+struct PackedEncoding { const char* op; int map; uint8_t opcode; int evexW; };
+static const PackedEncoding packedEncodings[] = {
+    { "paddq", 1, 0xD4, -1 }, { "psubq", 1, 0xFB, -1 }, { "pxor", 1, 0xEF, -1 }, { "pand", 1, 0xDB, -1 },
+    { "por", 1, 0xEB, -1 }, { "pmuludq", 1, 0xF4, -1 }, { "punpcklqdq", 1, 0x6C, -1 },
+    { "vpaddq", 1, 0xD4, 1 }, { "vpsubq", 1, 0xFB, 1 }, { "vpxor", 1, 0xEF, -1 }, { "vpand", 1, 0xDB, -1 },
+    { "vpor", 1, 0xEB, -1 }, { "vpxorq", 1, 0xEF, 1 }, { "vpandq", 1, 0xDB, 1 }, { "vporq", 1, 0xEB, 1 },
+    { "vpmuludq", 1, 0xF4, 1 }, { "vpunpcklqdq", 1, 0x6C, 1 }, { "vpmullq", 2, 0x40, 1 },
+};
+// Whole-register moves: mandatory prefix (1 = 66, 2 = F3) and EVEX.W; loads are 6F, stores 7F.
+struct VectorMoveEncoding { const char* op; int pp; int evexW; };
+static const VectorMoveEncoding vectorMoveEncodings[] = {
+    { "movdqa", 1, -1 }, { "movdqu", 2, -1 }, { "vmovdqa", 1, -1 }, { "vmovdqu", 2, -1 },
+    { "vmovdqa32", 1, 0 }, { "vmovdqu32", 2, 0 }, { "vmovdqa64", 1, 1 }, { "vmovdqu64", 2, 1 },
+};
+
+static bool fitsInt8(int64_t v) { return v >= -128 && v <= 127; }
+static bool fitsInt32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+enum class FixupKind { Abs64, Rel32 };
+
+// In-process assembler for the NASM subset the emitter produces, fed either NASM text (runtime
+// helpers, data, legacy blocks) or lowered MInsts directly. Sections are lists of fragments that
+// each end in at most one branch to a label, so every branch starts in its 2-byte form and grows
+// to rel32 only when its target is out of reach. The result is written as a static executable
+// or as a relocatable object for an external linker.
+class Assembler {
+public:
+    // Text is buffered until a full line has arrived, so NASM can be streamed in pieces. Fed
+    // text carries no NODE line.
+    void Feed(const std::string& text) {
+        mark(0);
+        feed(text);
+    }
+
+    void Encode(const MInst& in) {
+        if (!pending.empty()) { line(pending); pending.clear(); }
+        if (in.op == "label") { define(in.ops[0].sym); return; }
+        if (in.line) mark(in.line);
+        if (in.op == "raw") { feed(in.text + "\n"); return; }
+        MInst q = in;
+        for (MOperand& o : q.ops) if (!o.sym.empty()) o.sym = qualify(o.sym);
+        lowered = &in;
+        encode(q);
+        lowered = nullptr;
+    }
+
+    // -g: keeps the NODE line of each encoded instruction for a line table naming `source`.
+    // Routines assembled on their own only need the rows, which Append brings over.
+    void DebugLines(const std::string& source) {
+        debugLines = true;
+        debugSource = source;
+    }
+
+    // Splices in `part`, a routine assembled on its own starting in .text. Its fragments follow
+    // this assembler's, and its symbols and fixups move over with shifted fragment indices, so
+    // layout and symbol order come out as if the routine had been encoded here.
+    void Append(Assembler& part) {
+        if (!pending.empty()) { line(pending); pending.clear(); }
+        size_t base[SectionCount];
+        for (int s = 0; s < SectionCount; ++s) {
+            Section &to = sections[s], &from = part.sections[s];
+            base[s] = to.fragments.size();
+            to.align = std::max(to.align, from.align);
+            for (Fragment& f : from.fragments) to.fragments.push_back(std::move(f));
+        }
+        for (const std::string& name : part.symbolOrder) {
+            const Symbol& from = part.symbols.at(name);
+            Symbol& to = symbol(name);
+            bool global = to.global || from.global;
+            if (from.defined) {
+                if (to.defined) throw std::runtime_error("assembler: symbol '" + name + "' defined twice");
+                to = from;
+                to.fragment += base[from.section];
+            }
+            to.global = global;
+        }
+        for (Fixup& f : part.fixups) {
+            f.fragment += base[f.section];
+            fixups.push_back(std::move(f));
+        }
+        for (LineRow& row : part.lineRows) {
+            row.fragment += base[Text];
+            lineRows.push_back(row);
+        }
+        current = part.current;
+        scope = part.scope;
+    }
+
+    // Static, non-PIE executable at 0x400000: headers and .rodata, then .text, then .data and
+    // .bss, each in its own page-aligned segment. Every reference must resolve, so the image
+    // carries no relocations and needs no loader. `packed` puts .text straight after .rodata in
+    // one R+X segment, which saves exec a mapping and the program a page fault.
+    void WriteExecutable(const std::string& path, bool packed = false) {
+        finish();
+        const uint64_t base = 0x400000, page = 0x1000;
+        Section &text = sections[Text], &rodata = sections[Rodata], &data = sections[Data], &bss = sections[Bss];
+        int segments = (packed ? 1 : 2) + (data.size || bss.size ? 1 : 0);
+        uint64_t offset = 64 + 56 * segments;
+        offset = alignUp(offset, rodata.align);
+        rodata.address = base + offset;
+        uint64_t rodataEnd = offset + rodata.size;
+        uint64_t textOffset = alignUp(rodataEnd, packed ? text.align : page);
+        text.address = base + textOffset;
+        uint64_t dataOffset = alignUp(textOffset + text.size, page);
+        data.address = base + dataOffset;
+        bss.address = alignUp(data.address + data.size, bss.align);
+
+        auto entry = symbols.find("_start");
+        if (entry == symbols.end() || !entry->second.defined) throw std::runtime_error("assembler: no _start label");
+        std::vector<std::vector<uint8_t>> images;
+        for (int s = 0; s < SectionCount; ++s) images.push_back(image(s));
+        for (const Fixup& f : fixups) {
+            const Symbol* sym = resolve(f.symbol);
+            if (!sym) throw std::runtime_error("assembler: undefined symbol '" + f.symbol + "' (link the object with --emit-obj)");
+            uint64_t target = address(*sym) + f.addend;
+            uint64_t at = sections[f.section].address + sections[f.section].fragments[f.fragment].start + f.offset;
+            if (f.kind == FixupKind::Abs64) put(images[f.section], at - sections[f.section].address, target, 8);
+            else patchRel32(images[f.section], at - sections[f.section].address, static_cast<int64_t>(target - at));
+        }
+
+        std::vector<uint8_t> file(dataOffset + data.size, 0);
+        std::copy(images[Rodata].begin(), images[Rodata].end(), file.begin() + static_cast<std::ptrdiff_t>(rodata.address - base));
+        std::copy(images[Text].begin(), images[Text].end(), file.begin() + static_cast<std::ptrdiff_t>(textOffset));
+        std::copy(images[Data].begin(), images[Data].end(), file.begin() + static_cast<std::ptrdiff_t>(dataOffset));
+
+        // Section headers after the loaded bytes so objdump, gdb and perf see names and symbols.
+        std::vector<int> present;
+        for (int s = 0; s < SectionCount; ++s) if (s == Text || sections[s].size) present.push_back(s);
+        std::vector<uint8_t> symtab, strtab(1, 0), shstrtab(1, 0);
+        int locals = symbolTable(symtab, strtab, present, true);
+        uint64_t symtabOffset = alignUp(file.size(), 8);
+        file.resize(symtabOffset);
+        file.insert(file.end(), symtab.begin(), symtab.end());
+        uint64_t strtabOffset = file.size();
+        file.insert(file.end(), strtab.begin(), strtab.end());
+        std::vector<uint8_t> headers(64, 0);
+        for (int s : present) {
+            const Section& sec = sections[s];
+            uint64_t at = s == Bss ? dataOffset + (bss.address - data.address) : sec.address - base;
+            sectionHeader(headers, shstrtab, sec.name, s == Bss ? 8 : 1, sectionFlags(s), sec.address, at, sec.size, 0, 0, sec.align, 0);
+        }
+        int symtabIndex = static_cast<int>(present.size()) + 1;
+        sectionHeader(headers, shstrtab, ".symtab", 2, 0, 0, symtabOffset, symtab.size(), symtabIndex + 1, locals, 8, 24);
+        sectionHeader(headers, shstrtab, ".strtab", 3, 0, 0, strtabOffset, strtab.size(), 0, 0, 1, 0);
+        int debugCount = 0;
+        if (debugLines) {
+            std::vector<DebugFixup> unused;
+            std::vector<std::vector<uint8_t>> debug = debugSections(text.address, unused);
+            for (size_t d = 0; d < debug.size(); ++d, ++debugCount) {
+                sectionHeader(headers, shstrtab, debugNames[d], 1, 0, 0, file.size(), debug[d].size(), 0, 0, 1, 0);
+                file.insert(file.end(), debug[d].begin(), debug[d].end());
+            }
+        }
+        uint64_t shstrtabOffset = file.size();
+        int shstrndx = symtabIndex + 2 + debugCount;
+        sectionHeader(headers, shstrtab, ".shstrtab", 3, 0, 0, shstrtabOffset, 0, 0, 0, 1, 0);
+        put(headers, headers.size() - 32, shstrtab.size(), 8);
+        file.insert(file.end(), shstrtab.begin(), shstrtab.end());
+        uint64_t shoff = alignUp(file.size(), 8);
+        file.resize(shoff);
+        file.insert(file.end(), headers.begin(), headers.end());
+
+        elfHeader(file, 2, address(entry->second), 64, segments, shoff, shstrndx + 1, shstrndx);
+        uint64_t ph = 64;
+        if (packed) {
+            programHeader(file, ph, 5, 0, base, textOffset + text.size, textOffset + text.size);   // R+X
+        } else {
+            programHeader(file, ph, 4, 0, base, rodataEnd, rodataEnd);                    // R
+            programHeader(file, ph, 5, textOffset, text.address, text.size, text.size);  // R+X
+        }
+        if (data.size || bss.size)
+            programHeader(file, ph, 6, dataOffset, data.address, data.size, bss.address + bss.size - data.address);  // R+W
+        writeFile(path, file, true);
+    }
+
+    // ET_REL object with .rela sections; references within a section are resolved here.
+    void WriteObject(const std::string& path) { writeFile(path, Object(), false); }
+
+    std::vector<uint8_t> Object() {
+        finish();
+        std::vector<std::vector<uint8_t>> images;
+        for (int s = 0; s < SectionCount; ++s) images.push_back(image(s));
+        std::vector<int> present;
+        for (int s = 0; s < SectionCount; ++s) if (s == Text || sections[s].size) present.push_back(s);
+        // -g: the debug sections follow the loaded ones, and their relocations go through
+        // section symbols for .text (header 1) and for each of them.
+        std::vector<DebugFixup> debugFixups;
+        std::vector<std::vector<uint8_t>> debug;
+        std::vector<int> sectionSymbols;
+        if (debugLines) {
+            debug = debugSections(0, debugFixups);
+            sectionSymbols.push_back(1);
+            for (size_t d = 0; d < debug.size(); ++d) sectionSymbols.push_back(static_cast<int>(present.size() + 1 + d));
+        }
+        std::vector<uint8_t> symtab, strtab(1, 0), shstrtab(1, 0);
+        int locals = symbolTable(symtab, strtab, present, false, sectionSymbols);
+        std::vector<std::vector<uint8_t>> relocations(SectionCount);
+        for (const Fixup& f : fixups) {
+            auto sym = symbols.find(f.symbol);
+            if (!sym->second.defined && !sym->second.global)
+                throw std::runtime_error("assembler: undefined symbol '" + f.symbol + "' (declare it extern)");
+            uint64_t at = sections[f.section].fragments[f.fragment].start + f.offset;
+            if (f.kind == FixupKind::Rel32 && sym->second.defined && sym->second.section == f.section) {
+                uint64_t target = sections[f.section].fragments[sym->second.fragment].start + sym->second.offset;
+                patchRel32(images[f.section], at, static_cast<int64_t>(target + f.addend - at));
+                continue;
+            }
+            std::vector<uint8_t>& rela = relocations[f.section];
+            put(rela, rela.size(), at, 8);
+            put(rela, rela.size(), static_cast<uint64_t>(symbolIndex.at(f.symbol)) << 32 | (f.kind == FixupKind::Abs64 ? 1 : 2), 8);
+            put(rela, rela.size(), static_cast<uint64_t>(f.addend), 8);
+        }
+
+        std::vector<std::vector<uint8_t>> debugRelocations(debug.size());
+        for (const DebugFixup& f : debugFixups) {
+            std::vector<uint8_t>& section = debug[f.section];
+            uint64_t addend = 0;
+            for (int i = f.size - 1; i >= 0; --i) addend = addend << 8 | section[f.offset + i];
+            put(section, f.offset, 0, f.size);
+            std::vector<uint8_t>& rela = debugRelocations[f.section];
+            put(rela, rela.size(), f.offset, 8);
+            put(rela, rela.size(), static_cast<uint64_t>(f.target + 2) << 32 | (f.size == 8 ? 1 : 10), 8);   // R_X86_64_64 / _32
+            put(rela, rela.size(), addend, 8);
+        }
+
+        std::vector<uint8_t> file(64, 0), headers(64, 0);
+        std::map<int, int> headerIndex;
+        int next = 1;
+        for (int s : present) headerIndex[s] = next++;
+        int debugBase = next;
+        next += static_cast<int>(debug.size());
+        int relaCount = 0;
+        for (int s : present) relaCount += !relocations[s].empty();
+        for (const std::vector<uint8_t>& rela : debugRelocations) relaCount += !rela.empty();
+        int symtabIndex = next + relaCount;
+        for (int s : present) {
+            const Section& sec = sections[s];
+            file.resize(alignUp(file.size(), sec.align));
+            uint64_t at = file.size();
+            if (s != Bss) file.insert(file.end(), images[s].begin(), images[s].end());
+            sectionHeader(headers, shstrtab, sec.name, s == Bss ? 8 : 1, sectionFlags(s), 0, at, sec.size, 0, 0, sec.align, 0);
+        }
+        for (size_t d = 0; d < debug.size(); ++d) {
+            sectionHeader(headers, shstrtab, debugNames[d], 1, 0, 0, file.size(), debug[d].size(), 0, 0, 1, 0);
+            file.insert(file.end(), debug[d].begin(), debug[d].end());
+        }
+        for (int s : present) {
+            if (relocations[s].empty()) continue;
+            file.resize(alignUp(file.size(), 8));
+            uint64_t at = file.size();
+            file.insert(file.end(), relocations[s].begin(), relocations[s].end());
+            sectionHeader(headers, shstrtab, ".rela" + sections[s].name, 4, 0x40, 0, at, relocations[s].size(), symtabIndex,
+                          headerIndex[s], 8, 24);
+        }
+        for (size_t d = 0; d < debug.size(); ++d) {
+            if (debugRelocations[d].empty()) continue;
+            file.resize(alignUp(file.size(), 8));
+            uint64_t at = file.size();
+            file.insert(file.end(), debugRelocations[d].begin(), debugRelocations[d].end());
+            sectionHeader(headers, shstrtab, std::string(".rela") + debugNames[d], 4, 0x40, 0, at, debugRelocations[d].size(),
+                          symtabIndex, debugBase + static_cast<int>(d), 8, 24);
+        }
+        file.resize(alignUp(file.size(), 8));
+        uint64_t symtabOffset = file.size();
+        file.insert(file.end(), symtab.begin(), symtab.end());
+        sectionHeader(headers, shstrtab, ".symtab", 2, 0, 0, symtabOffset, symtab.size(), symtabIndex + 1, locals, 8, 24);
+        sectionHeader(headers, shstrtab, ".strtab", 3, 0, 0, file.size(), strtab.size(), 0, 0, 1, 0);
+        file.insert(file.end(), strtab.begin(), strtab.end());
+        sectionHeader(headers, shstrtab, ".shstrtab", 3, 0, 0, file.size(), 0, 0, 0, 1, 0);
+        put(headers, headers.size() - 32, shstrtab.size(), 8);
+        file.insert(file.end(), shstrtab.begin(), shstrtab.end());
+        uint64_t shoff = alignUp(file.size(), 8);
+        file.resize(shoff);
+        file.insert(file.end(), headers.begin(), headers.end());
+        elfHeader(file, 1, 0, 0, 0, shoff, symtabIndex + 3, symtabIndex + 2);
+        return file;
+    }
+
+    // Readies the object for a library: its top-level labels become globals and whatever it
+    // uses without defining becomes an extern. Returns the symbols it now exports.
+    std::vector<std::string> Export() {
+        if (!pending.empty()) { line(pending); pending.clear(); }
+        std::vector<std::string> exported;
+        for (const std::string& name : symbolOrder) {
+            Symbol& s = symbols[name];
+            if (s.defined && name.find('.') != std::string::npos) continue;
+            s.global = true;
+            if (s.defined) exported.push_back(name);
+        }
+        return exported;
+    }
+
+    size_t codeBytes() const { return sections[Text].size; }
+
+private:
+    enum { Text, Rodata, Data, Bss, SectionCount };
+
+    struct Fragment {
+        std::vector<uint8_t> bytes;
+        uint64_t zeros = 0;        // .bss space reserved after the bytes
+        uint64_t align = 1;        // alignment of the fragment's start
+        int branch = -1;           // trailing branch: jcc condition 0-15, or 16 for jmp
+        std::string target;
+        bool wide = false;         // rel32 form: 5 bytes for jmp, 6 for jcc; the short form is 2
+        uint64_t start = 0;        // offset in the section once laid out
+        uint64_t size() const { return bytes.size() + zeros + (branch < 0 ? 0 : !wide ? 2 : branch == 16 ? 5 : 6); }
+    };
+    struct Section {
+        std::string name;
+        std::vector<Fragment> fragments = std::vector<Fragment>(1);
+        uint64_t align = 1, size = 0, address = 0;
+    };
+    struct Symbol {
+        int section = -1;
+        size_t fragment = 0;
+        uint64_t offset = 0;
+        bool defined = false, global = false;
+    };
+    struct Fixup {
+        int section;
+        size_t fragment;
+        uint64_t offset;
+        std::string symbol;
+        int64_t addend;
+        FixupKind kind;
+    };
+
+    Section sections[SectionCount] = { { ".text" }, { ".rodata" }, { ".data" }, { ".bss" } };
+    int current = Text;
+    std::unordered_map<std::string, Symbol> symbols;
+    std::vector<std::string> symbolOrder;           // first mention, for a stable symbol table
+    std::unordered_map<std::string, int> symbolIndex;
+    std::vector<Fixup> fixups;
+    std::string pending, scope, source;   // source: the NASM line being assembled
+    const MInst* lowered = nullptr;       // or the lowered instruction
+    bool finished = false;
+
+    // -g: where the NODE line changes in .text, in address order
+    struct LineRow { size_t fragment; uint64_t offset; int line; };
+    std::vector<LineRow> lineRows;
+    bool debugLines = false;
+    std::string debugSource;
+
+    static uint64_t alignUp(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+    [[noreturn]] void fail() const {
+        std::string what = source;
+        if (lowered) {
+            EmitBuffer text;
+            printInst(text, *lowered);
+            what = trim(text.str());
+        }
+        throw std::runtime_error("assembler: cannot encode '" + what + "'");
+    }
+
+    Fragment& fragment() { return sections[current].fragments.back(); }
+    void feed(const std::string& text) {
+        pending += text;
+        size_t start = 0, end;
+        while ((end = pending.find('\n', start)) != std::string::npos) {
+            line(pending.substr(start, end - start));
+            start = end + 1;
+        }
+        pending.erase(0, start);
+    }
+    void mark(int line) {
+        if (!debugLines || current != Text) return;
+        if (lineRows.empty() ? line == 0 : lineRows.back().line == line) return;
+        lineRows.push_back({ sections[Text].fragments.size() - 1, fragment().bytes.size(), line });
+    }
+    void byte(uint8_t b) {
+        if (current == Bss) throw std::runtime_error("assembler: initialized data in .bss: '" + source + "'");
+        fragment().bytes.push_back(b);
+    }
+    void bytes(uint64_t v, int n) { for (int i = 0; i < n; ++i) byte(static_cast<uint8_t>(v >> (8 * i))); }
+
+    Symbol& symbol(const std::string& name) {
+        auto it = symbols.find(name);
+        if (it == symbols.end()) {
+            symbolOrder.push_back(name);
+            it = symbols.emplace(name, Symbol()).first;
+        }
+        return it->second;
+    }
+    // NASM scoping: `.x` belongs to the last label that does not start with a dot.
+    std::string qualify(const std::string& name) const { return name[0] == '.' ? scope + name : name; }
+    void define(const std::string& label) {
+        std::string name = qualify(label);
+        if (label[0] != '.') scope = label;
+        Symbol& s = symbol(name);
+        if (s.defined) throw std::runtime_error("assembler: symbol '" + name + "' defined twice");
+        s.defined = true;
+        s.section = current;
+        s.fragment = sections[current].fragments.size() - 1;
+        s.offset = fragment().bytes.size() + fragment().zeros;
+    }
+    void fixup(const std::string& name, int64_t addend, FixupKind kind) {
+        symbol(name);
+        fixups.push_back({ current, sections[current].fragments.size() - 1, fragment().bytes.size(), name, addend, kind });
+    }
+    void align(uint64_t a) {
+        sections[current].align = std::max(sections[current].align, a);
+        if (fragment().size() == 0) { fragment().align = std::max(fragment().align, a); return; }
+        sections[current].fragments.emplace_back();
+        fragment().align = a;
+    }
+    void branch(int kind, const std::string& target) {
+        symbol(target);
+        fragment().branch = kind;
+        fragment().target = target;
+        sections[current].fragments.emplace_back();
+    }
+
+    // -- NASM text ------------------------------------------------------------
+
+    static std::string lower(std::string s) {
+        for (char& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return s;
+    }
+    static std::string trim(const std::string& s) {
+        size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+        return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+    }
+    // Splits at commas outside quotes and brackets.
+    static std::vector<std::string> split(const std::string& s) {
+        std::vector<std::string> parts(1);
+        char quote = 0;
+        int depth = 0;
+        for (char c : s) {
+            if (quote) { if (c == quote) quote = 0; }
+            else if (c == '"' || c == '\'') quote = c;
+            else if (c == '[') depth++;
+            else if (c == ']') depth--;
+            else if (c == ',' && depth == 0) { parts.emplace_back(); continue; }
+            parts.back() += c;
+        }
+        for (std::string& p : parts) p = trim(p);
+        return parts;
+    }
+    static bool number(const std::string& s, int64_t& v) {
+        if (s.size() == 3 && s[0] == '\'' && s[2] == '\'') { v = static_cast<unsigned char>(s[1]); return true; }
+        size_t i = s[0] == '-' || s[0] == '+' ? 1 : 0;
+        if (i >= s.size() || !std::isdigit(static_cast<unsigned char>(s[i]))) return false;
+        bool hex = s.compare(i, 2, "0x") == 0;
+        char* end = nullptr;
+        uint64_t magnitude = std::strtoull(s.c_str() + i + (hex ? 2 : 0), &end, hex ? 16 : 10);
+        if (*end) return false;
+        v = static_cast<int64_t>(s[0] == '-' ? 0 - magnitude : magnitude);
+        return true;
+    }
+    static int registerNumber(const std::string& name, const char* const (&names)[16]) {
+        for (int r = 0; r < 16; ++r) if (name == names[r]) return r;
+        return NoReg;
+    }
+    static bool registerOperand(const std::string& name, MOperand& o) {
+        int r;
+        if ((r = registerNumber(name, regName64)) != NoReg) { o = MOperand::R(r, 64); return true; }
+        if ((r = registerNumber(name, regName32)) != NoReg) { o = MOperand::R(r, 32); return true; }
+        if ((r = registerNumber(name, regName8)) != NoReg) { o = MOperand::R(r, 8); return true; }
+        static const std::pair<const char*, int> vectors[] = { { "xmm", 128 }, { "ymm", 256 }, { "zmm", 512 } };
+        for (const auto& v : vectors) {
+            if (name.compare(0, 3, v.first) != 0 || name.size() < 4 || name.size() > 5) continue;
+            int n = 0;
+            for (size_t i = 3; i < name.size(); ++i) {
+                if (!std::isdigit(static_cast<unsigned char>(name[i]))) return false;
+                n = n * 10 + (name[i] - '0');
+            }
+            if (n > 15) return false;
+            o = MOperand::V(n, v.second);
+            return true;
+        }
+        return false;
+    }
+
+    MOperand operand(const std::string& text) {
+        std::string t = text, l = lower(text);
+        int size = 64;
+        static const std::pair<const char*, int> sizes[] = {
+            { "byte", 8 }, { "word", 16 }, { "dword", 32 }, { "qword", 64 }, { "oword", 128 }, { "yword", 256 }, { "zword", 512 },
+        };
+        for (const auto& s : sizes) {
+            size_t n = std::strlen(s.first);
+            if (l.compare(0, n, s.first) == 0 && l.size() > n && (l[n] == ' ' || l[n] == '[')) {
+                size = s.second;
+                t = trim(t.substr(n));
+                l = lower(t);
+                break;
+            }
+        }
+        MOperand o;
+        int64_t v;
+        if (!t.empty() && t[0] == '[' && t.back() == ']') {
+            std::string inner = trim(t.substr(1, t.size() - 2));
+            if (lower(inner).compare(0, 4, "rel ") == 0) {
+                std::string target = trim(inner.substr(4));
+                size_t plus = target.find_first_of("+-");
+                o = MOperand::Rip(qualify(trim(target.substr(0, plus))));
+                if (plus != std::string::npos && !number(trim(target.substr(plus)), o.imm)) fail();
+                o.size = size;
+                return o;
+            }
+            o = MOperand::M(NoReg, 0);
+            inner.erase(std::remove_if(inner.begin(), inner.end(), [](char c) { return c == ' ' || c == '\t'; }), inner.end());
+            std::string term;
+            for (size_t i = 0; i <= inner.size(); ++i) {
+                if (i < inner.size() && ((inner[i] != '+' && inner[i] != '-') || term.empty())) { term += inner[i]; continue; }
+                if (term.empty()) fail();
+                term = lower(term[0] == '+' ? term.substr(1) : term);
+                size_t star = term.find('*');
+                MOperand r;
+                if (star != std::string::npos) {
+                    std::string reg = trim(term.substr(0, star)), factor = trim(term.substr(star + 1));
+                    if (!registerOperand(reg, r)) std::swap(reg, factor);
+                    if (!registerOperand(reg, r) || r.kind != MOperand::Reg || !number(factor, v) || o.index != NoReg) fail();
+                    o.index = r.reg;
+                    o.scale = static_cast<int>(v);
+                } else if (registerOperand(term, r) && r.kind == MOperand::Reg && r.size == 64) {
+                    if (o.reg == NoReg) o.reg = r.reg;
+                    else if (o.index == NoReg) { o.index = r.reg; o.scale = 1; }
+                    else fail();
+                } else if (number(term, v)) {
+                    o.imm += v;
+                } else {
+                    fail();
+                }
+                term = i < inner.size() ? std::string(1, inner[i]) : "";
+            }
+            if (o.reg == NoReg && o.index == NoReg) fail();
+            o.size = size;
+            return o;
+        }
+        if (registerOperand(l, o)) return o;
+        if (number(t, v)) return MOperand::I(v);
+        if (t.empty()) fail();
+        return MOperand::L(qualify(t));
+    }
+
+    void line(const std::string& raw) {
+        std::string s;
+        char quote = 0;
+        for (char c : raw) {
+            if (quote) { if (c == quote) quote = 0; }
+            else if (c == '"' || c == '\'') quote = c;
+            else if (c == ';') break;
+            s += c;
+        }
+        s = trim(s);
+        if (s.empty()) return;
+        source = s;
+        size_t word = s.find_first_of(" \t:");
+        if (word != std::string::npos && s[word] == ':') {
+            define(s.substr(0, word));
+            s = trim(s.substr(word + 1));
+            if (s.empty()) return;
+        }
+        word = s.find_first_of(" \t");
+        std::string head = lower(s.substr(0, word));
+        std::string rest = word == std::string::npos ? "" : trim(s.substr(word));
+        if (head == "section") {
+            std::string name = trim(rest);
+            for (current = 0; current < SectionCount && sections[current].name != name; ++current) {}
+            if (current == SectionCount) throw std::runtime_error("assembler: unknown section '" + name + "'");
+            return;
+        }
+        if (head == "global") { symbol(rest).global = true; return; }
+        if (head == "extern") { symbol(rest).global = true; return; }
+        if (head == "default") return;
+        if (head == "align" || head == "alignb") {
+            int64_t a;
+            if (!number(rest, a) || a <= 0 || (a & (a - 1))) fail();
+            align(static_cast<uint64_t>(a));
+            return;
+        }
+        int64_t repeat = 1;
+        if (head == "times") {
+            size_t n = rest.find_first_of(" \t");
+            if (n == std::string::npos || !number(rest.substr(0, n), repeat)) fail();
+            s = trim(rest.substr(n));
+            n = s.find_first_of(" \t");
+            head = lower(s.substr(0, n));
+            rest = n == std::string::npos ? "" : trim(s.substr(n));
+        }
+        static const std::pair<const char*, int> data[] = { { "db", 1 }, { "dw", 2 }, { "dd", 4 }, { "dq", 8 } };
+        for (const auto& d : data) {
+            if (head != d.first) continue;
+            for (int64_t r = 0; r < repeat; ++r) {
+                for (const std::string& item : split(rest)) {
+                    int64_t v;
+                    if (item.size() >= 2 && item[0] == '"' && item.back() == '"') {
+                        for (size_t i = 1; i + 1 < item.size(); ++i) byte(static_cast<uint8_t>(item[i]));
+                    } else if (number(item, v)) {
+                        bytes(static_cast<uint64_t>(v), d.second);
+                    } else if (d.second == 8 && !item.empty()) {
+                        fixup(qualify(item), 0, FixupKind::Abs64);
+                        bytes(0, 8);
+                    } else {
+                        fail();
+                    }
+                }
+            }
+            return;
+        }
+        if (head == "resb" || head == "resq") {
+            int64_t n;
+            if (!number(rest, n) || n < 0) fail();
+            uint64_t total = static_cast<uint64_t>(n * repeat * (head == "resq" ? 8 : 1));
+            if (current == Bss) fragment().zeros += total;
+            else for (uint64_t i = 0; i < total; ++i) byte(0);
+            return;
+        }
+        if (repeat != 1) fail();
+        MInst in;
+        in.op = head;
+        if (head == "rep") { in.op = "rep " + lower(rest); rest.clear(); }
+        if (!rest.empty()) for (const std::string& o : split(rest)) in.ops.push_back(operand(o));
+        encode(in);
+    }
+
+    // -- Encoding -------------------------------------------------------------
+
+    // REX for a ModRM instruction; `force` emits an empty one, which spl/bpl/sil/dil need.
+    void rex(bool w, int reg, const MOperand& rm, bool force) {
+        int b = 0, x = 0;
+        if (rm.kind == MOperand::Mem) {
+            if (rm.reg != NoReg) b = rm.reg >> 3;
+            if (rm.index != NoReg) x = rm.index >> 3;
+        } else {
+            b = rm.reg >> 3;
+        }
+        uint8_t v = static_cast<uint8_t>(0x40 | (w ? 8 : 0) | ((reg >> 3) & 1) << 2 | x << 1 | b);
+        if (v != 0x40 || force) byte(v);
+    }
+    // ModRM, SIB and displacement. A rip-relative displacement counts from the end of the
+    // instruction, so `trailing` immediate bytes still to come move the addend; `n` is the EVEX
+    // disp8*N scale.
+    void modrm(int reg, const MOperand& rm, int trailing, int n = 1) {
+        reg &= 7;
+        if (rm.kind == MOperand::Reg || rm.kind == MOperand::Vec) { byte(static_cast<uint8_t>(0xC0 | reg << 3 | (rm.reg & 7))); return; }
+        if (rm.kind != MOperand::Mem) fail();
+        if (rm.reg == NoReg && rm.index == NoReg) {
+            byte(static_cast<uint8_t>(0x05 | reg << 3));
+            fixup(rm.sym, rm.imm - 4 - trailing, FixupKind::Rel32);
+            bytes(0, 4);
+            return;
+        }
+        int64_t disp = rm.imm;
+        if (!fitsInt32(disp)) fail();
+        int scale = rm.scale == 1 ? 0 : rm.scale == 2 ? 1 : rm.scale == 4 ? 2 : rm.scale == 8 ? 3 : -1;
+        if (rm.index != NoReg && (scale < 0 || rm.index == RSP)) fail();
+        if (rm.reg == NoReg) {
+            byte(static_cast<uint8_t>(0x04 | reg << 3));
+            byte(static_cast<uint8_t>(scale << 6 | (rm.index & 7) << 3 | 5));
+            bytes(static_cast<uint64_t>(disp), 4);
+            return;
+        }
+        int mod = disp == 0 && (rm.reg & 7) != RBP ? 0 : disp % n == 0 && fitsInt8(disp / n) ? 1 : 2;
+        bool sib = rm.index != NoReg || (rm.reg & 7) == RSP;
+        byte(static_cast<uint8_t>(mod << 6 | reg << 3 | (sib ? 4 : rm.reg & 7)));
+        if (sib) byte(static_cast<uint8_t>((rm.index == NoReg ? 0 : scale) << 6 | (rm.index == NoReg ? 4 : rm.index & 7) << 3 | (rm.reg & 7)));
+        if (mod == 1) byte(static_cast<uint8_t>(disp / n));
+        else if (mod == 2) bytes(static_cast<uint64_t>(disp), 4);
+    }
+    // General-purpose instruction: [REX] opcode ModRM [imm].
+    void legacy(bool w, std::initializer_list<uint8_t> opcode, int reg, const MOperand& rm, int immBytes = 0, int64_t imm = 0,
+                bool force = false) {
+        rex(w, reg, rm, force);
+        for (uint8_t b : opcode) byte(b);
+        modrm(reg, rm, immBytes);
+        bytes(static_cast<uint64_t>(imm), immBytes);
+    }
+    // VEX (xmm/ymm) or EVEX (zmm) instruction. `pp`: 0 none, 1 = 66, 2 = F3; `map`: 1 = 0F,
+    // 2 = 0F38; `vvvv` is the extra source register (0 when unused); `n` is the EVEX disp8 scale.
+    void vex(int pp, int map, bool w, int bits, int reg, int vvvv, const MOperand& rm, uint8_t opcode, int n = 1,
+             int immBytes = 0, int64_t imm = 0) {
+        int b = 0, x = 0;
+        if (rm.kind == MOperand::Mem) {
+            if (rm.reg != NoReg) b = rm.reg >> 3;
+            if (rm.index != NoReg) x = rm.index >> 3;
+        } else {
+            b = rm.reg >> 3;
+        }
+        int r = (reg >> 3) & 1, l = bits == 256 ? 1 : 0;
+        if (bits == 512) {
+            byte(0x62);
+            byte(static_cast<uint8_t>(!r << 7 | !x << 6 | !b << 5 | 1 << 4 | map));      // R' set: registers below 16
+            byte(static_cast<uint8_t>((w ? 0x80 : 0) | (~vvvv & 15) << 3 | 4 | pp));
+            byte(0x48);                                                                // L'L = 512 bits, V' set, no mask
+        } else if (!x && !b && !w && map == 1) {
+            byte(0xC5);
+            byte(static_cast<uint8_t>(!r << 7 | (~vvvv & 15) << 3 | l << 2 | pp));
+        } else {
+            byte(0xC4);
+            byte(static_cast<uint8_t>(!r << 7 | !x << 6 | !b << 5 | map));
+            byte(static_cast<uint8_t>((w ? 0x80 : 0) | (~vvvv & 15) << 3 | l << 2 | pp));
+        }
+        byte(opcode);
+        modrm(reg, rm, immBytes, bits == 512 ? n : 1);
+        bytes(static_cast<uint64_t>(imm), immBytes);
+    }
+    // SSE form: [66/F3] [REX] 0F [38] opcode ModRM [imm].
+    void sse(int prefix, bool w, int map, uint8_t opcode, int reg, const MOperand& rm, int immBytes = 0, int64_t imm = 0) {
+        byte(static_cast<uint8_t>(prefix));
+        rex(w, reg, rm, false);
+        byte(0x0F);
+        if (map == 2) byte(0x38);
+        byte(opcode);
+        modrm(reg, rm, immBytes);
+        bytes(static_cast<uint64_t>(imm), immBytes);
+    }
+
+    void encode(const MInst& in);
+    bool encodeVector(const MInst& in);
+
+    // Lays out every section: fragments start at their alignment and short branches whose
+    // targets are out of rel8 reach (or in another section) grow until nothing changes.
+    void finish() {
+        if (finished) return;
+        if (!pending.empty()) { line(pending); pending.clear(); }
+        finished = true;
+        for (int s = 0; s < SectionCount; ++s) {
+            Section& sec = sections[s];
+            for (bool changed = true; changed;) {
+                changed = false;
+                uint64_t at = 0;
+                for (Fragment& f : sec.fragments) {
+                    at = alignUp(at, f.align);
+                    f.start = at;
+                    at += f.size();
+                }
+                sec.size = at;
+                for (Fragment& f : sec.fragments) {
+                    if (f.branch < 0 || f.wide) continue;
+                    const Symbol& t = symbols[f.target];
+                    int64_t disp = t.defined && t.section == s
+                        ? static_cast<int64_t>(sec.fragments[t.fragment].start + t.offset) - static_cast<int64_t>(f.start + f.size())
+                        : 1 << 20;
+                    if (!fitsInt8(disp)) { f.wide = true; changed = true; }
+                }
+            }
+            for (size_t i = 0; i < sec.fragments.size(); ++i) {
+                const Fragment& f = sec.fragments[i];
+                if (f.branch < 0) continue;
+                const Symbol& t = symbols[f.target];
+                if (!t.defined || t.section != s)
+                    fixups.push_back({ s, i, f.bytes.size() + (f.branch == 16 ? 1 : 2), f.target, -4, FixupKind::Rel32 });
+            }
+        }
+    }
+    // Section contents with padding and branches filled in (references to other sections are
+    // left as zero for the fixups).
+    std::vector<uint8_t> image(int s) const {
+        const Section& sec = sections[s];
+        std::vector<uint8_t> out;
+        if (s == Bss) return out;
+        out.reserve(sec.size);
+        for (const Fragment& f : sec.fragments) {
+            out.resize(f.start, s == Text ? 0x90 : 0);
+            out.insert(out.end(), f.bytes.begin(), f.bytes.end());
+            if (f.branch < 0) continue;
+            auto t = symbols.find(f.target);
+            int64_t disp = 0;
+            if (t->second.defined && t->second.section == s)
+                disp = static_cast<int64_t>(sec.fragments[t->second.fragment].start + t->second.offset) -
+                       static_cast<int64_t>(f.start + f.size());
+            if (!f.wide) {
+                out.push_back(static_cast<uint8_t>(f.branch == 16 ? 0xEB : 0x70 + f.branch));
+                out.push_back(static_cast<uint8_t>(disp));
+                continue;
+            }
+            if (f.branch == 16) out.push_back(0xE9);
+            else { out.push_back(0x0F); out.push_back(static_cast<uint8_t>(0x80 + f.branch)); }
+            put(out, out.size(), static_cast<uint64_t>(disp), 4);
+        }
+        out.resize(sec.size, s == Text ? 0x90 : 0);
+        return out;
+    }
+
+    const Symbol* resolve(const std::string& name) const {
+        auto it = symbols.find(name);
+        return it == symbols.end() || !it->second.defined ? nullptr : &it->second;
+    }
+    uint64_t address(const Symbol& s) const { return sections[s.section].address + sections[s.section].fragments[s.fragment].start + s.offset; }
+
+    static void put(std::vector<uint8_t>& out, uint64_t at, uint64_t v, int n) {
+        if (out.size() < at + n) out.resize(at + n);
+        for (int i = 0; i < n; ++i) out[at + i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+    void patchRel32(std::vector<uint8_t>& out, uint64_t at, int64_t v) const {
+        if (!fitsInt32(v)) throw std::runtime_error("assembler: displacement out of range");
+        put(out, at, static_cast<uint64_t>(v), 4);
+    }
+    static void append(std::vector<uint8_t>& table, const std::string& s) {
+        table.insert(table.end(), s.begin(), s.end());
+        table.push_back(0);
+    }
+    static uint64_t sectionFlags(int s) { return s == Text ? 0x6 : s == Rodata ? 0x2 : 0x3; }   // ALLOC | EXECINSTR / WRITE
+
+    // -g: DWARF 4 for one compile unit covering .text: .debug_abbrev, .debug_info and a
+    // .debug_line program with a row wherever the NODE line changes. `fixups` gets the fields
+    // an object file must relocate, against .text (-1) or another of these sections.
+    struct DebugFixup { int section; uint64_t offset; int target; int size; };
+    static constexpr const char* debugNames[3] = { ".debug_abbrev", ".debug_info", ".debug_line" };
+
+    static void uleb(std::vector<uint8_t>& out, uint64_t v) {
+        do {
+            uint8_t b = v & 0x7F;
+            v >>= 7;
+            out.push_back(static_cast<uint8_t>(b | (v ? 0x80 : 0)));
+        } while (v);
+    }
+    static void sleb(std::vector<uint8_t>& out, int64_t v) {
+        for (bool more = true; more;) {
+            uint8_t b = v & 0x7F;
+            v >>= 7;
+            more = !((v == 0 && !(b & 0x40)) || (v == -1 && (b & 0x40)));
+            out.push_back(static_cast<uint8_t>(b | (more ? 0x80 : 0)));
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> debugSections(uint64_t textAddress, std::vector<DebugFixup>& fixups) const {
+        // compile_unit, no children: producer, name (string), stmt_list (sec_offset), low_pc (addr),
+        // high_pc (data8, a length)
+        std::vector<uint8_t> abbrev = { 1, 0x11, 0, 0x25, 0x08, 0x03, 0x08, 0x10, 0x17, 0x11, 0x01, 0x12, 0x07, 0, 0, 0 };
+
+        std::vector<uint8_t> info(11, 0);
+        put(info, 4, 4, 2);                                   // version; abbrev offset 0 at 6
+        info[10] = 8;                                         // address size
+        fixups.push_back({ 1, 6, 0, 4 });
+        info.push_back(1);
+        append(info, "nodec");
+        append(info, debugSource);
+        fixups.push_back({ 1, info.size(), 2, 4 });
+        put(info, info.size(), 0, 4);
+        fixups.push_back({ 1, info.size(), -1, 8 });
+        put(info, info.size(), textAddress, 8);
+        put(info, info.size(), sections[Text].size, 8);
+        put(info, 0, info.size() - 4, 4);
+
+        // Header: line_base -5, line_range 14, opcode_base 13, no include directories, one file.
+        std::vector<uint8_t> line(10, 0);
+        put(line, 4, 4, 2);
+        line.insert(line.end(), { 1, 1, 1, static_cast<uint8_t>(-5), 14, 13, 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1, 0 });
+        append(line, debugSource);
+        line.insert(line.end(), { 0, 0, 0, 0 });
+        put(line, 6, line.size() - 10, 4);
+
+        // Rows at the same address keep only the last one.
+        std::vector<std::pair<uint64_t, int>> rows;
+        for (const LineRow& row : lineRows) {
+            uint64_t at = sections[Text].fragments[row.fragment].start + row.offset;
+            if (!rows.empty() && rows.back().first == at) rows.pop_back();
+            if (rows.empty() ? row.line != 0 : rows.back().second != row.line) rows.push_back({ at, row.line });
+        }
+        uint64_t address = rows.empty() ? 0 : rows.front().first;
+        int64_t current = 1;
+        line.insert(line.end(), { 0, 9, 2 });                // DW_LNE_set_address
+        fixups.push_back({ 2, line.size(), -1, 8 });
+        put(line, line.size(), textAddress + address, 8);
+        for (const auto& row : rows) {
+            uint64_t advance = row.first - address;
+            int64_t delta = row.second - current;
+            uint64_t special = static_cast<uint64_t>(delta + 5) + 14 * advance + 13;
+            if (delta >= -5 && delta < 9 && special <= 255) {
+                line.push_back(static_cast<uint8_t>(special));
+            } else {
+                if (advance) { line.push_back(2); uleb(line, advance); }      // DW_LNS_advance_pc
+                if (delta) { line.push_back(3); sleb(line, delta); }          // DW_LNS_advance_line
+                line.push_back(1);                                            // DW_LNS_copy
+            }
+            address = row.first;
+            current = row.second;
+        }
+        if (sections[Text].size > address) { line.push_back(2); uleb(line, sections[Text].size - address); }
+        line.insert(line.end(), { 0, 1, 1 });                // DW_LNE_end_sequence
+        put(line, 0, line.size() - 4, 4);
+        return { abbrev, info, line };
+    }
+
+    // Section symbols for the headers in `sectionSymbols`, then locals, then globals and externs;
+    // returns the index of the first global.
+    int symbolTable(std::vector<uint8_t>& symtab, std::vector<uint8_t>& strtab, const std::vector<int>& present, bool linked,
+                    const std::vector<int>& sectionSymbols = {}) {
+        symtab.assign(24, 0);
+        int index = 1, locals = 1;
+        for (int header : sectionSymbols) {
+            put(symtab, symtab.size(), 0, 4);
+            symtab.push_back(3);                                                // STB_LOCAL, STT_SECTION
+            symtab.push_back(0);
+            put(symtab, symtab.size(), static_cast<uint64_t>(header), 2);
+            put(symtab, symtab.size(), 0, 8);
+            put(symtab, symtab.size(), 0, 8);
+            index++;
+        }
+        for (int pass = 0; pass < 2; ++pass) {
+            for (const std::string& name : symbolOrder) {
+                const Symbol& s = symbols[name];
+                if (s.global != (pass == 1) || (!s.defined && !s.global)) continue;
+                uint64_t at = symtab.size();
+                put(symtab, at, strtab.size(), 4);
+                append(strtab, name);
+                symtab.push_back(static_cast<uint8_t>(s.global ? 0x10 : 0));    // STB_GLOBAL / STB_LOCAL, STT_NOTYPE
+                symtab.push_back(0);
+                int shndx = 0;
+                if (s.defined) shndx = static_cast<int>(std::find(present.begin(), present.end(), s.section) - present.begin()) + 1;
+                put(symtab, symtab.size(), static_cast<uint64_t>(shndx), 2);
+                put(symtab, symtab.size(), s.defined ? (linked ? address(s) : sections[s.section].fragments[s.fragment].start + s.offset) : 0, 8);
+                put(symtab, symtab.size(), 0, 8);
+                symbolIndex[name] = index++;
+            }
+            if (pass == 0) locals = index;
+        }
+        return locals;
+    }
+    static void sectionHeader(std::vector<uint8_t>& headers, std::vector<uint8_t>& shstrtab, const std::string& name, uint32_t type,
+                              uint64_t flags, uint64_t addr, uint64_t offset, uint64_t size, uint32_t link, uint32_t info,
+                              uint64_t align, uint64_t entsize) {
+        uint64_t at = headers.size();
+        put(headers, at, shstrtab.size(), 4);
+        append(shstrtab, name);
+        put(headers, at + 4, type, 4);
+        put(headers, at + 8, flags, 8);
+        put(headers, at + 16, addr, 8);
+        put(headers, at + 24, offset, 8);
+        put(headers, at + 32, size, 8);
+        put(headers, at + 40, link, 4);
+        put(headers, at + 44, info, 4);
+        put(headers, at + 48, align, 8);
+        put(headers, at + 56, entsize, 8);
+    }
+    static void elfHeader(std::vector<uint8_t>& file, int type, uint64_t entry, uint64_t phoff, int phnum, uint64_t shoff,
+                          int shnum, int shstrndx) {
+        static const uint8_t ident[16] = { 0x7F, 'E', 'L', 'F', 2, 1, 1 };    // 64-bit, little-endian, SysV
+        std::copy(ident, ident + 16, file.begin());
+        put(file, 16, static_cast<uint64_t>(type), 2);
+        put(file, 18, 62, 2);                                                  // EM_X86_64
+        put(file, 20, 1, 4);
+        put(file, 24, entry, 8);
+        put(file, 32, phoff, 8);
+        put(file, 40, shoff, 8);
+        put(file, 48, 0, 4);
+        put(file, 52, 64, 2);
+        put(file, 54, phnum ? 56 : 0, 2);
+        put(file, 56, static_cast<uint64_t>(phnum), 2);
+        put(file, 58, 64, 2);
+        put(file, 60, static_cast<uint64_t>(shnum), 2);
+        put(file, 62, static_cast<uint64_t>(shstrndx), 2);
+    }
+    static void programHeader(std::vector<uint8_t>& file, uint64_t& at, uint32_t flags, uint64_t offset, uint64_t vaddr,
+                              uint64_t filesz, uint64_t memsz) {
+        put(file, at, 1, 4);                                                   // PT_LOAD
+        put(file, at + 4, flags, 4);
+        put(file, at + 8, offset, 8);
+        put(file, at + 16, vaddr, 8);
+        put(file, at + 24, vaddr, 8);
+        put(file, at + 32, filesz, 8);
+        put(file, at + 40, memsz, 8);
+        put(file, at + 48, 0x1000, 8);
+        at += 56;
+    }
+    static void writeFile(const std::string& path, const std::vector<uint8_t>& file, bool executable) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+        if (!out) throw std::runtime_error("cannot write " + path);
+        out.close();
+#if defined(__unix__) || defined(__APPLE__)
+        if (executable) chmod(path.c_str(), 0755);
+#else
+        (void)executable;
+#endif
+    }
+};
+
+void Assembler::encode(const MInst& in) {
+    const std::string& op = in.op;
+    const std::vector<MOperand>& a = in.ops;
+    size_t n = a.size();
+    auto is = [&](size_t i, MOperand::Kind k) { return i < n && a[i].kind == k; };
+    // Operand width from the first register, else from the memory operand (qword unless sized).
+    int width = 64;
+    bool force = false;
+    for (const MOperand& o : a) if (o.kind == MOperand::Mem) width = o.size;
+    for (size_t i = n; i-- > 0;) if (a[i].kind == MOperand::Reg) width = a[i].size;
+    for (const MOperand& o : a) if (o.kind == MOperand::Reg && o.size == 8 && o.reg >= RSP && o.reg <= RDI) force = true;
+    bool w = width == 64, b8 = width == 8;
+
+    static const std::pair<const char*, std::vector<uint8_t>> fixed[] = {
+        { "ret", { 0xC3 } }, { "leave", { 0xC9 } }, { "nop", { 0x90 } }, { "int3", { 0xCC } }, { "hlt", { 0xF4 } },
+        { "syscall", { 0x0F, 0x05 } }, { "cpuid", { 0x0F, 0xA2 } }, { "xgetbv", { 0x0F, 0x01, 0xD0 } }, { "ud2", { 0x0F, 0x0B } },
+        { "cqo", { 0x48, 0x99 } }, { "cdq", { 0x99 } }, { "rep stosq", { 0xF3, 0x48, 0xAB } }, { "rep stosb", { 0xF3, 0xAA } },
+        { "rep movsb", { 0xF3, 0xA4 } },
+        { "vzeroupper", { 0xC5, 0xF8, 0x77 } },
+    };
+    if (n == 0) {
+        for (const auto& f : fixed) {
+            if (op != f.first) continue;
+            for (uint8_t c : f.second) byte(c);
+            return;
+        }
+    }
+    if (op == "int" && n == 1) {
+        // `int 3` is CD 03 as in nasm; only the mnemonic `int3` is the one-byte CC.
+        if (!is(0, MOperand::Imm) || a[0].imm < 0 || a[0].imm > 255) fail();
+        byte(0xCD);
+        byte(static_cast<uint8_t>(a[0].imm));
+        return;
+    }
+    if (width != 8 && width != 32 && width != 64 && !encodeVector(in)) fail();
+    if (width != 8 && width != 32 && width != 64) return;
+
+    if (op == "jmp" || op == "call") {
+        if (n != 1) fail();
+        if (is(0, MOperand::Label)) {
+            if (op == "jmp") { branch(16, a[0].sym); return; }
+            byte(0xE8);
+            fixup(a[0].sym, -4, FixupKind::Rel32);
+            bytes(0, 4);
+            return;
+        }
+        legacy(false, { 0xFF }, op == "jmp" ? 4 : 2, a[0]);
+        return;
+    }
+    if (op[0] == 'j' && n == 1 && is(0, MOperand::Label)) {
+        int cc = conditionCode(op.substr(1));
+        if (cc < 0) fail();
+        branch(cc, a[0].sym);
+        return;
+    }
+    if (op.compare(0, 3, "set") == 0 && n == 1 && a[0].kind != MOperand::Label) {
+        int cc = conditionCode(op.substr(3));
+        if (cc < 0 || width != 8) fail();
+        legacy(false, { 0x0F, static_cast<uint8_t>(0x90 + cc) }, 0, a[0], 0, 0, force);
+        return;
+    }
+    if (op == "mov" && n == 2) {
+        if (is(1, MOperand::Imm)) {
+            int64_t v = a[1].imm;
+            if (is(0, MOperand::Reg)) {
+                int r = a[0].reg;
+                if (b8) {
+                    rex(false, 0, a[0], force);
+                    byte(static_cast<uint8_t>(0xB0 + (r & 7)));
+                    bytes(static_cast<uint64_t>(v), 1);
+                } else if (width == 32 || (v >= 0 && v <= UINT32_MAX)) {     // zero-extends into the full register
+                    if (r >= R8) byte(0x41);
+                    byte(static_cast<uint8_t>(0xB8 + (r & 7)));
+                    bytes(static_cast<uint64_t>(v), 4);
+                } else if (fitsInt32(v)) {
+                    legacy(true, { 0xC7 }, 0, a[0], 4, v);
+                } else {
+                    byte(static_cast<uint8_t>(0x48 | r >> 3));
+                    byte(static_cast<uint8_t>(0xB8 + (r & 7)));
+                    bytes(static_cast<uint64_t>(v), 8);
+                }
+                return;
+            }
+            if (!is(0, MOperand::Mem) || (!b8 && !fitsInt32(v))) fail();
+            legacy(w, { static_cast<uint8_t>(b8 ? 0xC6 : 0xC7) }, 0, a[0], b8 ? 1 : 4, v);
+            return;
+        }
+        if (is(1, MOperand::Reg) && (is(0, MOperand::Reg) || is(0, MOperand::Mem))) {
+            legacy(w, { static_cast<uint8_t>(b8 ? 0x88 : 0x89) }, a[1].reg, a[0], 0, 0, force);
+            return;
+        }
+        if (is(0, MOperand::Reg) && is(1, MOperand::Mem)) {
+            legacy(w, { static_cast<uint8_t>(b8 ? 0x8A : 0x8B) }, a[0].reg, a[1], 0, 0, force);
+            return;
+        }
+        if (!encodeVector(in)) fail();
+        return;
+    }
+    for (const AluEncoding& e : aluEncodings) {
+        if (op != e.op) continue;
+        if (n != 2) fail();
+        if (is(1, MOperand::Imm)) {
+            int64_t v = a[1].imm;
+            if (b8) legacy(false, { 0x80 }, e.digit, a[0], 1, v, force);
+            else if (fitsInt8(v)) legacy(w, { 0x83 }, e.digit, a[0], 1, v);
+            else if (!fitsInt32(v)) fail();
+            else if (a[0].isReg(RAX)) { if (w) byte(0x48); byte(static_cast<uint8_t>(e.opcode + 4)); bytes(static_cast<uint64_t>(v), 4); }
+            else legacy(w, { 0x81 }, e.digit, a[0], 4, v);
+        } else if (is(1, MOperand::Reg) && (is(0, MOperand::Reg) || is(0, MOperand::Mem))) {
+            legacy(w, { static_cast<uint8_t>(e.opcode - b8) }, a[1].reg, a[0], 0, 0, force);
+        } else if (is(0, MOperand::Reg) && is(1, MOperand::Mem)) {
+            legacy(w, { static_cast<uint8_t>(e.opcode + 2 - b8) }, a[0].reg, a[1], 0, 0, force);
+        } else {
+            fail();
+        }
+        return;
+    }
+    if (op == "test" && n == 2) {
+        if (is(1, MOperand::Imm)) {
+            if (a[0].isReg(RAX) && !b8) { if (w) byte(0x48); byte(0xA9); bytes(static_cast<uint64_t>(a[1].imm), 4); }
+            else legacy(w, { static_cast<uint8_t>(b8 ? 0xF6 : 0xF7) }, 0, a[0], b8 ? 1 : 4, a[1].imm, force);
+        } else if (is(1, MOperand::Reg)) {
+            legacy(w, { static_cast<uint8_t>(b8 ? 0x84 : 0x85) }, a[1].reg, a[0], 0, 0, force);
+        } else if (is(0, MOperand::Reg) && is(1, MOperand::Mem)) {
+            legacy(w, { static_cast<uint8_t>(b8 ? 0x84 : 0x85) }, a[0].reg, a[1], 0, 0, force);   // test is symmetric
+        } else {
+            fail();
+        }
+        return;
+    }
+    if (op == "imul" && n >= 2) {
+        if (!is(0, MOperand::Reg) || b8) fail();
+        const MOperand& src = n == 3 || !is(1, MOperand::Imm) ? a[1] : a[0];
+        const MOperand* imm = n == 3 ? &a[2] : is(1, MOperand::Imm) ? &a[1] : nullptr;
+        if (!imm) { legacy(w, { 0x0F, 0xAF }, a[0].reg, src); return; }
+        if (imm->kind != MOperand::Imm || !fitsInt32(imm->imm)) fail();
+        if (fitsInt8(imm->imm)) legacy(w, { 0x6B }, a[0].reg, src, 1, imm->imm);
+        else legacy(w, { 0x69 }, a[0].reg, src, 4, imm->imm);
+        return;
+    }
+    for (const auto& e : unaryEncodings) {
+        if (op != e.first || n != 1) continue;
+        legacy(w, { static_cast<uint8_t>(b8 ? 0xF6 : 0xF7) }, e.second, a[0], 0, 0, force);
+        return;
+    }
+    if ((op == "inc" || op == "dec") && n == 1) {
+        legacy(w, { static_cast<uint8_t>(b8 ? 0xFE : 0xFF) }, op == "dec", a[0], 0, 0, force);
+        return;
+    }
+    for (const auto& e : shiftEncodings) {
+        if (op != e.first || n != 2) continue;
+        if (is(1, MOperand::Imm) && a[1].imm == 1) legacy(w, { static_cast<uint8_t>(b8 ? 0xD0 : 0xD1) }, e.second, a[0], 0, 0, force);
+        else if (is(1, MOperand::Imm)) legacy(w, { static_cast<uint8_t>(b8 ? 0xC0 : 0xC1) }, e.second, a[0], 1, a[1].imm, force);
+        else if (a[1].isReg(RCX) && a[1].size == 8) legacy(w, { static_cast<uint8_t>(b8 ? 0xD2 : 0xD3) }, e.second, a[0], 0, 0, force);
+        else fail();
+        return;
+    }
+    if ((op == "push" || op == "pop") && n == 1) {
+        bool push = op == "push";
+        if (is(0, MOperand::Reg) && width == 64) {
+            if (a[0].reg >= R8) byte(0x41);
+            byte(static_cast<uint8_t>((push ? 0x50 : 0x58) + (a[0].reg & 7)));
+        } else if (is(0, MOperand::Mem)) {
+            legacy(false, { static_cast<uint8_t>(push ? 0xFF : 0x8F) }, push ? 6 : 0, a[0]);
+        } else if (push && is(0, MOperand::Imm) && fitsInt32(a[0].imm)) {
+            byte(fitsInt8(a[0].imm) ? 0x6A : 0x68);
+            bytes(static_cast<uint64_t>(a[0].imm), fitsInt8(a[0].imm) ? 1 : 4);
+        } else {
+            fail();
+        }
+        return;
+    }
+    if (op == "lea" && n == 2 && is(0, MOperand::Reg) && is(1, MOperand::Mem)) {
+        legacy(w, { 0x8D }, a[0].reg, a[1]);
+        return;
+    }
+    if (op == "movzx" && n == 2 && is(0, MOperand::Reg) && a[1].size == 8 && a[1].kind != MOperand::Imm) {
+        legacy(w, { 0x0F, 0xB6 }, a[0].reg, a[1], 0, 0, force);
+        return;
+    }
+    if (op == "xchg" && n == 2 && is(1, MOperand::Reg)) {
+        legacy(w, { static_cast<uint8_t>(b8 ? 0x86 : 0x87) }, a[1].reg, a[0], 0, 0, force);
+        return;
+    }
+    if (!encodeVector(in)) fail();
+}
+
+bool Assembler::encodeVector(const MInst& in) {
+    const std::string& op = in.op;
+    const std::vector<MOperand>& a = in.ops;
+    size_t n = a.size();
+    bool v = op[0] == 'v';
+    for (const VectorMoveEncoding& e : vectorMoveEncodings) {
+        if (op != e.op) continue;
+        if (n != 2) fail();
+        bool store = a[0].kind == MOperand::Mem;
+        const MOperand& reg = store ? a[1] : a[0];
+        const MOperand& rm = store ? a[0] : a[1];
+        uint8_t opcode = store ? 0x7F : 0x6F;
+        if (reg.kind != MOperand::Vec || (rm.kind != MOperand::Vec && rm.kind != MOperand::Mem)) fail();
+        if (!v) {
+            if (reg.size != 128) fail();
+            sse(e.pp == 1 ? 0x66 : 0xF3, false, 1, opcode, reg.reg, rm);
+        } else if (reg.size == 512) {
+            if (e.evexW < 0) fail();
+            vex(e.pp, 1, e.evexW == 1, 512, reg.reg, 0, rm, opcode, 64);
+        } else {
+            if (e.evexW >= 0) fail();
+            vex(e.pp, 1, false, reg.size, reg.reg, 0, rm, opcode);
+        }
+        return true;
+    }
+    for (const PackedEncoding& e : packedEncodings) {
+        if (op != e.op) continue;
+        if (!v) {
+            if (n != 2 || a[0].kind != MOperand::Vec || a[0].size != 128) fail();
+            sse(0x66, false, e.map, e.opcode, a[0].reg, a[1]);
+        } else {
+            if (n != 3 || a[0].kind != MOperand::Vec || a[1].kind != MOperand::Vec) fail();
+            if (a[0].size == 512 && e.evexW < 0) fail();
+            vex(1, e.map, a[0].size == 512 && e.evexW == 1, a[0].size, a[0].reg, a[1].reg, a[2], e.opcode, 64);
+        }
+        return true;
+    }
+    if (op == "psrlq" || op == "psllq" || op == "vpsrlq" || op == "vpsllq") {
+        int digit = op.find("srl") != std::string::npos ? 2 : 6;
+        if (!v && n == 2 && a[0].kind == MOperand::Vec && a[1].kind == MOperand::Imm) {
+            sse(0x66, false, 1, 0x73, digit, a[0], 1, a[1].imm);
+            return true;
+        }
+        if (!v || n != 3 || a[0].kind != MOperand::Vec || a[1].kind != MOperand::Vec || a[2].kind != MOperand::Imm) fail();
+        vex(1, 1, a[0].size == 512, a[0].size, digit, a[0].reg, a[1], 0x73, 64, 1, a[2].imm);
+        return true;
+    }
+    if (op == "movq" || op == "vmovq") {
+        if (n != 2) fail();
+        bool toVector = a[0].kind == MOperand::Vec;
+        const MOperand& reg = toVector ? a[0] : a[1];
+        const MOperand& rm = toVector ? a[1] : a[0];
+        if (reg.kind != MOperand::Vec || reg.size != 128 || rm.kind == MOperand::Vec) fail();
+        uint8_t opcode = toVector ? 0x6E : 0x7E;
+        if (v) vex(1, 1, true, 128, reg.reg, 0, rm, opcode);
+        else sse(0x66, true, 1, opcode, reg.reg, rm);
+        return true;
+    }
+    if (op == "vpbroadcastq") {
+        if (n != 2 || a[0].kind != MOperand::Vec) fail();
+        if (a[1].kind == MOperand::Reg) {
+            if (a[0].size != 512) fail();
+            vex(1, 2, true, 512, a[0].reg, 0, a[1], 0x7C);
+        } else if (a[0].size == 512) {
+            vex(1, 2, true, 512, a[0].reg, 0, a[1], 0x59, 8);
+        } else {
+            vex(1, 2, false, a[0].size, a[0].reg, 0, a[1], 0x59);
+        }
+        return true;
+    }
+    return false;
+}
+
+// -----------------------------
+// NASM EMITTER
+// -----------------------------
+
+struct CompileStats {
+    int functions = 0, intervals = 0, spilled = 0, calleeSaved = 0;
+    int instructions = 0, memoryOps = 0;
+    uint64_t textBytes = 0;         // NASM text written by the encode and emit phases
+    double routineSeconds = 0;      // wall time of the per-routine phases, isel to encode
+    PeepholeStats peephole;
+    ScheduleStats schedule;
+    std::vector<int> selected = std::vector<int>(selectionRuleCount, 0);   // trees covered per rule
+
+    void add(const CompileStats& o) {
+        functions += o.functions;
+        intervals += o.intervals;
+        spilled += o.spilled;
+        calleeSaved += o.calleeSaved;
+        instructions += o.instructions;
+        memoryOps += o.memoryOps;
+        for (size_t r = 0; r < peephole.hits.size(); ++r) peephole.hits[r] += o.peephole.hits[r];
+        schedule.regions += o.schedule.regions;
+        schedule.reordered += o.schedule.reordered;
+        schedule.moved += o.schedule.moved;
+        schedule.cyclesBefore += o.schedule.cyclesBefore;
+        schedule.cyclesAfter += o.schedule.cyclesAfter;
+        for (size_t r = 0; r < selected.size(); ++r) selected[r] += o.selected[r];
+    }
+};
+
+// Where emitted code goes: NASM text (output.asm, or nasm's input), the built-in assembler, or
+// both. Text reaches the assembler piece by piece; lowered instructions skip the printing.
+struct CodeSink {
+    EmitBuffer* text = nullptr;
+    Assembler* machine = nullptr;
+
+    CodeSink& operator<<(const std::string& s) {
+        if (text) *text << s;
+        if (machine) machine->Feed(s);
+        return *this;
+    }
+    CodeSink& operator<<(const char* s) {
+        if (text) *text << s;
+        if (machine) machine->Feed(s);
+        return *this;
+    }
+    CodeSink& operator<<(char c) {
+        if (text) *text << c;
+        if (machine) machine->Feed(std::string(1, c));
+        return *this;
+    }
+    CodeSink& operator<<(unsigned char c) { return *this << static_cast<char>(c); }
+    template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+    CodeSink& operator<<(T v) {
+        if (text) *text << v;
+        if (machine) machine->Feed(std::to_string(v));
+        return *this;
+    }
+
+    void inst(const MInst& in) {
+        if (text) printInst(*text, in);
+        if (machine) machine->Encode(in);
+    }
+};
+
+static void emitStringData(CodeSink& out, const std::string& symbol, const std::string& value) {
+    out << "    " << symbol << ": db ";
+    bool inQuote = false;
+    for (unsigned char c : value) {
+        if (c >= 32 && c < 127 && c != '"') {
+            if (!inQuote) { out << "\""; inQuote = true; }
+            out << c;
+        } else {
+            if (inQuote) { out << "\", "; inQuote = false; }
+            out << static_cast<int>(c) << ", ";
+        }
+    }
+    if (inQuote) out << "\", ";
+    out << "0\n";
+}
+
+// The runtime library. Each entry is one routine with its data and the runtime routines it
+// calls or jumps to, which always come earlier in the table. A program carries only the closure
+// of the routines its code references; --emit-runtime builds the same entries into
+// libnoderuntime.a, one object per routine, for `ld --gc-sections`.
+struct RuntimeRoutine {
+    const char* name;
+    const char* uses[2];
+    const char* text;
+};
+
+// Buffers come straight from mmap: a 64-byte header (mapping size, element count) keeps the
+// payload aligned for the widest vector loops. Failure to map goes to throw_handler.
+static const RuntimeRoutine runtimeLibrary[] = {
+    { "node_rt_new", {},
+      "node_rt_new:\n"
+      "    push rdi\n"
+      "    lea rsi, [rdi*8+64+4095]\n"
+      "    and rsi, -4096\n"
+      "    push rsi\n"
+      "    mov eax, 9\n"
+      "    xor edi, edi\n"
+      "    mov edx, 3\n"
+      "    mov r10d, 0x22\n"
+      "    mov r8, -1\n"
+      "    xor r9d, r9d\n"
+      "    syscall\n"
+      "    pop rsi\n"
+      "    pop rdi\n"
+      "    test rax, rax\n"
+      "    js throw_handler\n"
+      "    mov [rax+48], rsi\n"
+      "    mov [rax+56], rdi\n"
+      "    add rax, 64\n"
+      "    ret\n" },
+    { "node_rt_delete", {},
+      "node_rt_delete:\n"
+      "    test rdi, rdi\n"
+      "    jz .done\n"
+      "    sub rdi, 64\n"
+      "    mov rsi, [rdi+48]\n"
+      "    mov eax, 11\n"
+      "    syscall\n"
+      ".done:\n"
+      "    ret\n" },
+    // Buffers that never escape their function come from a 4 MiB bump arena. The payload is
+    // zeroed and 64-byte aligned like node_rt_new's; the two words below it hold the previous
+    // top and the element count. Functions rewind the top on return, and popping the most
+    // recent buffer rewinds it early. A full arena falls back to node_rt_new.
+    { "node_rt_arena_new", { "node_rt_new" },
+      "node_rt_arena_new:\n"
+      "    mov rax, [rel node_arena_top]\n"
+      "    lea rdx, [rax+16+63]\n"
+      "    and rdx, -64\n"
+      "    lea rcx, [rdi*8+15]\n"
+      "    and rcx, -16\n"
+      "    add rcx, rdx\n"
+      "    lea rsi, [rel node_arena_end]\n"
+      "    cmp rcx, rsi\n"
+      "    ja node_rt_new\n"
+      "    mov [rel node_arena_top], rcx\n"
+      "    mov [rdx-16], rax\n"
+      "    mov [rdx-8], rdi\n"
+      "    mov rcx, rdi\n"
+      "    mov rdi, rdx\n"
+      "    xor eax, eax\n"
+      "    rep stosq\n"
+      "    mov rax, rdx\n"
+      "    ret\n"
+      "section .data\n"
+      "node_arena_top: dq node_arena\n"
+      "section .bss\n"
+      "alignb 64\n"
+      "node_arena: resb 4194304\n"
+      "node_arena_end:\n"
+      "section .text\n" },
+    { "node_rt_bounds_fail", {},
+      "node_rt_bounds_fail:\n"
+      "    mov eax, 1\n"
+      "    mov edi, 2\n"
+      "    lea rsi, [rel node_bounds_message]\n"
+      "    mov edx, 20\n"
+      "    syscall\n"
+      "    jmp throw_handler\n"
+      "section .rodata\n"
+      "node_bounds_message: db \"index out of bounds\", 10\n"
+      "section .text\n" },
+    { "node_rt_arena_pop", { "node_rt_arena_new", "node_rt_delete" },
+      "node_rt_arena_pop:\n"
+      "    lea rax, [rel node_arena]\n"
+      "    cmp rdi, rax\n"
+      "    jb node_rt_delete\n"
+      "    lea rax, [rel node_arena_end]\n"
+      "    cmp rdi, rax\n"
+      "    jae node_rt_delete\n"
+      "    mov rax, [rdi-8]\n"
+      "    lea rax, [rax*8+15]\n"
+      "    and rax, -16\n"
+      "    add rax, rdi\n"
+      "    cmp rax, [rel node_arena_top]\n"
+      "    jne .done\n"
+      "    mov rax, [rdi-16]\n"
+      "    mov [rel node_arena_top], rax\n"
+      ".done:\n"
+      "    ret\n" },
+    // Output collects in a 64 KiB buffer and input is read 64 KiB at a time, so a print-heavy
+    // program makes one system call per buffer rather than per value.
+    { "node_rt_flush", {}, R"(
+node_rt_flush:
+    ; Writes out node_out_buf and empties it; a failed write drops what is left
+    lea rsi, [rel node_out_buf]
+    mov rdx, [rel node_out_used]
+.write:
+    test rdx, rdx
+    jz .done
+    mov eax, 1                      ; write(1, rsi, rdx)
+    mov edi, 1
+    syscall
+    cmp rax, -4                     ; EINTR
+    je .write
+    test rax, rax
+    jle .done
+    add rsi, rax
+    sub rdx, rax
+    jmp .write
+.done:
+    mov qword [rel node_out_used], 0
+    ret
+section .bss
+alignb 64
+node_out_buf: resb 65536
+node_out_used: resq 1
+section .text
+)" },
+    { "node_rt_line_end", { "node_rt_flush" }, R"(
+node_rt_line_end:
+    ; Called after a complete line is buffered; writes it out when stdout is a terminal
+    movzx eax, byte [rel node_out_tty]
+    cmp eax, 2
+    jne .tty
+    sub rsp, 72
+    mov eax, 16                     ; ioctl(1, TCGETS, rsp) succeeds only on a terminal
+    mov edi, 1
+    mov esi, 0x5401
+    mov rdx, rsp
+    syscall
+    add rsp, 72
+    xor ecx, ecx
+    test rax, rax
+    jnz .remember
+    mov ecx, 1
+.remember:
+    mov [rel node_out_tty], cl
+    mov eax, ecx
+.tty:
+    test eax, eax
+    jnz node_rt_flush
+    ret
+section .data
+node_out_tty: db 2                  ; 2 until the first line asks whether stdout is a terminal
+section .text
+)" },
+    { "print", { "node_rt_flush", "node_rt_line_end" }, R"(
+print:
+    ; RDI = integer to print on its own line. Lines collect in node_out_buf, which is written
+    ; when full, at exit, and after every line when stdout is a terminal.
+    sub rsp, 104
+    mov rax, rdi
+    lea rsi, [rsp+96]               ; digits are written backwards from the newline
+    mov byte [rsi], 10
+    test rax, rax
+    jns .convert
+    neg rax                         ; -2^63 stays put and is converted correctly as unsigned
+.convert:
+    lea r8, [rel node_digit_pairs]
+    mov r9, 0x28F5C28F5C28F5C3      ; ((x >> 2) * r9) >> 66 is x / 100
+.pair:
+    cmp rax, 100                    ; two digits per step, one multiply and no div
+    jb .last
+    mov rcx, rax
+    shr rax, 2
+    mul r9
+    shr rdx, 2
+    imul r10, rdx, 100
+    sub rcx, r10
+    movzx r10d, byte [r8+rcx*2]
+    movzx r11d, byte [r8+rcx*2+1]
+    sub rsi, 2
+    mov [rsi], r10b
+    mov [rsi+1], r11b
+    mov rax, rdx
+    jmp .pair
+.last:
+    cmp rax, 10
+    jb .one
+    movzx r10d, byte [r8+rax*2]
+    movzx r11d, byte [r8+rax*2+1]
+    sub rsi, 2
+    mov [rsi], r10b
+    mov [rsi+1], r11b
+    jmp .sign
+.one:
+    add eax, 48
+    dec rsi
+    mov [rsi], al
+.sign:
+    test rdi, rdi
+    jns .append
+    dec rsi
+    mov byte [rsi], 45
+.append:
+    mov rax, [rel node_out_used]
+    cmp rax, 65515                  ; room for 20 digits and a newline
+    jbe .room
+    push rsi
+    call node_rt_flush
+    pop rsi
+    xor eax, eax
+.room:
+    lea rcx, [rsp+97]
+    sub rcx, rsi
+    lea rdi, [rel node_out_buf]
+    add rdi, rax
+    add rax, rcx
+    mov [rel node_out_used], rax
+    rep movsb
+    add rsp, 104
+    jmp node_rt_line_end
+section .rodata
+node_digit_pairs: db "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899"
+section .text
+)" },
+    { "print_str", { "node_rt_flush", "node_rt_line_end" }, R"(
+print_str:
+    ; RDI = NUL-terminated string to print on its own line, through the same buffer as print
+    push rbx
+    mov rbx, rdi
+.next:
+    mov rax, [rel node_out_used]
+    cmp rax, 65536
+    jb .room
+    call node_rt_flush
+    xor eax, eax
+.room:
+    movzx ecx, byte [rbx]
+    inc rbx
+    mov edx, ecx
+    test ecx, ecx
+    jnz .store
+    mov edx, 10                     ; the terminating NUL goes out as the newline
+.store:
+    lea rsi, [rel node_out_buf]
+    mov [rsi+rax], dl
+    inc rax
+    mov [rel node_out_used], rax
+    test ecx, ecx
+    jnz .next
+    pop rbx
+    jmp node_rt_line_end
+)" },
+    { "input", { "node_rt_flush" }, R"(
+input:
+    ; Reads one line from stdin and returns its leading decimal integer (optional '-'), else 0;
+    ; a value out of int64 range saturates. Pending output is flushed first, so a prompt shows
+    ; before the program waits. Runs of eight digits are converted at once (SWAR).
+    push rbx
+    push r12
+    push r13
+    call node_rt_flush
+    xor ebx, ebx                    ; magnitude so far
+    xor r12d, r12d                  ; 1 after a leading '-'
+    xor r13d, r13d                  ; 0 at line start, 1 in the number, 2 once it has ended
+.next:
+    mov rax, [rel node_in_pos]
+    mov rdx, [rel node_in_len]
+    cmp rax, rdx
+    jb .have
+    xor eax, eax                    ; read(0, node_in_buf, 65536)
+    xor edi, edi
+    lea rsi, [rel node_in_buf]
+    mov edx, 65536
+    syscall
+    cmp rax, -4                     ; EINTR
+    je .next
+    test rax, rax
+    jle .done
+    mov [rel node_in_len], rax
+    mov qword [rel node_in_pos], 0
+    jmp .next
+.have:
+    cmp r13d, 2
+    je .byte
+    sub rdx, rax
+    cmp rdx, 8
+    jb .byte
+    lea rcx, [rel node_in_buf]
+    mov rcx, [rcx+rax*1]
+    mov rdx, 0x0606060606060606     ; each byte is a digit iff its high nibble is 3 before and
+    add rdx, rcx                    ; after adding 6
+    mov rsi, 0xF0F0F0F0F0F0F0F0
+    and rdx, rsi
+    shr rdx, 4
+    and rsi, rcx
+    or rdx, rsi
+    mov rsi, 0x3333333333333333
+    cmp rdx, rsi
+    jne .byte
+    mov rsi, 0x0F0F0F0F0F0F0F0F     ; digit values, then pairs, quads and all eight combined
+    and rcx, rsi
+    imul rcx, rcx, 2561             ; 10 * 2^8 + 1
+    shr rcx, 8
+    mov rsi, 0x00FF00FF00FF00FF
+    and rcx, rsi
+    imul rcx, rcx, 6553601          ; 100 * 2^16 + 1
+    shr rcx, 16
+    mov rsi, 0x0000FFFF0000FFFF
+    and rcx, rsi
+    mov rsi, 42949672960001         ; 10000 * 2^32 + 1
+    imul rcx, rsi
+    shr rcx, 32
+    add rax, 8
+    mov [rel node_in_pos], rax
+    mov r13d, 1
+    imul rbx, rbx, 100000000
+    jo .overflow
+    add rbx, rcx
+    jo .overflow
+    jmp .next
+.byte:
+    lea rcx, [rel node_in_buf]
+    movzx ecx, byte [rcx+rax*1]
+    inc rax
+    mov [rel node_in_pos], rax
+    cmp ecx, 10
+    je .done
+    cmp r13d, 2
+    je .next
+    sub ecx, 48
+    cmp ecx, 9
+    ja .other
+    mov r13d, 1
+    imul rbx, rbx, 10
+    jo .overflow
+    add rbx, rcx
+    jo .overflow
+    jmp .next
+.other:
+    cmp ecx, -3                     ; '-' counts only at line start
+    jne .end
+    test r13d, r13d
+    jnz .end
+    mov r12d, 1
+    mov r13d, 1
+    jmp .next
+.overflow:
+    mov rbx, 0x7FFFFFFFFFFFFFFF     ; 2^63 - 1, or 2^63 for a negative number
+    add rbx, r12
+.end:
+    mov r13d, 2
+    jmp .next
+.done:
+    mov rax, rbx
+    test r12d, r12d
+    jz .return
+    neg rax
+.return:
+    pop r13
+    pop r12
+    pop rbx
+    ret
+section .bss
+alignb 64
+node_in_buf: resb 65536
+node_in_pos: resq 1
+node_in_len: resq 1
+section .text
+)" },
+};
+
+// The library routines `calls` reach, in table order.
+static std::vector<const RuntimeRoutine*> runtimeClosure(const std::set<std::string>& calls) {
+    std::set<std::string> needed = calls;
+    const size_t count = sizeof runtimeLibrary / sizeof runtimeLibrary[0];
+    for (size_t i = count; i-- > 0;)
+        if (needed.count(runtimeLibrary[i].name))
+            for (const char* use : runtimeLibrary[i].uses) if (use) needed.insert(use);
+    std::vector<const RuntimeRoutine*> routines;
+    for (const RuntimeRoutine& r : runtimeLibrary) if (needed.count(r.name)) routines.push_back(&r);
+    return routines;
+}
+
+// Writes libnoderuntime.a: one relocatable object per library routine, so each routine sits in
+// sections of its own, behind a GNU ar symbol index that lets ld pull in only what is referenced.
+// Timestamps and owners are zero, which keeps the archive reproducible.
+static void writeRuntimeLibrary(const std::string& path) {
+    struct Member { std::string name; std::vector<uint8_t> object; std::vector<std::string> symbols; };
+    std::vector<Member> members;
+    for (const RuntimeRoutine& r : runtimeLibrary) {
+        Assembler object;
+        object.Feed(std::string("section .text\n") + r.text + "\n");
+        std::vector<std::string> symbols = object.Export();
+        members.push_back({ std::string(r.name) + ".o", object.Object(), symbols });
+    }
+
+    std::string names;   // "//" member: names too long for the 16-byte header field
+    std::vector<std::string> headerNames;
+    for (const Member& m : members) {
+        if (m.name.size() < 16) { headerNames.push_back(m.name + "/"); continue; }
+        headerNames.push_back("/" + std::to_string(names.size()));
+        names += m.name + "/\n";
+    }
+    auto header = [](std::string& out, const std::string& name, int mode, size_t size) {
+        char field[61];
+        std::snprintf(field, sizeof field, "%-16s%-12d%-6d%-6d%-8d%-10zu`\n", name.c_str(), 0, 0, 0, mode, size);
+        out.append(field, 60);
+    };
+    size_t symbolCount = 0, symbolNames = 0;
+    for (const Member& m : members)
+        for (const std::string& sym : m.symbols) { symbolCount++; symbolNames += sym.size() + 1; }
+    size_t indexSize = 4 + 4 * symbolCount + symbolNames;
+    // Member offsets follow the index and the name table, each padded to an even size.
+    size_t offset = 8 + 60 + indexSize + indexSize % 2;
+    if (!names.empty()) offset += 60 + names.size() + names.size() % 2;
+    std::vector<size_t> offsets;
+    for (const Member& m : members) {
+        offsets.push_back(offset);
+        offset += 60 + m.object.size() + m.object.size() % 2;
+    }
+
+    std::string file = "!<arch>\n";
+    header(file, "/", 0, indexSize);
+    auto bigEndian = [&](size_t v) { for (int shift = 24; shift >= 0; shift -= 8) file += static_cast<char>(v >> shift & 0xFF); };
+    bigEndian(symbolCount);
+    for (size_t i = 0; i < members.size(); ++i)
+        for (size_t k = 0; k < members[i].symbols.size(); ++k) bigEndian(offsets[i]);
+    for (const Member& m : members)
+        for (const std::string& sym : m.symbols) file.append(sym.c_str(), sym.size() + 1);
+    if (indexSize % 2) file += '\n';
+    if (!names.empty()) {
+        header(file, "//", 0, names.size());
+        file += names;
+        if (names.size() % 2) file += '\n';
+    }
+    for (size_t i = 0; i < members.size(); ++i) {
+        header(file, headerNames[i], 644, members[i].object.size());
+        file.append(members[i].object.begin(), members[i].object.end());
+        if (members[i].object.size() % 2) file += '\n';
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(file.data(), static_cast<std::streamsize>(file.size()));
+    if (!out) throw std::runtime_error("cannot write " + path);
+}
+
+// Runs once from _start: picks the widest SIMD level the CPU and OS support (0 = SSE2, 1 = AVX2,
+// 2 = AVX-512F+DQ) and copies that column of node_dispatch_versions into node_dispatch.
+static const char* cpuResolver =
+    "node_rt_cpu_init:\n"
+    "    push rbx\n"
+    "    xor r8d, r8d\n"
+    "    xor eax, eax\n"
+    "    cpuid\n"
+    "    cmp eax, 7\n"
+    "    jb .pick\n"
+    "    mov eax, 1\n"
+    "    cpuid\n"
+    "    and ecx, 0x18000000\n"          // OSXSAVE | AVX
+    "    cmp ecx, 0x18000000\n"
+    "    jne .pick\n"
+    "    xor ecx, ecx\n"
+    "    xgetbv\n"
+    "    mov r9d, eax\n"
+    "    and eax, 6\n"                   // XMM and YMM state enabled by the OS
+    "    cmp eax, 6\n"
+    "    jne .pick\n"
+    "    mov eax, 7\n"
+    "    xor ecx, ecx\n"
+    "    cpuid\n"
+    "    test ebx, 0x20\n"               // AVX2
+    "    jz .pick\n"
+    "    mov r8d, 1\n"
+    "    and ebx, 0x30000\n"             // AVX512F | AVX512DQ
+    "    cmp ebx, 0x30000\n"
+    "    jne .pick\n"
+    "    and r9d, 0xe6\n"                // opmask and ZMM state
+    "    cmp r9d, 0xe6\n"
+    "    jne .pick\n"
+    "    mov r8d, 2\n"
+    ".pick:\n"
+    "    lea rsi, [rel node_dispatch_versions]\n"
+    "    lea rdi, [rel node_dispatch]\n"
+    "    lea rcx, [rel node_dispatch_end]\n"
+    ".next:\n"
+    "    cmp rdi, rcx\n"
+    "    jae .done\n"
+    "    mov rax, [rsi+r8*8]\n"
+    "    mov [rdi], rax\n"
+    "    add rsi, 24\n"
+    "    add rdi, 8\n"
+    "    jmp .next\n"
+    ".done:\n"
+    "    pop rbx\n"
+    "    ret\n";
+
+// Instrumented builds write "NODEPRF1", the source hash, the counter count and the counters
+// themselves to <source>.nodeprof when the program exits.
+static const char* profileDump =
+    "node_rt_prof_dump:\n"
+    "    mov eax, 2\n"
+    "    lea rdi, [rel node_prof_path]\n"
+    "    mov esi, 0x241\n"                // O_WRONLY | O_CREAT | O_TRUNC
+    "    mov edx, 420\n"                  // 0644
+    "    syscall\n"
+    "    test rax, rax\n"
+    "    js .done\n"
+    "    push rax\n"
+    "    mov rdi, rax\n"
+    "    mov eax, 1\n"
+    "    lea rsi, [rel node_prof_header]\n"
+    "    mov rdx, [rel node_prof_header+16]\n"
+    "    lea rdx, [rdx*8+24]\n"
+    "    syscall\n"
+    "    pop rdi\n"
+    "    mov eax, 3\n"
+    "    syscall\n"
+    ".done:\n"
+    "    ret\n";
+
+static void emitProfileData(const IRModule& module, CodeSink& out) {
+    out << "section .data\nalign 8\nnode_prof_header: db \"NODEPRF1\"\n";
+    out << "    dq " << static_cast<int64_t>(module.sourceHash) << ", " << module.profileCounters << "\n";
+    out << "node_prof_counters: times " << std::max(module.profileCounters, 1) << " dq 0\n";
+    emitStringData(out, "node_prof_path", module.profileOutput);
+    out << "section .text\n\n";
+}
+
+static void emitDispatch(const IRModule& module, CodeSink& out) {
+    for (const DispatchEntry& entry : module.dispatch)
+        out << entry.symbol << ":\n    jmp [rel " << entry.symbol << "_slot]\n";
+    out << "\n" << cpuResolver << "\n";
+    out << "section .data\nnode_dispatch:\n";
+    for (const DispatchEntry& entry : module.dispatch) {
+        auto baseline = std::find_if(entry.versions.begin(), entry.versions.end(),
+                                     [](const std::pair<int, std::string>& v) { return v.first == 16; });
+        out << entry.symbol << "_slot: dq " << baseline->second << "\n";
+    }
+    out << "node_dispatch_end:\n";
+    out << "section .rodata\nnode_dispatch_versions:\n";
+    for (const DispatchEntry& entry : module.dispatch) {
+        out << "    dq";
+        for (int bytes : { 16, 32, 64 }) {
+            auto it = std::find_if(entry.versions.begin(), entry.versions.end(),
+                                   [&](const std::pair<int, std::string>& v) { return v.first == bytes; });
+            out << (bytes == 16 ? " " : ", ") << it->second;
+        }
+        out << "\n";
+    }
+    out << "section .text\n\n";
+}
+
+// --prefault: madvise(MADV_POPULATE_WRITE) maps every page from node_data_start (first in
+// .data) to node_bss_end (last in .bss) instead of taking a fault on each first touch. The
+// buffer arena is skipped, since its pages are only touched as buffers are allocated. Kernels
+// before 5.14 reject the advice and the pages fault in as usual.
+static std::string prefaultRange(const char* start, const char* end) {
+    return std::string("    lea rdi, [rel ") + start + "]\n"
+           "    lea rsi, [rel " + end + "]\n"
+           "    and rdi, -4096\n"
+           "    sub rsi, rdi\n"
+           "    mov edx, 23\n"
+           "    mov eax, 28\n"
+           "    syscall\n";
+}
+
+// --time-startup: the first thing _start does is write CLOCK_MONOTONIC to fd 3, where
+// timeStartup listens. Without that pipe the write fails and nothing else changes.
+static const char* startupProbe =
+    "    sub rsp, 16\n"
+    "    mov eax, 228\n"                // clock_gettime(CLOCK_MONOTONIC, rsp)
+    "    mov edi, 1\n"
+    "    mov rsi, rsp\n"
+    "    syscall\n"
+    "    mov eax, 1\n"                  // write(3, rsp, 16)
+    "    mov edi, 3\n"
+    "    mov rsi, rsp\n"
+    "    mov edx, 16\n"
+    "    syscall\n"
+    "    add rsp, 16\n";
+
+// Calls work(0) .. work(count - 1) from `threads` threads, the caller's included, handing out
+// indices in order.
+static void parallelFor(size_t count, int threads, const std::function<void(size_t)>& work) {
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&] {
+        for (size_t i; (i = next++) < count;) work(i);
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < static_cast<size_t>(threads) && t < count; ++t) pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool) t.join();
+}
+
+// One routine's code, built by whichever thread picked it up.
+struct RoutineCode {
+    CompileStats stats;
+    PassTimings timings;
+    std::unique_ptr<EmitBuffer> text;      // when the sink takes NASM text
+    std::unique_ptr<Assembler> machine;    // when the sink encodes
+    std::exception_ptr error;
+};
+
+static CompileStats emitModule(const IRModule& module, const CompileOptions& options, const CostModel& costs,
+                               CodeSink& out, PassTimings& timings) {
+    CompileStats stats;
+    // With a profile, the most-entered functions come first and the ones it never entered go
+    // last, so the code a run touches shares as few pages as possible.
+    std::vector<const IRFunction*> order;
+    for (const IRFunction& fn : module.functions) if (!fn.cold) order.push_back(&fn);
+    std::stable_sort(order.begin(), order.end(), [](const IRFunction* a, const IRFunction* b) { return a->entries > b->entries; });
+    for (const IRFunction& fn : module.functions) if (fn.cold) order.push_back(&fn);
+    // Routines are independent from selection to encoding, so they are built in parallel and
+    // spliced in `order`, which keeps the output byte-identical to a one-thread build.
+    std::vector<RoutineCode> routines(order.size());
+    auto start = std::chrono::steady_clock::now();
+    parallelFor(order.size(), options.threads, [&](size_t i) {
+        const IRFunction& fn = *order[i];
+        RoutineCode& r = routines[i];
+        try {
+            Selection selection;
+            const Selection* covers = options.treeSelection ? &selection : nullptr;
+            if (covers) {
+                r.timings.measure("isel", [&] { InstructionSelector(fn, selection).Run(); });
+                for (size_t k = 0; k < selectionRuleCount; ++k) r.stats.selected[k] += selection.hits[k];
+            }
+            Allocation alloc;
+            r.timings.measure("regalloc", [&] { alloc = LinearScanAllocator(fn, options.spillEverything, covers).Run(); });
+            r.stats.functions++;
+            r.stats.intervals += alloc.intervals;
+            r.stats.spilled += alloc.spillSlots;
+            r.stats.calleeSaved += static_cast<int>(alloc.savedRegs.size());
+            std::vector<MInst> code;
+            r.timings.measure("lowering", [&] { FunctionLowering(fn, alloc, code, options.strengthReduce, covers).Run(); });
+            if (options.peephole) r.timings.measure("peephole", [&] { runPeephole(code, r.stats.peephole); });
+            if (options.schedule) r.timings.measure("schedule", [&] { ListScheduler(costs, r.stats.schedule).Run(code); });
+            r.timings.measure("encode", [&] {
+                if (out.text) r.text.reset(new EmitBuffer(-1, false, 1 << 12));
+                if (out.machine) r.machine.reset(new Assembler);
+                if (r.machine && options.debugInfo) r.machine->DebugLines(module.sourceFile);
+                int textLine = 0;
+                for (const MInst& in : code) {
+                    // -g: nasm attributes the lines that follow a %line to that .node line.
+                    if (r.text && options.debugInfo && in.line && in.line != textLine && in.op != "label") {
+                        *r.text << "%line " << in.line << "+0 " << module.sourceFile << '\n';
+                        textLine = in.line;
+                    }
+                    if (r.text) printInst(*r.text, in);
+                    if (r.machine) r.machine->Encode(in);
+                    if (in.op == "label" || in.op == "raw") continue;
+                    r.stats.instructions++;
+                    if (touchesMemory(in)) r.stats.memoryOps++;
+                }
+            });
+        } catch (...) {
+            r.error = std::current_exception();
+        }
+    });
+    stats.routineSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (RoutineCode& r : routines) {
+        if (r.error) std::rethrow_exception(r.error);
+        stats.add(r.stats);
+        timings.Add(r.timings);
+    }
+    // Output is flushed on the way out only when something can have buffered it.
+    std::vector<const RuntimeRoutine*> runtime = runtimeClosure(module.runtime);
+    auto carries = [&](const char* name) {
+        return std::any_of(runtime.begin(), runtime.end(), [&](const RuntimeRoutine* r) { return std::strcmp(r->name, name) == 0; });
+    };
+    bool flush = carries("node_rt_flush");
+    // With --runtime=lib the arena is in the library's .bss, which ld places after node_bss_end.
+    bool arena = !options.runtimeLibrary && carries("node_rt_arena_new");
+    uint64_t textStart = out.text ? out.text->size() : 0;
+    timings.measure("emit", [&] {
+        if (options.prefault) out << "section .data\nnode_data_start:\n";
+        out << "section .text\nglobal _start\n";
+        for (const std::string& ext : module.externs) out << "extern " << ext << "\n";
+        if (options.runtimeLibrary) {
+            // libnoderuntime.a supplies the routines and jumps back to throw_handler.
+            out << "global throw_handler\n";
+            for (const std::string& name : module.runtime) out << "extern " << name << "\n";
+            if (flush && !module.runtime.count("node_rt_flush")) out << "extern node_rt_flush\n";
+        }
+        out << "_start:\n";
+        if (options.startupRuns) out << startupProbe;
+        if (options.prefault && arena)
+            out << prefaultRange("node_data_start", "node_arena") << prefaultRange("node_arena_end", "node_bss_end");
+        else if (options.prefault)
+            out << prefaultRange("node_data_start", "node_bss_end");
+        if (!module.dispatch.empty()) out << "    call node_rt_cpu_init\n";
+        for (const std::string& entry : module.entryCalls) out << "    call " << entry << "\n";
+        bool instrumented = module.profileCounters > 0;
+        out << "node_exit:\n";
+        if (instrumented) out << "    call node_rt_prof_dump\n";
+        if (flush) out << "    call node_rt_flush\n";
+        out << "    mov rax, 60\n    xor rdi, rdi\n    syscall\n\n";
+        out << "throw_handler:\n";
+        if (instrumented) out << "    call node_rt_prof_dump\n";
+        if (flush) out << "    call node_rt_flush\n";
+        out << "    mov rax, 60\n    mov rdi, 1\n    syscall\n\n";
+        if (instrumented) {
+            out << profileDump << "\n";
+            emitProfileData(module, out);
+        }
+        if (!options.runtimeLibrary)
+            for (const RuntimeRoutine* r : runtime) out << r->text << "\n";
+        if (!module.dispatch.empty()) emitDispatch(module, out);
+
+        for (RoutineCode& r : routines) {
+            if (r.text) out.text->append(*r.text);
+            if (r.machine) out.machine->Append(*r.machine);
+            r.text.reset();
+            r.machine.reset();
+        }
+
+        if (!module.strings.empty() || !module.tables.empty()) {
+            // Immutable data: string literals and `==` tables, one copy per distinct contents.
+            // A table's element count sits just below its first element, as for buffers.
+            out << "\nsection .rodata\n";
+            for (const auto& s : module.strings) emitStringData(out, s.first, s.second);
+            for (const auto& t : module.tables) {
+                out << "    align 8\n    dq " << t.second.size() << "\n" << t.first << ":";
+                for (size_t i = 0; i < t.second.size(); ++i) out << (i ? ", " : " dq ") << t.second[i];
+                out << "\n";
+            }
+        }
+        if (options.prefault) out << "section .bss\nnode_bss_end:\n";
+    });
+    if (out.text) stats.textBytes = out.text->size() - textStart;
+    return stats;
+}
+
+// -----------------------------
+// EXTERNAL ASSEMBLER (nasm + ld)
+// -----------------------------
+
+// --assembler=nasm keeps the NASM text off disk unless --emit-asm asks for it. The emitter
+// streams it into an anonymous in-memory file while code generation runs, and nasm writes its
+// object to a second one that ld reads. nasm reads its input again on every pass, so it gets a
+// file it can reopen (/dev/fd/3) rather than a pipe on stdin. Each nasm + ld run is a background
+// job, so a batch build assembles one file while the next one is still being compiled.
+
+#if defined(__linux__)
+// Returns -1 where the kernel has no memfd_create; the caller then falls back to output.asm.
+static int memoryFile(const char* name) { return memfd_create(name, MFD_CLOEXEC); }
+#endif
+
+// Runs nasm + ld command lines, at most `limit` at a time. In the foreground (a single source)
+// Start waits for its job; in the background it only waits for a free slot.
+class NasmJobs {
+public:
+    NasmJobs(int limit, bool background) : limit(std::max(1, limit)), background(background) {}
+    ~NasmJobs() { WaitAll(); }
+    NasmJobs(const NasmJobs&) = delete;
+    NasmJobs& operator=(const NasmJobs&) = delete;
+
+    // Runs `command` through the shell with asmFd and objFd (-1 for none) open as fds 3 and 4,
+    // and closes both in this process. Reports "<output> generated" or the failure when done.
+    void Start(const std::string& command, int asmFd, int objFd, const std::string& output, const std::string& log) {
+#if defined(__unix__) || defined(__APPLE__)
+        while (static_cast<int>(running.size()) >= limit) waitOne();
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Move both files clear of 3 and 4 first so that one dup2 cannot close the other.
+            int in = asmFd >= 0 ? fcntl(asmFd, F_DUPFD, 10) : -1;
+            int obj = objFd >= 0 ? fcntl(objFd, F_DUPFD, 10) : -1;
+            if (in >= 0) dup2(in, 3);
+            if (obj >= 0) dup2(obj, 4);
+            execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        if (asmFd >= 0) close(asmFd);
+        if (objFd >= 0) close(objFd);
+        if (pid < 0) {
+            finish(false, output, log);
+            return;
+        }
+        running.push_back({ pid, output, log });
+        if (!background) WaitAll();
+#else
+        (void)asmFd;
+        (void)objFd;
+        finish(system(command.c_str()) == 0, output, log);
+#endif
+    }
+
+    // Waits for every job still running; returns false if any job so far has failed.
+    bool WaitAll() {
+#if defined(__unix__) || defined(__APPLE__)
+        while (!running.empty()) waitOne();
+#endif
+        return !failed;
+    }
+
+private:
+    struct Job {
+        int pid;
+        std::string output, log;
+    };
+    int limit;
+    bool background;
+    bool failed = false;
+    std::vector<Job> running;
+
+#if defined(__unix__) || defined(__APPLE__)
+    void waitOne() {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) return;
+            for (const Job& job : running) finish(false, job.output, job.log);
+            running.clear();
+            return;
+        }
+        auto it = std::find_if(running.begin(), running.end(), [&](const Job& job) { return job.pid == pid; });
+        if (it == running.end()) return;
+        finish(WIFEXITED(status) && WEXITSTATUS(status) == 0, it->output, it->log);
+        running.erase(it);
+    }
+#endif
+
+    void finish(bool ok, const std::string& output, const std::string& log) {
+        if (ok) std::cout << "[SUCCESS] Compilation successful: " << output << " generated.\nLogs: " << log << "\n";
+        else std::cerr << "❌ Compilation of " << output << " failed. Check NASM/LD installation.\n";
+        if (!ok) {
+            std::remove(output.c_str());   // whatever ld or nasm left half-written
+            failed = true;
+        }
+    }
+};
+
+// `dir/Name.node` -> `Name`: names the .nodeprof file and, in a batch build, the outputs.
+static std::string sourceStem(const std::string& filename) {
+    std::string stem = filename.substr(filename.find_last_of("/\\") + 1);
+    if (stem.size() > 5 && stem.compare(stem.size() - 5, 5, ".node") == 0) stem.resize(stem.size() - 5);
+    return stem;
+}
+
+// Output names for a batch build: the stem, or `<parent>_<stem>` when another source shares
+// the stem, with `_2`, `_3`... added if that is still taken.
+static std::vector<std::string> batchNames(const std::vector<std::string>& sources) {
+    std::map<std::string, int> stems;
+    for (const std::string& source : sources) stems[sourceStem(source)]++;
+    std::set<std::string> used;
+    std::vector<std::string> names;
+    for (const std::string& source : sources) {
+        std::string name = sourceStem(source);
+        if (stems[name] > 1) {
+            std::string dir = source.substr(0, source.find_last_of("/\\") + 1);
+            dir.resize(dir.find_last_not_of("/\\") + 1);
+            std::string parent = dir.substr(dir.find_last_of("/\\") + 1);
+            if (!parent.empty() && parent != "." && parent != "..") name = parent + "_" + name;
+        }
+        std::string base = name;
+        for (int n = 2; !used.insert(name).second; ++n) name = base + "_" + std::to_string(n);
+        names.push_back(name);
+    }
+    return names;
+}
+
+// Reads a .nodeprof written by an --instrument build of the same source; returns false (with a
+// reason) when the file is missing, truncated or was recorded against different source.
+static bool readProfile(const std::string& path, uint64_t sourceHash, std::vector<uint64_t>& counts, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) { error = "cannot open " + path; return false; }
+    char magic[8];
+    uint64_t hash = 0, n = 0;
+    in.read(magic, 8);
+    in.read(reinterpret_cast<char*>(&hash), 8);
+    in.read(reinterpret_cast<char*>(&n), 8);
+    if (!in || std::string(magic, 8) != "NODEPRF1") { error = path + " is not a NODE profile"; return false; }
+    if (hash != sourceHash) { error = path + " was recorded for a different version of the source"; return false; }
+    counts.resize(n);
+    in.read(reinterpret_cast<char*>(counts.data()), static_cast<std::streamsize>(n * 8));
+    if (!in) { error = path + " is truncated"; return false; }
+    return true;
+}
+
+// Returns false if the build failed; nasm + ld jobs report through NasmJobs::WaitAll instead.
+bool compileNODEFile(const std::string& filename, const CompileOptions& options, NasmJobs& nasm) {
+    std::ifstream inFile(filename);
+    if (!inFile.is_open()) {
+        std::cerr << "Error: Could not open " << filename << std::endl;
+        return false;
+    }
+    std::string source((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+    // A build that fails must not leave the previous build's output behind to be run by mistake.
+    std::string output = options.output + (options.emitObject ? ".o" : ".exe");
+    std::remove(output.c_str());
+
+    EmitBuffer asmText;
+    bool asmInMemory = false;
+#if defined(__linux__)
+    if (options.nasmBackend && !options.emitAsm) {
+        int fd = memoryFile("nodec-asm");
+        if (fd >= 0) asmText.Attach(fd);
+        asmInMemory = fd >= 0;
+    }
+#endif
+    if (!asmInMemory && (options.nasmBackend || options.emitAsm) && !asmText.Open(options.output + ".asm")) {
+        std::cerr << "Error: Could not create " << options.output << ".asm\n";
+        return false;
+    }
+    std::ofstream logFile(options.logPath);
+    Assembler assembler;
+    if (options.debugInfo) assembler.DebugLines(filename);
+    CodeSink sink;
+    if (asmText.isOpen()) sink.text = &asmText;
+    if (!options.nasmBackend) sink.machine = &assembler;
+
+    Program program;
+    IRModule module;
+    CompileStats stats;
+    LoopStats loops;
+    ProfileStats pgo;
+    BoundsStats bounds;
+    std::vector<std::string> boundsReport;
+    PassTimings timings;
+    AnalysisCache analyses;
+    PassContext passes{ module, analyses };
+    CostModel costs;
+    std::string costError;
+    std::istringstream builtinCosts(builtinCostModel);
+    if (!costs.Parse(builtinCosts, "built-in", costError) ||
+        (!options.costModel.empty() && !costs.Load(options.costModel, costError))) {
+        std::cerr << "Error: cost model: " << costError << "\n";
+        return false;
+    }
+    module.sourceHash = hashSource(source);
+    module.profileOutput = sourceStem(filename) + ".nodeprof";
+    module.sourceFile = filename;
+    try {
+        timings.measure("parse", [&] { Parser(Lexer(source).Tokenize(), program, logFile).Parse(); });
+        IRBuilder builder(module, logFile, options);
+        if (!options.useProfile.empty()) {
+            std::vector<uint64_t> counts;
+            std::string error;
+            if (readProfile(options.useProfile, module.sourceHash, counts, error)) builder.UseProfile(std::move(counts));
+            else std::cerr << "Warning: ignoring profile: " << error << "\n";
+        }
+        PassTimings::Entry& irgen = timings.measure("irgen", [&] { builder.Build(program); });
+        irgen.irAfter = irSize(module);
+        loops = builder.loopStats;
+        pgo = builder.profileStats;
+        bounds = builder.boundsStats;
+        boundsReport = builder.boundsReport;
+        runPipeline(options.passes, passes, timings);
+        stats = emitModule(module, options, costs, sink, timings);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << " (see " << options.logPath << ")\n";
+        return false;
+    }
+
+    if (options.reportBounds) {
+        std::cout << "[Bounds] " << bounds.proven << " accesses proven in range, " << bounds.guarded << " covered by "
+                  << bounds.guards << " loop guards, " << bounds.checked << " checked on every access, "
+                  << bounds.unchecked << " through pointers of unknown size\n";
+        for (const std::string& entry : boundsReport) std::cout << "[Bounds] " << entry << "\n";
+    }
+    if (options.profile) {
+        std::cout << "[Profile] loops: " << loops.full << " fully unrolled, " << loops.partial
+                  << " partially unrolled, " << loops.capped << " capped by budget, " << loops.vectorized << " vectorized\n";
+        if (options.instrument)
+            std::cout << "[Profile] pgo: " << module.profileCounters << " counters, written to "
+                      << module.profileOutput << " at exit\n";
+        else if (!options.useProfile.empty())
+            std::cout << "[Profile] pgo: " << pgo.hotLoops << " hot loops unrolled, " << pgo.coldLoops
+                      << " cold loops kept rolled, " << pgo.coldBlocks << " cold blocks moved out of line, "
+                      << pgo.swappedBranches << " branches swapped, " << pgo.coldFunctions << " cold functions placed last\n";
+        const InlineStats& inlining = passes.inlining;
+        const ScalarStats& scalar = passes.scalar;
+        const EscapeStats& escapes = passes.escapes;
+        std::cout << "[Profile] passes:";
+        for (const std::string& pass : options.passes) std::cout << " " << pass;
+        std::cout << (options.passes.empty() ? " none" : "") << " (-O" << options.optLevel << ")\n";
+        if (runsPass(options, "inline")) {
+            std::cout << "[Profile] inline: " << inlining.inlined << " call sites inlined, " << inlining.kept << " kept\n";
+            for (const std::string& decision : inlining.decisions) std::cout << "[Profile] inline " << decision << "\n";
+        }
+        std::cout << "[Profile] scalar: " << scalar.webs << " live ranges split, " << scalar.propagated
+                  << " operands propagated, " << scalar.folded << " constants folded, " << scalar.reused
+                  << " expressions reused, " << scalar.removed << " dead instructions removed, " << scalar.hoisted << " hoisted out of loops\n";
+        if (runsPass(options, "escape"))
+            std::cout << "[Profile] escape: " << escapes.stack << " buffers on the stack, " << escapes.arena
+                      << " in the scoped arena, " << escapes.escaped << " escaping, " << escapes.deletesRemoved
+                      << " deletes removed\n";
+        if (runsPass(options, "tailcalls"))
+            std::cout << "[Profile] tail calls: " << passes.tailCalls << " calls became jumps\n";
+        std::cout << "[Profile] simd: target " << options.targetCpu << ", " << module.dispatch.size()
+                  << " functions dispatched at startup\n";
+        std::cout << "[Profile] regalloc: " << stats.functions << " functions, " << stats.intervals
+                  << " live intervals, " << stats.spilled << " spilled, " << stats.calleeSaved << " callee-saved\n";
+        std::cout << "[Profile] emitted: " << stats.instructions << " instructions, "
+                  << stats.memoryOps << " touching memory\n";
+        // Rules sharing a name (operand orders, Branch and SetCC forms) are reported together.
+        std::map<std::string, int> selected;
+        for (size_t r = 0; r < selectionRuleCount; ++r)
+            if (stats.selected[r]) selected[selectionRules[r].name] += stats.selected[r];
+        for (const auto& rule : selected) std::cout << "[Profile] isel " << rule.first << ": " << rule.second << " trees\n";
+        for (size_t r = 0; r < stats.peephole.hits.size(); ++r)
+            std::cout << "[Profile] peephole " << peepholeRules[r].name << ": " << stats.peephole.hits[r] << " hits\n";
+        if (options.schedule)
+            std::cout << "[Profile] schedule (" << costs.source
+                      << (options.costModel.empty() ? "" : ": " + std::to_string(costs.changed) + " entries changed, " +
+                                                           std::to_string(costs.kept) + " kept from built-in")
+                      << "): " << stats.schedule.reordered << " of "
+                      << stats.schedule.regions << " regions reordered, " << stats.schedule.moved
+                      << " instructions moved, estimated " << stats.schedule.cyclesBefore << " -> "
+                      << stats.schedule.cyclesAfter << " cycles\n";
+    }
+
+    inFile.close();
+    logFile.close();
+    int asmFd = asmInMemory ? asmText.Release() : -1;
+    if (asmInMemory ? asmFd < 0 : !asmText.Flush()) {
+        std::cerr << "Error: Could not write the assembly for " << filename << "\n";
+        return false;
+    }
+
+    bool built = options.nasmBackend;
+    if (options.nasmBackend) {
+        int objFd = -1;
+#if defined(__linux__)
+        if (asmFd >= 0 && !options.emitObject) objFd = memoryFile("nodec-obj");
+#endif
+        std::string input = asmFd >= 0 ? "/dev/fd/3" : options.output + ".asm";
+        std::string object = objFd >= 0 ? "/dev/fd/4" : options.output + ".o";
+        // Only -g asks nasm for DWARF; the %line directives in the text point it at the .node lines.
+        std::string command = std::string(options.debugInfo ? "nasm -g -F dwarf" : "nasm") + " -f elf64 " + input + " -o " + object;
+        if (!options.emitObject)
+            command += std::string(" && ld") + (options.packSegments ? " -z noseparate-code" : "") +
+                       (options.runtimeLibrary ? " --gc-sections " + object + " libnoderuntime.a" : " " + object) + " -o " + output;
+        std::cout << "Assembling and linking " << (asmFd >= 0 ? filename + " in memory" : input) << "...\n";
+        timings.measure("assemble+link", [&] { nasm.Start(command, asmFd, objFd, output, options.logPath); });
+    } else {
+        // Encoded in process while emitting; this lays out the sections and writes the ELF file.
+        timings.measure("assemble+link", [&] {
+            try {
+                if (options.emitObject) assembler.WriteObject(output);
+                else assembler.WriteExecutable(output, options.packSegments);
+                built = true;
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << "\n";
+                std::remove(output.c_str());
+            }
+        });
+        if (built) std::cout << "[SUCCESS] Compilation successful: " << output << " generated.\nLogs: " << options.logPath << "\n";
+    }
+    if (options.timeReport) {
+        timings.Print(std::cout);
+        char row[120];
+        std::snprintf(row, sizeof row, "[Time] %d routines on %d threads: %.3f ms wall from isel to encode\n",
+                      stats.functions, std::min(options.threads, std::max(stats.functions, 1)), stats.routineSeconds * 1000);
+        std::cout << row;
+        double textSeconds = 0;
+        for (const PassTimings::Entry& e : timings.entries)
+            if (e.name == "encode" || e.name == "emit") textSeconds += e.seconds;
+        if (stats.textBytes && textSeconds > 0) {
+            std::snprintf(row, sizeof row, "[Time] encode+emit wrote %llu bytes of assembly text, %.1f MB/s\n",
+                          static_cast<unsigned long long>(stats.textBytes), stats.textBytes / textSeconds / 1e6);
+            std::cout << row;
+        }
+        std::cout << "[Time] analyses: " << analyses.computed << " computed, " << analyses.reused
+                  << " reused from cache\n";
+    }
+    return built;
+}
+
+// -----------------------------
+// STARTUP TIMING
+// -----------------------------
+
+// --time-startup=N spawns the executable N times with stdin and stdout on /dev/null. Its _start
+// reports when it began through fd 3 (see startupProbe), which separates exec-to-_start from the
+// run and the exit. Compare the two backends by building once with each.
+static void timeStartup(const std::string& exe, int runs) {
+#if defined(__linux__)
+    int probe[2];
+    if (pipe2(probe, O_CLOEXEC) != 0) {
+        std::cerr << "Error: --time-startup could not open a pipe\n";
+        return;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, probe[1], 3);
+    std::string path = exe.find('/') == std::string::npos ? "./" + exe : exe;
+    char* args[] = { &path[0], nullptr };
+    auto micros = [](const timespec& t) { return t.tv_sec * 1e6 + t.tv_nsec / 1e3; };
+    std::vector<double> entry, total;
+    struct rusage before, after;
+    getrusage(RUSAGE_CHILDREN, &before);
+    for (int i = 0; i < runs; ++i) {
+        timespec start, reached, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pid_t pid;
+        if (posix_spawn(&pid, path.c_str(), &actions, nullptr, args, environ) != 0) {
+            std::cerr << "Error: --time-startup could not run " << path << "\n";
+            break;
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (read(probe[0], &reached, sizeof reached) != static_cast<ssize_t>(sizeof reached)) {
+            std::cerr << "Error: " << path << " did not report reaching _start\n";
+            break;
+        }
+        entry.push_back(micros(reached) - micros(start));
+        total.push_back(micros(end) - micros(start));
+    }
+    getrusage(RUSAGE_CHILDREN, &after);
+    posix_spawn_file_actions_destroy(&actions);
+    close(probe[0]);
+    close(probe[1]);
+    if (entry.empty()) return;
+    std::sort(entry.begin(), entry.end());
+    std::sort(total.begin(), total.end());
+    size_t n = entry.size();
+    char row[200];
+    std::snprintf(row, sizeof row, "[Time] startup of %s over %zu runs: exec to _start median %.1f us (min %.1f), "
+                  "exec to exit median %.1f us, %.1f page faults per run\n", exe.c_str(), n, entry[n / 2], entry[0],
+                  total[n / 2], static_cast<double>(after.ru_minflt - before.ru_minflt) / n);
+    std::cout << row;
+#else
+    (void)exe;
+    (void)runs;
+    std::cerr << "Warning: --time-startup needs Linux\n";
+#endif
+}
+
+// For a --name=N switch whose N is not a count.
+static int usageCount(const std::string& arg, size_t prefix) {
+    std::cerr << "Error: " << arg.substr(0, prefix) << "N needs a whole number N from 1 up, not '" << arg.substr(prefix) << "'\n";
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2) {
+        CompileOptions options;
+        // -O sets the defaults every other switch then adjusts, wherever it appears.
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3')
+                applyOptLevel(options, arg[2] - '0');
+        }
+        std::vector<std::string> dropped;
+        std::vector<std::string> sources;
+        bool emitRuntime = false;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.empty() || arg[0] != '-') sources.push_back(arg);
+            else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3') continue;
+            else if (arg == "--profile") options.profile = true;
+            else if (arg == "--regalloc=spill") options.spillEverything = true;
+            else if (arg == "--regalloc=linear") options.spillEverything = false;
+            else if (arg == "--isel=tree") options.treeSelection = true;
+            else if (arg == "--isel=simple") options.treeSelection = false;
+            else if (arg == "--no-peephole") options.peephole = false;
+            else if (arg == "--no-unroll") options.autoUnroll = false;
+            else if (arg == "--no-vectorize") options.vectorize = false;
+            else if (arg == "--no-strength-reduce") options.strengthReduce = false;
+            else if (arg == "--no-schedule") options.schedule = false;
+            else if (arg.rfind("--cost-model=", 0) == 0) options.costModel = arg.substr(13);
+            else if (arg == "--no-inline") dropped.push_back("inline");
+            else if (arg == "--no-escape") dropped.push_back("escape");
+            else if (arg == "--no-tail-calls") dropped.push_back("tailcalls");
+            else if (arg == "--no-gvn") { dropped.push_back("gvn"); dropped.push_back("dce"); }
+            else if (arg == "--no-licm") dropped.push_back("licm");
+            else if (arg == "--time-report") options.timeReport = true;
+            else if (arg == "--assembler=builtin") options.nasmBackend = false;
+            else if (arg == "--assembler=nasm") options.nasmBackend = true;
+            else if (arg == "--emit-asm") options.emitAsm = true;
+            else if (arg == "--emit-obj") options.emitObject = true;
+            else if (arg == "-g") options.debugInfo = true;
+            else if (arg == "--prefault") options.prefault = true;
+            else if (arg == "--pack-segments") options.packSegments = true;
+            else if (arg.rfind("--time-startup=", 0) == 0) {
+                if (!parseCount(arg.substr(15), options.startupRuns)) return usageCount(arg, 15);
+            }
+            else if (arg == "--emit-runtime") emitRuntime = true;
+            else if (arg == "--runtime=lib") options.runtimeLibrary = true;
+            else if (arg.rfind("--jobs=", 0) == 0) {
+                if (!parseCount(arg.substr(7), options.jobs)) return usageCount(arg, 7);
+            }
+            else if (arg.rfind("--threads=", 0) == 0) {
+                if (!parseCount(arg.substr(10), options.threads)) return usageCount(arg, 10);
+            }
+            else if (arg.rfind("--passes=", 0) == 0) {
+                options.passes.clear();
+                std::stringstream list(arg.substr(9));
+                std::string name;
+                while (std::getline(list, name, ',')) {
+                    if (name.empty()) continue;
+                    if (!findPass(name)) {
+                        std::cerr << "Unknown pass '" << name << "'. Available passes:\n";
+                        for (const PassInfo& pass : passRegistry)
+                            std::cerr << "  " << pass.name << std::string(11 - std::strlen(pass.name), ' ') << pass.summary << "\n";
+                        return 1;
+                    }
+                    options.passes.push_back(name);
+                }
+            }
+            else if (arg == "--no-bounds-checks") options.boundsChecks = false;
+            else if (arg == "--report-bounds") options.reportBounds = true;
+            else if (arg == "--instrument") options.instrument = true;
+            else if (arg.rfind("--use-profile=", 0) == 0) options.useProfile = arg.substr(14);
+            else if (arg.rfind("--target-cpu=", 0) == 0) {
+                options.targetCpu = arg.substr(13);
+                if (options.targetCpu != "sse2" && options.targetCpu != "avx2" && options.targetCpu != "avx512" &&
+                    options.targetCpu != "native" && options.targetCpu != "multi") {
+                    std::cerr << "Unknown --target-cpu '" << options.targetCpu << "' (sse2, avx2, avx512, native, multi)\n";
+                    return 1;
+                }
+            }
+            else if (arg.rfind("--unroll-budget=", 0) == 0) {
+                if (!parseCount(arg.substr(16), options.unrollBudget)) return usageCount(arg, 16);
+            }
+            else std::cerr << "Warning: ignoring unknown option " << arg << "\n";
+        }
+        for (const std::string& name : dropped)
+            options.passes.erase(std::remove(options.passes.begin(), options.passes.end(), name), options.passes.end());
+        int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        if (options.jobs == 0) options.jobs = cores;
+        if (options.threads == 0) options.threads = cores;
+        if (emitRuntime) {
+            try {
+                writeRuntimeLibrary("libnoderuntime.a");
+                std::cout << "[SUCCESS] Runtime library written: libnoderuntime.a\n";
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << "\n";
+                return 1;
+            }
+        } else if (sources.empty()) {
+            std::cerr << "Error: no source file given\n";
+            return 1;
+        }
+        // Several sources make a batch build: each gets <stem>.exe and <stem>.log, and their nasm
+        // + ld jobs run in the background while the next source compiles.
+        NasmJobs nasm(options.jobs, sources.size() > 1);
+        std::vector<std::string> names = batchNames(sources);
+        std::vector<std::string> executables;
+        bool ok = true;
+        for (size_t i = 0; i < sources.size(); ++i) {
+            const std::string& source = sources[i];
+            CompileOptions fileOptions = options;
+            if (sources.size() > 1) {
+                fileOptions.output = names[i];
+                fileOptions.logPath = fileOptions.output + ".log";
+            }
+            ok = compileNODEFile(source, fileOptions, nasm) && ok;
+            executables.push_back(fileOptions.output + ".exe");
+        }
+        ok = nasm.WaitAll() && ok;
+        if (ok && options.startupRuns && !options.emitObject)
+            for (const std::string& exe : executables) timeStartup(exe, options.startupRuns);
+        return ok ? 0 : 1;
     }
 
     std::string input;
+    EmitBuffer out(1);
     std::cout << "NODE Compiler Shell (v1.0)\nType NODE instructions (e.g., xor_eq, add, throw). Ctrl+C to exit.\n\n";
     while (true) {
         std::cout << ">> ";
-        std::getline(std::cin, input);
-        if (!input.empty()) std::cout << translateLine(input, 0, std::cout);
+        if (!std::getline(std::cin, input)) break;
+        if (input.empty()) continue;
+        translateLine(input, 0, out, std::cout);
+        std::cout.flush();
+        out.Flush();
     }
     return 0;
 }
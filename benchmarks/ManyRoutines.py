@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# Writes ManyRoutines.node. Change the count or the routine shape here, then regenerate:
+#
+#   python3 benchmarks/ManyRoutines.py > benchmarks/ManyRoutines.node
+
+ROUTINES = 300
+
+HEADER = [
+    "** %d independent routines, each a short loop of mixed arithmetic. Big enough that code **" % ROUTINES,
+    "** generation dominates the compile: `--time-report --assembler=nasm` gives the emit     **",
+    "** throughput in MB/s, and the wall time from isel to encode across `--threads=1,2,4,8`  **",
+    "** shows how code generation scales. Generated by ManyRoutines.py; edit that instead.    **",
+]
+
+
+def routine(i):
+    k = i * 7 + 3
+    return [
+        "@noinline routine r%d(A, B) {" % i,
+        "    Init s = A;",
+        "    for (Init i = 0; i < B; i = i + 1) {",
+        "        Init t = (s * %d + i) xor (s / %d);" % (k % 97 + 3, k % 13 + 2),
+        "        if (t > %d) { t = t - %d; }" % (100000 + k, 7 * k + 1),
+        "        s = (s + t * %d) and 1048575;" % (k % 29 + 1),
+        "    }",
+        "    Return s + %d;" % k,
+        "}",
+        "",
+    ]
+
+
+def main():
+    lines = HEADER + [""]
+    for i in range(ROUTINES):
+        lines += routine(i)
+    lines += ["Start | main |", "Init h = 1;"]
+    lines += ["h = r%d(h, %d);" % (i, 100 + i % 50) for i in range(ROUTINES)]
+    lines += ["print(h);", "Return;"]
+    print("\n".join(lines))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# Checks strength reduction against Python's arithmetic. Writes a NODE program that folds
+# x * c, x / c, x % c and x ^ k for constant c and k into one hash per dividend, or, with
+# --expected, the hashes the program must print. Build it with and without
+# --no-strength-reduce and compare both runs with the expected output:
+#
+#   python3 benchmarks/StrengthReduction.py > sr.node
+#   python3 benchmarks/StrengthReduction.py --expected > sr.expected
+#   ./nodec sr.node && ./output.exe | diff - sr.expected
+
+import sys
+
+MIN, MAX = -(1 << 63), (1 << 63) - 1
+
+DIVIDENDS = [
+    0, 1, -1, 2, -2, 7, -7, 100, -100, 12345, -12345,
+    4611686018427400249, -4611686018427388681, MAX, MIN, MIN + 1,
+    99999999999, -99999999999, 4095, -4095, 4096, -4096,
+    4865782901354085936, -7048155917072976836, -931725450029404348, -7491968275375482579,
+    4928188522590161285, -1007428432199280040, 5567713808534132990, 8213794561484772545,
+    -3367828769413532871, 8652272787646516959,
+    522223, -939098, 106519, -535079, 601597, -81684, 969575, 39793, 159430, -511187,
+]
+
+DIVISORS = [
+    2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 16, 25, 60, 64, 100, 125, 641, 1000, 1024, 4096, 65537,
+    1000000007, -1, -2, -3, -7, -8, -10, -1024, -641, 1, 1099511627779, -8589934592,
+    4611686018427387904, 3145728, 79792266297612001,
+]
+
+MULTIPLIERS = [
+    0, 1, -1, 2, 3, 5, 9, 6, 10, 12, 18, 36, 72, 7, 15, 17, 31, 33, 63, 65, 255, 257,
+    -3, -5, -9, -7, -17, 11, 13, 100, 1000, -1000, 1099511627776, 1099511627777,
+    12345678901, -6,
+]
+
+EXPONENTS = [0, 1, 2, 3, 5, 8, 13, 31, 64, 100]
+
+
+def wrap(x):
+    return (x - MIN) % (1 << 64) + MIN
+
+
+def literal(x):
+    return "-9223372036854775807 - 1" if x == MIN else str(x)
+
+
+def quotient(a, b):
+    q = abs(a) // abs(b)
+    return wrap(q if (a < 0) == (b < 0) else -q)
+
+
+def remainder(a, b):
+    return wrap(a - quotient(a, b) * b)
+
+
+def terms(v):
+    """(NODE operator, constant, value) for every term folded into the hash of v."""
+    out = []
+    for d in DIVISORS:
+        if v == MIN and d == -1:
+            continue    # overflows, and traps in idiv as well
+        out.append(("/", d, quotient(v, d)))
+        out.append(("%", d, remainder(v, d)))
+    for m in MULTIPLIERS:
+        out.append(("*", m, wrap(v * m)))
+    for k in EXPONENTS:
+        out.append(("^", k, wrap(pow(v, k, 1 << 64))))
+    return out
+
+
+def program():
+    lines = ["Start | main |", "Init v = 0;", "Init h = 0;"]
+    for v in DIVIDENDS:
+        lines.append("v = %s;" % literal(v))
+        for op, c, _ in terms(v):
+            lines.append("h = h * 31 + v %s %d;" % (op, c))
+        lines += ["print(h);", "h = 0;"]
+    lines.append("Return;")
+    return lines
+
+
+def expected():
+    lines = []
+    for v in DIVIDENDS:
+        h = 0
+        for _, _, value in terms(v):
+            h = wrap(h * 31 + value)
+        lines.append(str(h))
+    return lines
+
+
+if __name__ == "__main__":
+    print("\n".join(expected() if "--expected" in sys.argv[1:] else program()))